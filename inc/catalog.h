@@ -0,0 +1,260 @@
+/* clang-format off */
+
+#pragma once
+
+#include "ff.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+** The catalog is kept in SDRAM in exactly the layout of the library index file
+** (LIBRARY.IDX in the root of the card), so loading it is a single read of the
+** file and it is used in place without any parsing:
+**
+**   Catalog_Header                      at offset 0
+**   Catalog_Entry[header.count]         at offset header.entries
+**   string pool (NUL terminated)        at offset header.pool
+**
+** All values are little-endian, string fields are offsets into the string pool
+** and offset 0 is always the empty string.
+*/
+
+#define CATALOG_MAGIC   "MPIX"
+#define CATALOG_VERSION 6
+
+typedef struct {
+    char magic[4];          // CATALOG_MAGIC
+    uint16_t version;       // CATALOG_VERSION
+    uint16_t entry_size;    // sizeof(Catalog_Entry)
+    uint32_t count;         // number of entries
+    uint32_t entries;       // offset of the first entry
+    uint32_t pool;          // offset of the string pool
+    uint32_t pool_size;     // size of the string pool
+    uint32_t size;          // size of the whole index
+    uint32_t reserved;
+} Catalog_Header;
+
+typedef struct {
+    uint32_t name;          // directory name
+    uint32_t title;         // song title
+    uint32_t artist;        // song artist
+    uint32_t cluster;       // start cluster of the directory
+    uint32_t song_size;     // end of the audio in the song's file in bytes
+    uint32_t duration;      // length of the song in seconds
+    uint16_t date;          // FAT modification date of the directory
+    uint16_t time;          // FAT modification time of the directory
+    uint16_t cover_width;   // width of the cover in pixels (0:no cover)
+    uint16_t cover_height;  // height of the cover in pixels
+    uint32_t album;         // album of the song
+    uint16_t track;         // track number on the album (0:unknown)
+    uint16_t year;          // year of release (0:unknown)
+    uint32_t audio_offset;  // offset of the audio in the song's file
+    uint32_t cover_offset;  // offset of the cover in the song's file
+    uint32_t cover_size;    // size of the cover in the song's file (0:cover file)
+    int16_t gain;           // replay gain in hundredths of a dB
+    uint16_t flags;         // CATALOG_FLAG_*
+    uint32_t color;         // dominant color of the cover in ARGB8888 (0:unknown)
+    uint16_t reserved[2];
+} Catalog_Entry;
+
+// the song's file is a track container (track.pak) rather than song.raw
+#define CATALOG_FLAG_PACKED 0x0001
+// the cover file of the song is cover.png rather than cover.jpg
+#define CATALOG_FLAG_PNG    0x0002
+// the audio of song.raw is FLAC frames rather than PCM, there is no decoder
+// for them so the song is skipped
+#define CATALOG_FLAG_COMPRESSED 0x0004
+
+_Static_assert(sizeof(Catalog_Header) == 32, "Catalog_Header is part of the index file format");
+_Static_assert(sizeof(Catalog_Entry) == 64, "Catalog_Entry is part of the index file format");
+
+/*
+** The play order is an array of 16-byte sort keys in SDRAM, one per song,
+** holding the first 8 bytes of the string sorted by, its offset in the string
+** pool and the index of the song. A second array is sorted while the first
+** one is still being played from, so the order takes 32 bytes per song
+** (640KB for the largest catalog) on top of the catalog itself.
+*/
+typedef enum {
+    CATALOG_SORT_NAME,      // directory name
+    CATALOG_SORT_TITLE,     // song title, directory name if there is none
+    CATALOG_SORT_ARTIST,    // song artist, directory name if there is none
+} CATALOG_SORT;
+
+/*
+** A search of the titles and artists in the catalog, the matches are a range
+** of the search index that narrows as the query gets longer
+*/
+typedef struct {
+    uint32_t first;         // first match in the search index
+    uint32_t count;         // number of matches
+    uint32_t generation;    // search index the matches are in
+} Catalog_Search;
+
+// returned by Catalog_Find() when there is no such song
+#define CATALOG_NONE UINT32_MAX
+
+// longest a single Catalog_Process() slice is expected to take in microseconds
+#define CATALOG_SLICE_US 3000
+
+// colors of covers added before the library index file is written again
+#define CATALOG_SAVE_COLORS 16
+
+/*
+** Loads the catalog from the library index file on 'fs' and starts a rescan
+** of the card in the background, if the index is missing the catalog is built
+** from the directories in the root of 'fs' before returning
+** Returns 'true' if there is a usable catalog
+*/
+bool Catalog_Init(FATFS *fs);
+
+/*
+** Builds the catalog of songs from the directories in the root of 'fs' and
+** writes the library index file, entries of the current catalog whose
+** directory hasn't changed are reused as they are
+** Returns 'true' if the root directory could be read
+*/
+bool Catalog_Build(FATFS *fs);
+
+/*
+** Starts comparing the directories in the root of the card with the catalog,
+** the work is done in slices by Catalog_Process()
+** Returns 'true' if a rescan is running
+*/
+bool Catalog_StartRescan(void);
+
+/*
+** Does one slice of the running sort or rescan, a slice looks up or reads at
+** most a few sectors of a file or two, or does a bounded part of a sort or of
+** the table of directory names, so it can be done between two refills of the
+** audio buffer. Directories with the same start cluster and timestamp as
+** their entry are kept as they are, only changed and new ones have their
+** song, meta.txt (or the tags of the song) and cover read, or just the header
+** of their track container. If anything changed the new catalog is sorted,
+** replaces the active one and is then written to a temporary file that
+** replaces the library index file, as is the active one once enough colors of
+** covers were added to it. Whenever the catalog changed its search index is
+** made again
+** Returns 'true' if there is still work left to do
+*/
+bool Catalog_Process(void);
+
+/*
+** Returns the number of songs in the catalog
+*/
+uint32_t Catalog_Count(void);
+
+/*
+** Returns the entry of song 'index'
+*/
+const Catalog_Entry *Catalog_Get(uint32_t index);
+
+/*
+** Returns the string at 'offset' in the string pool
+*/
+const char *Catalog_String(uint32_t offset);
+
+/*
+** Starts sorting the play order by 'sort', the work is done in slices by
+** Catalog_Process() and the order changes once the sort is done
+*/
+void Catalog_Sort(CATALOG_SORT sort);
+
+/*
+** Returns 'true' while a sort started by Catalog_Sort() is still running
+*/
+bool Catalog_IsSorting(void);
+
+/*
+** Returns the index of the song at 'position' in the play order
+*/
+uint32_t Catalog_Sorted(uint32_t position);
+
+/*
+** Returns the position of song 'index' in the play order, or CATALOG_NONE if
+** it isn't in it. The whole order is searched
+*/
+uint32_t Catalog_Position(uint32_t index);
+
+#ifdef CATALOG_BENCHMARK
+/*
+** Sorts the play order by directory name, title and artist in turn, each
+** one to completion, and prints the time each took from start to finish over
+** UART next to the CPU time the sort prints itself. The order is left sorted
+** by directory name
+*/
+void Catalog_Benchmark(void);
+#endif
+
+/*
+** Returns a number that changes every time a rescan replaces the catalog,
+** song indexes from an older generation must be looked up again
+*/
+uint32_t Catalog_Generation(void);
+
+/*
+** Looks up the song in the directory whose name is the first 'len'
+** characters of 'name', letter case is ignored like FAT does. The first
+** lookup after the catalog changed hashes all directory names
+** Returns the index of the song, or CATALOG_NONE if there is no such directory
+*/
+uint32_t Catalog_Find(const char *name, uint32_t len);
+
+/*
+** Starts a search that matches every title and artist in the catalog
+** Returns 'false' if the search index is still being made
+*/
+bool Catalog_SearchStart(Catalog_Search *search_range);
+
+/*
+** Narrows 'search_range' to the titles and artists that start with the first
+** 'len' characters of 'query', letter case is ignored and any character that
+** isn't a letter or digit matches any other such character. Only the matches
+** of the last narrowing are searched, so 'query' has to start with the query
+** it was last narrowed with
+** Returns 'false' if the search index changed since the search started
+*/
+bool Catalog_SearchNarrow(Catalog_Search *search_range, const char *query, uint32_t len);
+
+/*
+** Returns the index of the song of match 'n' of 'search_range'
+*/
+uint32_t Catalog_SearchResult(const Catalog_Search *search_range, uint32_t n);
+
+/*
+** Keeps 'color' as the dominant color of the cover of song 'index' in its
+** entry, the library index file is written again in the background once
+** CATALOG_SAVE_COLORS colors were added
+*/
+void Catalog_SetColor(uint32_t index, uint32_t color);
+
+/*
+** Opens the file 'name' in the directory of song 'index', the directory is
+** found by its start cluster so no path lookup is needed, or by its name the
+** first time if the index came without clusters
+** Returns the result of f_open()
+*/
+FRESULT Catalog_Open(uint32_t index, FIL *file, const char *name, BYTE mode);
+
+/*
+** Opens the file holding the audio of song 'index' for reading, its track
+** container if it has one and its song.raw otherwise. The audio and any
+** embedded cover are at the offsets in its entry
+** Returns the result of f_open()
+*/
+FRESULT Catalog_OpenSong(uint32_t index, FIL *file);
+
+/*
+** Opens the file holding the cover of song 'index' for reading, its song's
+** file if the cover is embedded at the offset in its entry and its cover.jpg
+** or cover.png otherwise. The one the rescan found is tried first
+** Returns the result of f_open()
+*/
+FRESULT Catalog_OpenCover(uint32_t index, FIL *file);
+
+/*
+** Returns a key for song 'index' that stays the same across rescans and
+** reboots as long as its directory and cover don't change, made of the hash
+** of its directory name and the timestamp of the directory and its cover
+*/
+uint64_t Catalog_SongKey(uint32_t index);
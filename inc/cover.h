@@ -5,6 +5,13 @@
 #include "ff.h"
 
 #include <stdbool.h>
+#include <stdint.h>
+
+// longest a single Cover_Process() call is expected to take in microseconds
+#define COVER_SLICE_US 2000
+
+// key of a cover that isn't cached
+#define COVER_NO_KEY 0
 
 /*
 ** Initializes everything needed for displaying the album cover
@@ -13,7 +20,102 @@
 bool Cover_Init(void);
 
 /*
-** Displays the jpeg image in 'file' in the center of the LCD screen
+** Displays the jpeg or png image in 'file' in the center of the LCD screen
 ** Returns 'true' if everything initializes correctly
 */
 bool Cover_Display(FIL *file);
+
+/*
+** Displays the jpeg or png image of 'size' bytes at 'offset' in 'file' in
+** the center of the LCD screen, so a cover embedded in the tags of a song is
+** decoded in place
+** Returns 'true' if everything initializes correctly
+*/
+bool Cover_DisplayAt(FIL *file, FSIZE_t offset, uint32_t size);
+
+/*
+** Starts copying the cover cached for 'key' to the screen, Cover_Process()
+** finishes the copy. A cover that is still being decoded is stopped
+** Returns 'false' if the cover isn't cached
+*/
+bool Cover_StartCached(uint64_t key);
+
+/*
+** Returns 'true' if the cover for 'key' is cached
+*/
+bool Cover_IsCached(uint64_t key);
+
+/*
+** Starts decoding the jpeg or png image of 'size' bytes at 'offset' in 'file'
+** straight into the cache without showing it, so Cover_StartCached() finds
+** it later. Cover_Process() does the rest like for Cover_Start() and
+** Cover_Stop() drops a prefetch that isn't done yet
+** Returns 'true' if the decode started
+*/
+bool Cover_Prefetch(FIL *file, FSIZE_t offset, uint32_t size, uint64_t key);
+
+/*
+** Starts decoding the jpeg or png image of 'size' bytes at 'offset' in 'file'
+** and returns right away, the JPEG interrupt and Cover_Process() do the rest
+** and the image appears in the center of the LCD screen once it is done,
+** scaled down to fit 400x400 if it is larger. It is decoded into the
+** framebuffer being drawn into, so LCD_Present() mustn't be called until
+** then. 'file' must stay open until then and a cover that is still being
+** decoded is stopped. Unless 'key' is COVER_NO_KEY the decoded cover is cached
+** for Cover_StartCached()
+** Returns 'true' if the decode started
+*/
+bool Cover_Start(FIL *file, FSIZE_t offset, uint32_t size, uint64_t key);
+
+/*
+** Does the part of displaying the cover that can't be done in the JPEG
+** interrupt: reading more of the file and color converting the MCUs decoded
+** so far straight into the framebuffer being drawn into, or scaling them down
+** first for a cover larger than 400x400, then copying the cover into the
+** cache with the DMA2D. A png is decoded here a few rows at a time instead
+** and a cached cover is copied to the screen. A call takes at most about
+** COVER_SLICE_US
+** Returns 'true' while the cover isn't on the screen or in the cache yet
+*/
+bool Cover_Process(void);
+
+/*
+** Stops decoding the cover, the part of it that is already on the screen
+** stays there. A copy to or from the cache that already started is finished
+** first
+*/
+void Cover_Stop(void);
+
+/*
+** Leaves the place of the cover blank from the next LCD_Present() on, for a
+** song without one
+*/
+void Cover_Blank(void);
+
+/*
+** Returns the dominant color of the cover last put on the screen or into the
+** cache in ARGB8888, the average color of the most common of the color bins
+** one pixel of every MCU (or of every 8x8 pixels of a png) went into while it
+** was converted. A cached cover keeps its color
+** Returns 0 if the cover didn't finish or has no colors to bin (CMYK)
+*/
+uint32_t Cover_Color(void);
+
+/*
+** Reads the width and height of the jpeg or png image at the current position
+** of 'file' from its frame header or image header without decoding it, the
+** file is seeked back to where the image starts afterwards
+** Returns 'true' if a header was found
+*/
+bool Cover_ReadSize(FIL *file, uint16_t *width, uint16_t *height);
+
+#ifdef COVER_BENCHMARK
+/*
+** Color converts a 400x400 image of made up MCUs of each subsampling into a
+** slot of the cache, binning their colors like a decode does, and prints the
+** cycles per MCU and the time per image of each over UART. Then decodes a
+** made up 400x400 png from another slot and prints the time it took. The
+** cache must not hold any covers yet
+*/
+void Cover_Benchmark(void);
+#endif
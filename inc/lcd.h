@@ -3,15 +3,45 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef enum {
     TS_INPUT_NONE,
     TS_INPUT_PAUSE_PLAY,
     TS_INPUT_SKIP,
     TS_INPUT_VOL_UP,
-    TS_INPUT_VOL_DOWN
+    TS_INPUT_VOL_DOWN,
+    TS_INPUT_PREV,
+    TS_INPUT_SHUFFLE,
+    TS_INPUT_SEARCH,
+    TS_INPUT_SORT
 } TS_Input;
 
+// keys returned by LCD_GetKey() besides letters, digits and space
+#define LCD_KEY_NONE   0
+#define LCD_KEY_DELETE '\b'
+#define LCD_KEY_EXIT   0x1B
+// LCD_KEY_RESULT + n is the n-th search result
+#define LCD_KEY_RESULT 0x80
+
+// number of search results shown at once
+#define LCD_SEARCH_RESULTS 8
+
+/*
+** Pixel format of the screen and of every buffer copied to it, RGB565 when
+** built with -DLCD_RGB565 (half the memory and SDRAM bandwidth) and ARGB8888
+** otherwise. Colors are always given in ARGB8888
+*/
+#ifdef LCD_RGB565
+#define LCD_BYTES_PER_PIXEL 2
+#define LCD_DMA2D_OUTPUT    DMA2D_OUTPUT_RGB565
+#define LCD_DMA2D_INPUT     DMA2D_INPUT_RGB565
+#else
+#define LCD_BYTES_PER_PIXEL 4
+#define LCD_DMA2D_OUTPUT    DMA2D_OUTPUT_ARGB8888
+#define LCD_DMA2D_INPUT     DMA2D_INPUT_ARGB8888
+#endif
+
 /*
 ** Initializes everything needed for LCD and TS
 ** Returns 'true' if everything intialized correctly
@@ -19,13 +49,23 @@ typedef enum {
 bool LCD_Init(void);
 
 /*
-** Displays the song title
+** Switches the UI to colors that go with a cover whose dominant color is
+** 'color': it becomes the background and the text is dark or light,
+** whichever stands out. The default colors come back for 0. If the colors
+** changed the whole screen is drawn again
+** Returns 'true' if the screen was cleared, so the cover has to be drawn
+** again
+*/
+bool LCD_SetTheme(uint32_t color);
+
+/*
+** Displays the song title from the next LCD_Present() on
 ** Returns 'true' if everything initializes correctly
 */
 bool LCD_SongTitle(char *title);
 
 /*
-** Displays the song artist
+** Displays the song artist from the next LCD_Present() on
 ** Returns 'true' if everything initializes correctly
 */
 bool LCD_SongArtist(char *artist);
@@ -45,7 +85,120 @@ void LCD_DrawPlay(void);
 */
 void LCD_DrawPause(void);
 
+/*
+** Displays whether shuffle is 'on'
+*/
+void LCD_DrawShuffle(bool on);
+
+/*
+** Displays 'label' (at most 6 characters) on the sort button as what the play
+** order is sorted by
+*/
+void LCD_DrawSort(const char *label);
+
 /*
 ** Returns enum value of user input
 */
 TS_Input LCD_GetUserInput(void);
+
+/*
+** Returns the key of the search keyboard that was touched, LCD_KEY_RESULT + n
+** for the n-th search result or LCD_KEY_NONE
+*/
+int LCD_GetKey(void);
+
+/*
+** Copies the screen as drawn so far to SDRAM with the DMA2D, nothing may be
+** drawn until LCD_IsBusy() returns 'false'
+** Returns 'true' if the copy started
+*/
+bool LCD_SaveScreen(void);
+
+/*
+** Copies the screen saved by LCD_SaveScreen() back with the DMA2D, it is
+** shown by the next LCD_Present(). Nothing may be drawn until LCD_IsBusy()
+** returns 'false'
+** Returns 'true' if the copy started
+*/
+bool LCD_RestoreScreen(void);
+
+/*
+** Returns 'true' while a copy of the screen is in progress, or while the
+** frame last presented isn't on the screen and copied into the other
+** framebuffer yet. Nothing may be drawn until it returns 'false'
+*/
+bool LCD_IsBusy(void);
+
+/*
+** Draws the widgets in the dirty rectangles again, then shows everything
+** drawn since the last call at the next vertical blanking by swapping the
+** framebuffer the LTDC scans out. The regions that were drawn are then copied
+** into the other framebuffer with the DMA2D and drawing carries on there.
+** Nothing may be drawn until LCD_IsBusy() returns 'false'
+** Returns 'false' if nothing was drawn or the last frame isn't done yet
+*/
+bool LCD_Present(void);
+
+/*
+** Marks the 'width' by 'height' pixels at 'x', 'y' as drawn since the last
+** LCD_Present(), for pixels written into LCD_DrawBuffer() without the
+** drawing functions
+*/
+void LCD_MarkDrawn(uint16_t x, uint16_t y, uint16_t width, uint16_t height);
+
+/*
+** Fills the 'width' by 'height' pixels at 'x', 'y' with the background from
+** the next LCD_Present() on, the widgets in them are drawn again
+*/
+void LCD_Clear(uint16_t x, uint16_t y, uint16_t width, uint16_t height);
+
+/*
+** Returns the address of the framebuffer being drawn into, it changes once a
+** frame presented by LCD_Present() is on the screen
+*/
+uint32_t LCD_DrawBuffer(void);
+
+/*
+** Prints the frames presented since the last call, the average and longest
+** time from LCD_Present() until drawing could carry on (the wait for the
+** vertical blanking and the copies), the average and most pixels drawn per
+** frame and the bytes copied between the framebuffers over UART
+*/
+void LCD_PrintStats(void);
+
+/*
+** Returns the number of characters of the current font that fit across the
+** screen
+*/
+uint32_t LCD_LineLength(void);
+
+/*
+** Clears the screen and draws the search keyboard
+*/
+void LCD_DrawKeyboard(void);
+
+/*
+** Displays the search 'query' and the number of 'matches', or that the search
+** index isn't 'ready' yet
+*/
+void LCD_DrawSearch(const char *query, uint32_t matches, bool ready);
+
+/*
+** Displays 'text' as search result 'row', or clears the row if 'text' is NULL
+*/
+void LCD_DrawSearchResult(uint32_t row, const char *text);
+
+/*
+** Draws the latency histogram of the song reads along the bottom of the screen
+*/
+void LCD_DrawDiskStats(void);
+
+#ifdef LCD_BENCHMARK
+/*
+** Times a copy of the whole screen to SDRAM and back with the DMA2D, a fill
+** of the whole screen and a present of the whole screen, then prints the
+** bytes moved and the throughput of each over UART next to the bytes the
+** LTDC reads per frame. Build with and without -DLCD_RGB565 to compare them
+*/
+void LCD_Benchmark(void);
+#endif
@@ -0,0 +1,66 @@
+/* clang-format off */
+
+#pragma once
+
+#include "ff.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// most bytes of meta.txt that are read
+#define META_MAX_SIZE 512
+// bytes read at once from the tags at the start of a song, at most two such
+// reads are done
+#define META_TAG_READ 2048
+// longest text taken from a tag, in bytes of UTF-8
+#define META_TAG_TEXT 128
+// buffer needed by Meta_ReadTags(), the two reads and the converted text
+#define META_TAG_BUFFER (2 * META_TAG_READ + 3 * META_TAG_TEXT)
+
+// a string inside the buffer that was parsed, not terminated
+typedef struct {
+    const char *str;
+    uint32_t len;
+} Meta_String;
+
+typedef struct {
+    Meta_String title;
+    Meta_String artist;
+    Meta_String album;
+    uint32_t track;     // track number (0:unknown)
+    uint32_t year;      // year of release (0:unknown)
+    int32_t gain;       // replay gain in hundredths of a dB
+    FSIZE_t audio;      // offset of the audio after the tags of a song
+    FSIZE_t cover;      // offset of the jpeg or png cover embedded in the tags
+    uint32_t cover_size; // size of the embedded cover (0:none)
+    bool compressed;    // the audio isn't PCM (FLAC frames) and can't be played
+} Meta_Info;
+
+/*
+** Parses the 'len' bytes of a meta.txt in 'buf' into 'info'. Lines are
+** "key=value" with the keys title, artist, album, track, year and gain (in dB,
+** e.g. "-6.5 dB"), keys ignore letter case and lines starting with '#' are
+** comments. A file without any of the keys is read the old way, title on the
+** first line and artist on the second. Lines can end in "\n" or "\r\n", a
+** UTF-8 byte order mark is skipped and values are kept as they are
+*/
+void Meta_Parse(const char *buf, uint32_t len, Meta_Info *info);
+
+/*
+** Returns the length of the longest start of the 'len' bytes of UTF-8 in
+** 'str' that is at most 'max' bytes and doesn't cut a character in half
+*/
+uint32_t Meta_Clip(const char *str, uint32_t len, uint32_t max);
+
+/*
+** Reads the ID3v2 tag or the FLAC metadata blocks at the start of the song
+** in 'file' into 'info' with one or two reads of META_TAG_READ bytes. The
+** title, artist, album, track number, year and replay gain are taken from the
+** text frames or Vorbis comments and are converted to UTF-8 in 'buffer', which
+** must hold META_TAG_BUFFER bytes and be kept for as long as the strings are
+** used. A jpeg or png in an APIC frame or PICTURE block is found by its
+** offset in the file, a front cover is preferred, so it can be decoded in
+** place. The audio after FLAC metadata blocks is FLAC frames, not PCM, so
+** the song is marked as compressed
+** Returns 'false' if the song has no tags
+*/
+bool Meta_ReadTags(FIL *file, char *buffer, Meta_Info *info);
@@ -18,6 +18,13 @@ bool Music_Init(void);
 */
 bool Music_Start(FIL *file);
 
+/*
+** Start playing the 'size' bytes of music data at 'offset' in 'file', like the
+** audio after the tags of a song
+** Returns 'true' if music starts successfully
+*/
+bool Music_StartAt(FIL *file, FSIZE_t offset, FSIZE_t size);
+
 /*
 ** Stops the music that is currently being played
 */
@@ -53,3 +60,18 @@ uint32_t Music_GetVolume(void);
 ** Returns 'true' if should play the next song
 */
 bool Music_Process(void);
+
+/*
+** Returns the time in microseconds until Music_Process() has to refill the
+** audio buffer, 0 if a refill is already due
+*/
+uint32_t Music_TimeToRefill(void);
+
+#ifdef MUSIC_BENCHMARK
+/*
+** Reads all of 'file' once through FatFs and once with raw sector reads (if
+** the file is contiguous) and prints the throughput and cycles spent for each
+** over UART. The file is rewound afterwards
+*/
+void Music_Benchmark(FIL *file);
+#endif
@@ -0,0 +1,50 @@
+/* clang-format off */
+
+#pragma once
+
+#include "ff.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+** A track container (track.pak) holds everything of a song in one file so it
+** takes a single open to play it:
+**
+**   Pack_Header                         at offset 0
+**   meta.txt contents (key=value)       at offset header.meta
+**   cover jpeg                          at offset header.cover
+**   raw audio, 16-bit stereo at 44.1kHz at offset header.audio
+**
+** The audio starts on a PACK_ALIGN boundary so it can be read with raw sector
+** reads straight into the audio buffer. All values are little-endian and an
+** empty region has offset and size 0.
+*/
+
+#define PACK_FILE    "track.pak"
+#define PACK_MAGIC   "MPAK"
+#define PACK_VERSION 1
+#define PACK_ALIGN   512
+// bytes read at the start of a container, the header and usually the metadata
+#define PACK_HEADER_READ 512
+
+typedef struct {
+    char magic[4];          // PACK_MAGIC
+    uint16_t version;       // PACK_VERSION
+    uint16_t header_size;   // sizeof(Pack_Header)
+    uint32_t meta;          // offset of the metadata
+    uint32_t meta_size;     // size of the metadata
+    uint32_t cover;         // offset of the cover jpeg
+    uint32_t cover_size;    // size of the cover jpeg
+    uint32_t audio;         // offset of the audio
+    uint32_t audio_size;    // size of the audio
+} Pack_Header;
+
+_Static_assert(sizeof(Pack_Header) == 32, "Pack_Header is part of the container format");
+
+/*
+** Reads the first PACK_HEADER_READ bytes of the container in 'file' into
+** 'buffer' and copies its header to 'header', every region is checked to lie
+** within the file and the audio to start on a PACK_ALIGN boundary
+** Returns 'false' if 'file' isn't a usable container
+*/
+bool Pack_ReadHeader(FIL *file, uint8_t *buffer, Pack_Header *header);
@@ -0,0 +1,25 @@
+/* clang-format off */
+
+#pragma once
+
+#include "stm32f7xx_hal.h"
+#include <stdint.h>
+
+/*
+** Enables the DWT cycle counter used for all timing measurements
+*/
+void Perf_Init(void);
+
+/*
+** Returns the current value of the DWT cycle counter
+*/
+static inline uint32_t Perf_Cycles(void) {
+    return DWT->CYCCNT;
+}
+
+/*
+** Converts a number of cycles into microseconds
+*/
+static inline uint32_t Perf_CyclesToUs(uint32_t cycles) {
+    return cycles / (SystemCoreClock / 1000000);
+}
@@ -0,0 +1,24 @@
+/* clang-format off */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+** Loads the M3U/M3U8 playlist 'path' in one pass through a small buffer,
+** each entry is resolved to a song of the catalog by the name of its directory
+** (the first part of its path) and entries that aren't in the catalog are
+** skipped
+** Returns the number of songs in the playlist, 0 if it couldn't be read
+*/
+uint32_t Playlist_Load(const char *path);
+
+/*
+** Returns the number of songs in the playlist
+*/
+uint32_t Playlist_Count(void);
+
+/*
+** Returns the catalog index of the song at 'position' in the playlist
+*/
+uint32_t Playlist_Get(uint32_t position);
@@ -0,0 +1,72 @@
+/* clang-format off */
+
+#pragma once
+
+#include "ff.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+** A png is decoded one row at a time while it is streamed from the card: the
+** file is read in chunks of whole sectors, the image data is inflated through
+** a 32KB window in SDRAM and each row is unfiltered against the one above it
+** and written out in the pixel format of the screen. Every bit depth and color
+** type can be decoded, 16-bit samples are cut to 8 bits and alpha is ignored,
+** but interlaced images aren't supported
+*/
+
+// widest png that can be decoded, two of its rows are kept in SDRAM
+#define PNG_MAX_WIDTH 8192
+
+/*
+** Returns 'true' if the image at the current position of 'file' starts with
+** the png signature, the file is seeked back to where the image starts
+*/
+bool Png_IsPng(FIL *file);
+
+/*
+** Reads the width and height of the png image at the current position of
+** 'file' from its header without decoding it, the file is seeked back to
+** where the image starts afterwards
+** Returns 'true' if it is a png
+*/
+bool Png_ReadSize(FIL *file, uint16_t *width, uint16_t *height);
+
+/*
+** Starts decoding the png image of 'size' bytes at 'offset' in 'file', its
+** chunks are read up to the start of the image data and its size is put in
+** 'width' and 'height'. 'file' must stay open until every row is decoded
+** Returns 'false' if it isn't a png that can be decoded
+*/
+bool Png_Start(FIL *file, FSIZE_t offset, uint32_t size, uint32_t *width, uint32_t *height);
+
+/*
+** Inflates and unfilters the next row of the image and writes its pixels to
+** 'destination' in the pixel format of the screen, reading more of the file
+** whenever the image data runs out
+** Returns 'false' if the image is broken or has no rows left
+*/
+bool Png_Row(void *destination);
+
+/*
+** Returns the number of bytes of the png read from the card since it started
+*/
+uint32_t Png_BytesRead(void);
+
+#ifdef COVER_BENCHMARK
+/*
+** Writes a made up RGB png of 'width' by 'height' to 'data', its rows use
+** every filter in turn and its image data is deflated with fixed codes, both
+** literals and matches, like a real cover. Its CRCs and checksum are left
+** out as the decoder doesn't check them. 'width' can be at most 1024
+** Returns the size of the png
+*/
+uint32_t Png_MakeBenchmark(uint8_t *data, uint32_t width, uint32_t height);
+
+/*
+** Starts decoding the png image of 'size' bytes at 'data' like Png_Start()
+** does for a file, so the decoding can be timed without the card
+** Returns 'false' if it isn't a png that can be decoded
+*/
+bool Png_StartMemory(const uint8_t *data, uint32_t size, uint32_t *width, uint32_t *height);
+#endif
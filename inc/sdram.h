@@ -0,0 +1,45 @@
+/* clang-format off */
+
+#pragma once
+
+/*
+** Layout of the 16MB external SDRAM (0xC0000000 - 0xC0FFFFFF)
+*/
+
+// two LCD framebuffers, 480x800 ARGB8888 (1.5MB each), one is on the screen
+// while the other is drawn into. Only the first 750KB of each are used with
+// -DLCD_RGB565
+#define LCD_FRAME_BUFFER_0      0xC0000000
+#define LCD_FRAME_BUFFER_1      0xC0180000
+// band of MCU rows of a cover being scaled down, 16 lines of up to 8192
+// ARGB8888 (or 16384 RGB565) pixels (512KB)
+#define SDRAM_COVER_BAND        0xC0300000
+#define SDRAM_COVER_BAND_SIZE   0x00080000
+// inflate window of a png cover (32KB)
+#define SDRAM_PNG_WINDOW        0xC0380000
+#define SDRAM_PNG_WINDOW_SIZE   0x00008000
+// row of a png cover being unfiltered and the row above it, each up to 8192
+// pixels of 16-bit RGBA and a filter byte (132KB)
+#define SDRAM_PNG_ROWS          0xC0388000
+#define SDRAM_PNG_ROWS_SIZE     0x00021000
+// 0xC03A9000 - 0xC03FFFFF is unused (348KB)
+// copy of the screen while the search keyboard covers it (1.5MB)
+#define SDRAM_SCREEN_SAVE       0xC0400000
+// catalog of songs on the SD card (6MB)
+#define SDRAM_CATALOG           0xC0600000
+#define SDRAM_CATALOG_SIZE      0x00600000
+// sort keys of the catalog, two arrays of 16 bytes per song (640KB)
+#define SDRAM_CATALOG_KEYS      0xC0C00000
+#define SDRAM_CATALOG_KEYS_SIZE 0x000A0000
+// table of the catalog's directory names (128KB)
+#define SDRAM_CATALOG_HASH      0xC0CA0000
+#define SDRAM_CATALOG_HASH_SIZE 0x00020000
+// songs of the loaded playlist (128KB)
+#define SDRAM_PLAYLIST          0xC0CC0000
+#define SDRAM_PLAYLIST_SIZE     0x00020000
+// search index of the catalog, two keys of 16 bytes per song (640KB)
+#define SDRAM_CATALOG_SEARCH      0xC0CE0000
+#define SDRAM_CATALOG_SEARCH_SIZE 0x000A0000
+// decoded covers ready to be copied to the screen (2.5MB)
+#define SDRAM_COVER_CACHE       0xC0D80000
+#define SDRAM_COVER_CACHE_SIZE  0x00280000
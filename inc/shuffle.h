@@ -0,0 +1,23 @@
+/* clang-format off */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+** Shuffles 'count' positions without storing the shuffle: a Feistel network
+** over the smallest even number of bits that holds 'count' is a bijection, and
+** positions it maps past the end are fed through it again until they land in
+** range. 'seed' picks the shuffle, the same seed always gives the same one.
+*/
+
+/*
+** Returns where 'position' (< 'count') goes in the shuffle made from 'seed',
+** every position in [0, count) is returned for exactly one 'position'
+*/
+uint32_t Shuffle_Position(uint32_t position, uint32_t count, uint32_t seed);
+
+/*
+** Returns the position that Shuffle_Position() moves to 'shuffled'
+*/
+uint32_t Shuffle_Inverse(uint32_t shuffled, uint32_t count, uint32_t seed);
@@ -144,7 +144,8 @@ typedef struct __JPEG_MCU_RGB_ConvertorTypeDef
   uint32_t V_factor;
 
   uint32_t WidthExtend;
-  uint32_t ScaledWidth;
+  uint32_t ScaledWidth;   /* bytes from one output line to the next */
+  uint32_t ClipWidth;     /* columns written of each output line */
   
   uint32_t MCU_Total_Nb;
   
@@ -227,6 +228,60 @@ typedef struct __JPEG_MCU_RGB_ConvertorTypeDef
 /* Private macro -------------------------------------------------------------*/
 #if (USE_JPEG_DECODER == 1)
 #define CLAMP(value) CLAMP_LUT[(value) + 0x100] /* Range limitting macro */
+#define MIN(val1,val2) ((val1 < val2) ? val1 : val2)
+
+/* Store one pixel of already clamped color components */
+#if (JPEG_RGB_FORMAT == JPEG_ARGB8888)
+  #define JPEG_PUT_PIXEL(pOut, red, green, blue)                 \
+    (*(__IO uint32_t *)(pOut) = (0xFFUL << JPEG_ALPHA_OFFSET)   | \
+                                ((red) << JPEG_RED_OFFSET)      | \
+                                ((green) << JPEG_GREEN_OFFSET)  | \
+                                ((blue) << JPEG_BLUE_OFFSET))
+#elif (JPEG_RGB_FORMAT == JPEG_RGB888)
+  #define JPEG_PUT_PIXEL(pOut, red, green, blue)                 \
+    do {                                                         \
+      (pOut)[JPEG_RED_OFFSET/8]   = (red);                       \
+      (pOut)[JPEG_GREEN_OFFSET/8] = (green);                     \
+      (pOut)[JPEG_BLUE_OFFSET/8]  = (blue);                      \
+    } while(0)
+#elif (JPEG_RGB_FORMAT == JPEG_RGB565)
+  #define JPEG_PUT_PIXEL(pOut, red, green, blue)                 \
+    (*(__IO uint16_t *)(pOut) = (((red) >> 3) << JPEG_RED_OFFSET)     | \
+                                (((green) >> 2) << JPEG_GREEN_OFFSET) | \
+                                (((blue) >> 3) << JPEG_BLUE_OFFSET))
+#endif /* JPEG_RGB_FORMAT */
+
+/* Store one pixel from its luminance and the color offsets of its chrominance */
+#define JPEG_PUT_YCBCR(pOut, ycomp, c_red, c_green, c_blue)     \
+  JPEG_PUT_PIXEL(pOut, CLAMP((ycomp) + (c_red)), CLAMP((ycomp) + (c_green)), CLAMP((ycomp) + (c_blue)))
+
+/* With the Cortex-M7 DSP extension the YCbCr kernels add and clamp two 16-bit
+   color components per instruction: red and blue of one ARGB8888 pixel, or
+   green of two pixels. The scalar path gives exactly the same pixels */
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1) && (JPEG_RGB_FORMAT == JPEG_ARGB8888)
+  #define JPEG_USE_DSP             1
+#else
+  #define JPEG_USE_DSP             0
+#endif
+
+#if (JPEG_USE_DSP == 1)
+/* Red and blue color offsets in the halfwords of the pixel they are added to */
+#if (JPEG_RED_OFFSET == 16)
+  #define JPEG_PACK_RB(c_red, c_blue)  __PKHBT((uint32_t)(c_blue), (uint32_t)(c_red), 16)
+#else
+  #define JPEG_PACK_RB(c_red, c_blue)  __PKHBT((uint32_t)(c_red), (uint32_t)(c_blue), 16)
+#endif
+
+/* Green color offset of a chrominance: CR_GREEN_LUT[Cr] + CB_GREEN_LUT[Cb] as one
+   dual multiply-accumulate of (2*Cb, 2*Cr) with the halved coefficients */
+#define JPEG_GREEN_CB_COEF   (-((int32_t) ((0.34414 / 2) * (1L << 16))))
+#define JPEG_GREEN_CR_COEF   (-((int32_t) ((0.71414 / 2) * (1L << 16))))
+#define JPEG_GREEN_COEFS     __PKHBT((uint32_t)JPEG_GREEN_CB_COEF, (uint32_t)JPEG_GREEN_CR_COEF, 16)
+#define JPEG_GREEN_BIAS      (-256 * (JPEG_GREEN_CB_COEF + JPEG_GREEN_CR_COEF))
+#define JPEG_GREEN(cbcomp, crcomp)                                                               \
+  ((int32_t)__SMLAD(__PKHBT((uint32_t)(cbcomp), (uint32_t)(crcomp), 16) << 1, JPEG_GREEN_COEFS,    \
+                    (uint32_t)JPEG_GREEN_BIAS) >> 16)
+#endif /* JPEG_USE_DSP */
 #endif
 #if (USE_JPEG_ENCODER == 1)
 #define MAX(val1,val2) ((val1 > val2) ? val1 : val2)
@@ -1105,6 +1160,49 @@ HAL_StatusTypeDef JPEG_GetEncodeColorConvertFunc(JPEG_ConfTypeDef *pJpegInfo, JP
 #endif /* USE_JPEG_ENCODER == 1 */
 
 #if (USE_JPEG_DECODER == 1)
+/**
+  * @brief  Number of columns of an MCU that are written to the frame buffer
+  * @param  x        : first column of the MCU in the image.
+  * @param  H_factor : width of the MCU.
+  * @retval Columns of the MCU left of JPEG_ConvertorParams.ClipWidth
+  */
+static uint32_t JPEG_MCU_Columns(uint32_t x, uint32_t H_factor)
+{
+  if(x >= JPEG_ConvertorParams.ClipWidth)
+  {
+    return 0;
+  }
+  return MIN(H_factor, JPEG_ConvertorParams.ClipWidth - x);
+}
+
+#if (JPEG_USE_DSP == 1)
+/**
+  * @brief  Store two neighbouring pixels from their luminance and color offsets
+  * @param  pOut   : address of the first pixel.
+  * @param  y0     : luminance of the first pixel.
+  * @param  y1     : luminance of the second pixel.
+  * @param  c_rb0  : red and blue offsets of the first pixel, packed by JPEG_PACK_RB.
+  * @param  c_rb1  : red and blue offsets of the second pixel, packed by JPEG_PACK_RB.
+  * @param  c_gg   : green offsets of the first and second pixel in the low and high halfword.
+  * @param  second : store the second pixel too when not 0.
+  * @retval None
+  */
+__STATIC_INLINE void JPEG_PutYCbCr2(uint8_t *pOut, uint32_t y0, uint32_t y1, uint32_t c_rb0, uint32_t c_rb1,
+                                    uint32_t c_gg, uint32_t second)
+{
+  uint32_t green = __USAT16(__QADD16(__PKHBT(y0, y1, 16), c_gg), 8);
+
+  *(__IO uint32_t *)pOut = (0xFFUL << JPEG_ALPHA_OFFSET) | __USAT16(__QADD16(y0 * 0x00010001UL, c_rb0), 8) |
+                           ((green & 0xFFUL) << JPEG_GREEN_OFFSET);
+  if(second)
+  {
+    *(__IO uint32_t *)(pOut + JPEG_BYTES_PER_PIXEL) = (0xFFUL << JPEG_ALPHA_OFFSET) |
+                                                      __USAT16(__QADD16(y1 * 0x00010001UL, c_rb1), 8) |
+                                                      ((green >> 16) << JPEG_GREEN_OFFSET);
+  }
+}
+#endif /* JPEG_USE_DSP */
+
 /**
   * @brief  Convert YCbCr 4:2:0 blocks to RGB pixels  
   * @param  pInBuffer  : pointer to input YCbCr blocks buffer.
@@ -1122,17 +1220,22 @@ static uint32_t JPEG_MCU_YCbCr420_ARGB_ConvertBlocks(uint8_t *pInBuffer,
                                       uint32_t *ConvertedDataCount)
 {  
   uint32_t numberMCU;
-  uint32_t i,j,k, currentMCU, xRef,yRef;
+  uint32_t i,j,k, currentMCU, xRef,yRef, columns, column;
 
   uint32_t refline;
   int32_t ycomp, crcomp, cbcomp;
 
   int32_t c_red, c_blue, c_green;
+#if (JPEG_USE_DSP == 1)
+  uint32_t c_rb, c_gg;
+#endif
   
   uint8_t *pOutAddr, *pOutAddr2;
   uint8_t *pChrom, *pLum;
+  uint32_t line2;
   
   numberMCU = DataCount / YCBCR_420_BLOCK_SIZE;
+  *ConvertedDataCount = numberMCU * YCBCR_420_BLOCK_SIZE;
   currentMCU = BlockIndex;
   
 
@@ -1144,6 +1247,8 @@ static uint32_t JPEG_MCU_YCbCr420_ARGB_ConvertBlocks(uint8_t *pInBuffer,
     
     refline = JPEG_ConvertorParams.ScaledWidth * xRef + (JPEG_BYTES_PER_PIXEL*yRef);
 
+    columns = JPEG_MCU_Columns(yRef, 16);
+
     currentMCU++;
     
     pChrom = pInBuffer + 256; /* pChroma = pInBuffer + 4*64 */
@@ -1161,115 +1266,55 @@ static uint32_t JPEG_MCU_YCbCr420_ARGB_ConvertBlocks(uint8_t *pInBuffer,
       {
         pOutAddr = pOutBuffer + refline;
         pOutAddr2 = pOutAddr + JPEG_ConvertorParams.ScaledWidth;
+        line2 = (refline + JPEG_ConvertorParams.ScaledWidth) < JPEG_ConvertorParams.ImageSize_Bytes;
         
         for(k= 0; k<2; k++)
         {
           for(j=0; j < 8; j+=2)
           {           
-            cbcomp = (int32_t)(*(pChrom));
-            c_blue = (int32_t)(*(CB_BLUE_LUT + cbcomp));
-            
-            crcomp = (int32_t)(*(pChrom + 64));
-            c_red = (int32_t)(*(CR_RED_LUT + crcomp));          
-            
-            c_green = ((int32_t)(*(CR_GREEN_LUT + crcomp)) + (int32_t)(*(CB_GREEN_LUT + cbcomp))) >> 16;      
-          
-            
-            
-#if (JPEG_RGB_FORMAT == JPEG_ARGB8888)
-          
-            ycomp = (int32_t)(*(pLum +j));
-            
-            *(__IO uint32_t *)pOutAddr = 
-              (CLAMP(ycomp + c_red) << JPEG_RED_OFFSET)     | \
-              (CLAMP( ycomp + c_green) << JPEG_GREEN_OFFSET) | \
-              (CLAMP(ycomp + c_blue) << JPEG_BLUE_OFFSET);
-            /**********/
-            ycomp = (int32_t)(*(pLum +j +1));
-            
-            *((__IO uint32_t *)(pOutAddr + 4)) = 
-              (CLAMP(ycomp + c_red) << JPEG_RED_OFFSET)     | \
-              (CLAMP( ycomp + c_green) << JPEG_GREEN_OFFSET) | \
-              (CLAMP(ycomp + c_blue) << JPEG_BLUE_OFFSET);
-            
-            /**********/
-            ycomp = (int32_t)(*(pLum +j +8));
-            
-            *(__IO uint32_t *)pOutAddr2 = 
-              (CLAMP(ycomp + c_red) << JPEG_RED_OFFSET)     | \
-              (CLAMP( ycomp + c_green) << JPEG_GREEN_OFFSET) | \
-              (CLAMP(ycomp + c_blue) << JPEG_BLUE_OFFSET);
-            
-            /**********/
-            ycomp = (int32_t)(*(pLum +j +8 +1));
-            
-            *((__IO uint32_t *)(pOutAddr2 +4)) = 
-              (CLAMP(ycomp + c_red) << JPEG_RED_OFFSET)     | \
-              (CLAMP( ycomp + c_green) << JPEG_GREEN_OFFSET) | \
-              (CLAMP(ycomp + c_blue) << JPEG_BLUE_OFFSET);
-
-            
-#elif (JPEG_RGB_FORMAT == JPEG_RGB888)
-          
-           ycomp = (int32_t)(*(pLum +j));
-          
-            pOutAddr[JPEG_RED_OFFSET/8] = CLAMP(ycomp + c_red);
-            pOutAddr[JPEG_GREEN_OFFSET/8] = CLAMP(ycomp + c_green);
-            pOutAddr[JPEG_BLUE_OFFSET/8] = CLAMP(ycomp + c_blue);
-            
-            /**********/
-            ycomp = (int32_t)(*(pLum +j +1));
-
-            pOutAddr[3 + JPEG_RED_OFFSET/8] = CLAMP(ycomp + c_red);
-            pOutAddr[3 + JPEG_GREEN_OFFSET/8] = CLAMP(ycomp + c_green);
-            pOutAddr[3 + JPEG_BLUE_OFFSET/8] = CLAMP(ycomp + c_blue);
-
-            /**********/            
-            ycomp = (int32_t)(*(pLum +j +8));
-
-            pOutAddr2[JPEG_RED_OFFSET/8] = CLAMP(ycomp + c_red);
-            pOutAddr2[JPEG_GREEN_OFFSET/8] = CLAMP(ycomp + c_green);
-            pOutAddr2[JPEG_BLUE_OFFSET/8] = CLAMP(ycomp + c_blue);
-            
-            /**********/
-            ycomp = (int32_t)(*(pLum +j +8 +1));            
-            
-            pOutAddr2[3+ JPEG_RED_OFFSET/8] = CLAMP(ycomp + c_red);
-            pOutAddr2[3 + JPEG_GREEN_OFFSET/8] = CLAMP(ycomp + c_green);
-            pOutAddr2[3 + JPEG_BLUE_OFFSET/8] = CLAMP(ycomp + c_blue);
- 
-#elif (JPEG_RGB_FORMAT == JPEG_RGB565)
-          
-            ycomp = (int32_t)(*(pLum +j));
-            
-            *(__IO uint16_t *)pOutAddr = 
-              ((CLAMP(ycomp + c_red) >> 3) << JPEG_RED_OFFSET)     | \
-              ((CLAMP( ycomp + c_green) >> 2) << JPEG_GREEN_OFFSET) | \
-              ((CLAMP(ycomp + c_blue) >> 3) << JPEG_BLUE_OFFSET);
-            /**********/
-            ycomp = (int32_t)(*(pLum +j +1));
-            
-            *((__IO uint16_t *)(pOutAddr + 2)) = 
-              ((CLAMP(ycomp + c_red) >> 3) << JPEG_RED_OFFSET)     | \
-              ((CLAMP( ycomp + c_green) >> 2) << JPEG_GREEN_OFFSET) | \
-              ((CLAMP(ycomp + c_blue) >> 3) << JPEG_BLUE_OFFSET);
-            
-            /**********/
-            ycomp = (int32_t)(*(pLum +j +8));
-            
-            *(__IO uint16_t *)pOutAddr2 = 
-              ((CLAMP(ycomp + c_red) >> 3) << JPEG_RED_OFFSET)     | \
-              ((CLAMP( ycomp + c_green) >> 2) << JPEG_GREEN_OFFSET) | \
-              ((CLAMP(ycomp + c_blue) >> 3) << JPEG_BLUE_OFFSET);
-            
-            /**********/
-            ycomp = (int32_t)(*(pLum +j +8 +1));
-            
-            *((__IO uint16_t *)(pOutAddr2 +2)) = 
-              ((CLAMP(ycomp + c_red) >> 3) << JPEG_RED_OFFSET)     | \
-              ((CLAMP( ycomp + c_green) >> 2) << JPEG_GREEN_OFFSET) | \
-              ((CLAMP(ycomp + c_blue) >> 3) << JPEG_BLUE_OFFSET);         
-#endif /* JPEG_RGB_FORMAT */          
+            column = (k * 8) + j;
+            if(column < columns)
+            {
+              cbcomp = (int32_t)(*(pChrom));
+              crcomp = (int32_t)(*(pChrom + 64));
+#if (JPEG_USE_DSP == 1)
+              c_rb = JPEG_PACK_RB(CR_RED_LUT[crcomp], CB_BLUE_LUT[cbcomp]);
+              c_green = JPEG_GREEN(cbcomp, crcomp);
+              c_gg = __PKHBT((uint32_t)c_green, (uint32_t)c_green, 16);
+
+              JPEG_PutYCbCr2(pOutAddr, pLum[j], pLum[j + 1], c_rb, c_rb, c_gg, column + 1 < columns);
+              if(line2)
+              {
+                JPEG_PutYCbCr2(pOutAddr2, pLum[j + 8], pLum[j + 8 + 1], c_rb, c_rb, c_gg, column + 1 < columns);
+              }
+#else
+              c_blue = (int32_t)(*(CB_BLUE_LUT + cbcomp));
+              c_red = (int32_t)(*(CR_RED_LUT + crcomp));          
+              
+              c_green = ((int32_t)(*(CR_GREEN_LUT + crcomp)) + (int32_t)(*(CB_GREEN_LUT + cbcomp))) >> 16;      
+
+              ycomp = (int32_t)(*(pLum +j));
+              JPEG_PUT_YCBCR(pOutAddr, ycomp, c_red, c_green, c_blue);
+
+              if(column + 1 < columns)
+              {
+                ycomp = (int32_t)(*(pLum +j +1));
+                JPEG_PUT_YCBCR(pOutAddr + JPEG_BYTES_PER_PIXEL, ycomp, c_red, c_green, c_blue);
+              }
+
+              if(line2)
+              {
+                ycomp = (int32_t)(*(pLum +j +8));
+                JPEG_PUT_YCBCR(pOutAddr2, ycomp, c_red, c_green, c_blue);
+
+                if(column + 1 < columns)
+                {
+                  ycomp = (int32_t)(*(pLum +j +8 +1));
+                  JPEG_PUT_YCBCR(pOutAddr2 + JPEG_BYTES_PER_PIXEL, ycomp, c_red, c_green, c_blue);
+                }
+              }
+#endif /* JPEG_USE_DSP */
+            }
           
             pOutAddr += JPEG_BYTES_PER_PIXEL * 2;
             pOutAddr2 += JPEG_BYTES_PER_PIXEL * 2;
@@ -1306,17 +1351,21 @@ static uint32_t JPEG_MCU_YCbCr422_ARGB_ConvertBlocks(uint8_t *pInBuffer,
                                       uint32_t *ConvertedDataCount)
 {  
   uint32_t numberMCU;
-  uint32_t i,j,k, currentMCU, xRef,yRef;
+  uint32_t i,j,k, currentMCU, xRef,yRef, columns, column;
 
   uint32_t refline;
   int32_t ycomp, crcomp, cbcomp;
 
   int32_t c_red, c_blue, c_green;
+#if (JPEG_USE_DSP == 1)
+  uint32_t c_rb, c_gg;
+#endif
   
   uint8_t *pOutAddr;
   uint8_t *pChrom, *pLum;
   
   numberMCU = DataCount / YCBCR_422_BLOCK_SIZE;
+  *ConvertedDataCount = numberMCU * YCBCR_422_BLOCK_SIZE;
   currentMCU = BlockIndex;
   
 
@@ -1328,6 +1377,8 @@ static uint32_t JPEG_MCU_YCbCr422_ARGB_ConvertBlocks(uint8_t *pInBuffer,
     
     refline = JPEG_ConvertorParams.ScaledWidth * xRef + (JPEG_BYTES_PER_PIXEL*yRef);
 
+    columns = JPEG_MCU_Columns(yRef, 16);
+
     currentMCU++;
     
     pChrom = pInBuffer + 128; /* pChroma = pInBuffer + 2*64 */
@@ -1344,64 +1395,33 @@ static uint32_t JPEG_MCU_YCbCr422_ARGB_ConvertBlocks(uint8_t *pInBuffer,
         {
           for(j=0; j < 8; j+=2)
           {           
-            cbcomp = (int32_t)(*(pChrom));
-            c_blue = (int32_t)(*(CB_BLUE_LUT + cbcomp));
-            
-            crcomp = (int32_t)(*(pChrom + 64));
-            c_red = (int32_t)(*(CR_RED_LUT + crcomp));          
-            
-            c_green = ((int32_t)(*(CR_GREEN_LUT + crcomp)) + (int32_t)(*(CB_GREEN_LUT + cbcomp))) >> 16;      
-          
-            
-            
-#if (JPEG_RGB_FORMAT == JPEG_ARGB8888) 
-          
-            ycomp = (int32_t)(*(pLum +j));
-            
-            *(__IO uint32_t *)pOutAddr = 
-              (CLAMP(ycomp + c_red) << JPEG_RED_OFFSET)     | \
-              (CLAMP( ycomp + c_green) << JPEG_GREEN_OFFSET) | \
-              (CLAMP(ycomp + c_blue) << JPEG_BLUE_OFFSET);
-            /**********/
-            ycomp = (int32_t)(*(pLum +j +1));
-            
-            *((__IO uint32_t *)(pOutAddr + 4)) = 
-              (CLAMP(ycomp + c_red) << JPEG_RED_OFFSET)     | \
-              (CLAMP( ycomp + c_green) << JPEG_GREEN_OFFSET) | \
-              (CLAMP(ycomp + c_blue) << JPEG_BLUE_OFFSET);         
-            
-#elif (JPEG_RGB_FORMAT == JPEG_RGB888)
-          
-           ycomp = (int32_t)(*(pLum +j));
-          
-            pOutAddr[JPEG_RED_OFFSET/8] = CLAMP(ycomp + c_red);
-            pOutAddr[JPEG_GREEN_OFFSET/8] = CLAMP(ycomp + c_green);
-            pOutAddr[JPEG_BLUE_OFFSET/8] = CLAMP(ycomp + c_blue);
-            
-            /**********/
-            ycomp = (int32_t)(*(pLum +j +1));
-
-            pOutAddr[3 + JPEG_RED_OFFSET/8] = CLAMP(ycomp + c_red);
-            pOutAddr[3 + JPEG_GREEN_OFFSET/8] = CLAMP(ycomp + c_green);
-            pOutAddr[3 + JPEG_BLUE_OFFSET/8] = CLAMP(ycomp + c_blue);
-
-#elif (JPEG_RGB_FORMAT == JPEG_RGB565)  
-          
-            ycomp = (int32_t)(*(pLum +j));
-            
-            *(__IO uint16_t *)pOutAddr = 
-              ((CLAMP(ycomp + c_red) >> 3) << JPEG_RED_OFFSET)     | \
-              ((CLAMP( ycomp + c_green) >> 2) << JPEG_GREEN_OFFSET) | \
-              ((CLAMP(ycomp + c_blue) >> 3) << JPEG_BLUE_OFFSET);
-            /**********/
-            ycomp = (int32_t)(*(pLum +j +1));
-            
-            *((__IO uint16_t *)(pOutAddr + 2)) = 
-              ((CLAMP(ycomp + c_red) >> 3) << JPEG_RED_OFFSET)     | \
-              ((CLAMP( ycomp + c_green) >> 2) << JPEG_GREEN_OFFSET) | \
-              ((CLAMP(ycomp + c_blue) >> 3) << JPEG_BLUE_OFFSET);         
-          
-#endif /* JPEG_RGB_FORMAT*/          
+            column = (k * 8) + j;
+            if(column < columns)
+            {
+              cbcomp = (int32_t)(*(pChrom));
+              crcomp = (int32_t)(*(pChrom + 64));
+#if (JPEG_USE_DSP == 1)
+              c_rb = JPEG_PACK_RB(CR_RED_LUT[crcomp], CB_BLUE_LUT[cbcomp]);
+              c_green = JPEG_GREEN(cbcomp, crcomp);
+              c_gg = __PKHBT((uint32_t)c_green, (uint32_t)c_green, 16);
+
+              JPEG_PutYCbCr2(pOutAddr, pLum[j], pLum[j + 1], c_rb, c_rb, c_gg, column + 1 < columns);
+#else
+              c_blue = (int32_t)(*(CB_BLUE_LUT + cbcomp));
+              c_red = (int32_t)(*(CR_RED_LUT + crcomp));          
+              
+              c_green = ((int32_t)(*(CR_GREEN_LUT + crcomp)) + (int32_t)(*(CB_GREEN_LUT + cbcomp))) >> 16;      
+
+              ycomp = (int32_t)(*(pLum +j));
+              JPEG_PUT_YCBCR(pOutAddr, ycomp, c_red, c_green, c_blue);
+
+              if(column + 1 < columns)
+              {
+                ycomp = (int32_t)(*(pLum +j +1));
+                JPEG_PUT_YCBCR(pOutAddr + JPEG_BYTES_PER_PIXEL, ycomp, c_red, c_green, c_blue);
+              }
+#endif /* JPEG_USE_DSP */
+            }
           
             pOutAddr += JPEG_BYTES_PER_PIXEL * 2;
           
@@ -1437,17 +1457,21 @@ static uint32_t JPEG_MCU_YCbCr444_ARGB_ConvertBlocks(uint8_t *pInBuffer,
                                       uint32_t *ConvertedDataCount)
 {  
   uint32_t numberMCU;
-  uint32_t i,j, currentMCU, xRef,yRef;
+  uint32_t i,j, currentMCU, xRef,yRef, columns;
 
   uint32_t refline;
   int32_t ycomp, crcomp, cbcomp;
   
   int32_t c_red, c_blue, c_green;
+#if (JPEG_USE_DSP == 1)
+  uint32_t c_rb, c_rb2, c_gg;
+#endif
   
   uint8_t *pOutAddr;
   uint8_t *pChrom, *pLum;
   
   numberMCU = DataCount / YCBCR_444_BLOCK_SIZE;
+  *ConvertedDataCount = numberMCU * YCBCR_444_BLOCK_SIZE;
   currentMCU = BlockIndex;
   
 
@@ -1460,6 +1484,8 @@ static uint32_t JPEG_MCU_YCbCr444_ARGB_ConvertBlocks(uint8_t *pInBuffer,
     
     refline = JPEG_ConvertorParams.ScaledWidth * xRef + (JPEG_BYTES_PER_PIXEL*yRef);
 
+    columns = JPEG_MCU_Columns(yRef, 8);
+
     currentMCU++;   
     
     pChrom = pInBuffer + 64; /* pChroma = pInBuffer + 4*64 */
@@ -1472,50 +1498,42 @@ static uint32_t JPEG_MCU_YCbCr444_ARGB_ConvertBlocks(uint8_t *pInBuffer,
       {
         pOutAddr = pOutBuffer+ refline;
         
+#if (JPEG_USE_DSP == 1)
+        for(j=0; j < columns; j+=2)
+        {
+          cbcomp = (int32_t)(*(pChrom + j));
+          crcomp = (int32_t)(*(pChrom + j + 64));
+          c_rb = JPEG_PACK_RB(CR_RED_LUT[crcomp], CB_BLUE_LUT[cbcomp]);
+          c_green = JPEG_GREEN(cbcomp, crcomp);
 
-          for(j=0; j < 8; j++)
-          {           
-            cbcomp = (int32_t)(*pChrom);
-            c_blue = (int32_t)(*(CB_BLUE_LUT + cbcomp));
-            
-            crcomp = (int32_t)(*(pChrom + 64));
-            c_red = (int32_t)(*(CR_RED_LUT + crcomp));          
-            
-            c_green = ((int32_t)(*(CR_GREEN_LUT + crcomp)) + (int32_t)(*(CB_GREEN_LUT + cbcomp))) >> 16;      
-                      
-#if (JPEG_RGB_FORMAT == JPEG_ARGB8888)
-          
-            ycomp = (int32_t)(*(pLum +j));
-            
-            *(__IO uint32_t *)pOutAddr = 
-              (CLAMP(ycomp + c_red) << JPEG_RED_OFFSET)     | \
-              (CLAMP( ycomp + c_green) << JPEG_GREEN_OFFSET) | \
-              (CLAMP(ycomp + c_blue) << JPEG_BLUE_OFFSET);       
-            
-#elif (JPEG_RGB_FORMAT == JPEG_RGB888)
-            
-            ycomp = (int32_t)(*(pLum +j));
-          
-            pOutAddr[JPEG_RED_OFFSET/8] = CLAMP(ycomp + c_red);
-            pOutAddr[JPEG_GREEN_OFFSET/8] = CLAMP(ycomp + c_green);
-            pOutAddr[JPEG_BLUE_OFFSET/8] = CLAMP(ycomp + c_blue);        
+          cbcomp = (int32_t)(*(pChrom + j + 1));
+          crcomp = (int32_t)(*(pChrom + j + 1 + 64));
+          c_rb2 = JPEG_PACK_RB(CR_RED_LUT[crcomp], CB_BLUE_LUT[cbcomp]);
+          c_gg = __PKHBT((uint32_t)c_green, (uint32_t)JPEG_GREEN(cbcomp, crcomp), 16);
 
-#elif (JPEG_RGB_FORMAT == JPEG_RGB565)  
-            
-            ycomp = (int32_t)(*(pLum +j));
-          
-            *(__IO uint16_t *)pOutAddr = 
-              ((CLAMP(ycomp + c_red) >> 3) << JPEG_RED_OFFSET)     | \
-              ((CLAMP( ycomp + c_green) >> 2) << JPEG_GREEN_OFFSET) | \
-              ((CLAMP(ycomp + c_blue) >> 3) << JPEG_BLUE_OFFSET);      
-            
-#endif /* JPEG_RGB_FORMAT */          
+          JPEG_PutYCbCr2(pOutAddr, pLum[j], pLum[j + 1], c_rb, c_rb2, c_gg, j + 1 < columns);
+
+          pOutAddr += JPEG_BYTES_PER_PIXEL * 2;
+        }
+#else
+        for(j=0; j < columns; j++)
+        {           
+          cbcomp = (int32_t)(*(pChrom + j));
+          c_blue = (int32_t)(*(CB_BLUE_LUT + cbcomp));
           
-            pOutAddr += JPEG_BYTES_PER_PIXEL;
+          crcomp = (int32_t)(*(pChrom + j + 64));
+          c_red = (int32_t)(*(CR_RED_LUT + crcomp));          
           
-            pChrom++;
-          }
-          pLum += 8;
+          c_green = ((int32_t)(*(CR_GREEN_LUT + crcomp)) + (int32_t)(*(CB_GREEN_LUT + cbcomp))) >> 16;      
+
+          ycomp = (int32_t)(*(pLum +j));
+          JPEG_PUT_YCBCR(pOutAddr, ycomp, c_red, c_green, c_blue);
+        
+          pOutAddr += JPEG_BYTES_PER_PIXEL;
+        }
+#endif /* JPEG_USE_DSP */
+        pChrom += 8;
+        pLum += 8;
 
         refline += JPEG_ConvertorParams.ScaledWidth;          
       }
@@ -1542,7 +1560,7 @@ static uint32_t JPEG_MCU_Gray_ARGB_ConvertBlocks(uint8_t *pInBuffer,
                                       uint32_t *ConvertedDataCount)
 {
   uint32_t numberMCU;
-  uint32_t  currentMCU, xRef,yRef;
+  uint32_t  currentMCU, xRef,yRef, columns;
   uint32_t refline;
   
 
@@ -1551,6 +1569,7 @@ static uint32_t JPEG_MCU_Gray_ARGB_ConvertBlocks(uint8_t *pInBuffer,
 
   
   numberMCU = DataCount / GRAY_444_BLOCK_SIZE;
+  *ConvertedDataCount = numberMCU * GRAY_444_BLOCK_SIZE;
   currentMCU = BlockIndex;
   
   while(currentMCU < (numberMCU + BlockIndex))
@@ -1560,6 +1579,8 @@ static uint32_t JPEG_MCU_Gray_ARGB_ConvertBlocks(uint8_t *pInBuffer,
     yRef = ((currentMCU *8) % JPEG_ConvertorParams.WidthExtend);
     
     refline = JPEG_ConvertorParams.ScaledWidth * xRef + (JPEG_BYTES_PER_PIXEL*yRef);
+
+    columns = JPEG_MCU_Columns(yRef, 8);
     
     currentMCU++;
   
@@ -1570,29 +1591,15 @@ static uint32_t JPEG_MCU_Gray_ARGB_ConvertBlocks(uint8_t *pInBuffer,
       pOutAddr = pOutBuffer + refline;
       if(refline < JPEG_ConvertorParams.ImageSize_Bytes)
       {  
-        for(j=0; j < 8; j++)
+        for(j=0; j < columns; j++)
         { 
-          ySample =   (uint32_t)(*pLum);
+          ySample =   (uint32_t)(*(pLum + j));
 
-#if (JPEG_RGB_FORMAT == JPEG_ARGB8888)
-          
-          *(__IO uint32_t *)pOutAddr = ySample |  (ySample << 8) | (ySample << 16);
-          
-#elif (JPEG_RGB_FORMAT == JPEG_RGB888)
-          
-          pOutAddr[0] =  ySample;
-          pOutAddr[1] =  ySample;
-          pOutAddr[2] =  ySample;     
- 
-#elif (JPEG_RGB_FORMAT == JPEG_RGB565)
-            
-          *(__IO uint16_t *)pOutAddr = ((ySample >> 3) << 11) |  ((ySample >> 2) << 5) | (ySample >> 3);     
-          
-#endif /* JPEG_RGB_FORMAT */          
+          JPEG_PUT_PIXEL(pOutAddr, ySample, ySample, ySample);
           
           pOutAddr += JPEG_BYTES_PER_PIXEL;
-          pLum++;
         }
+        pLum += 8;
 
         refline += JPEG_ConvertorParams.ScaledWidth;        
       }
@@ -1619,7 +1626,7 @@ static uint32_t JPEG_MCU_YCCK_ARGB_ConvertBlocks(uint8_t *pInBuffer,
                                       uint32_t *ConvertedDataCount)
 {  
   uint32_t numberMCU;
-  uint32_t i,j, currentMCU, xRef,yRef;
+  uint32_t i,j, currentMCU, xRef,yRef, columns;
 
   uint32_t refline;
   int32_t color_k;
@@ -1629,6 +1636,7 @@ static uint32_t JPEG_MCU_YCCK_ARGB_ConvertBlocks(uint8_t *pInBuffer,
   uint8_t *pOutAddr, *pChrom;
   
   numberMCU = DataCount / CMYK_444_BLOCK_SIZE;
+  *ConvertedDataCount = numberMCU * CMYK_444_BLOCK_SIZE;
   currentMCU = BlockIndex;
   
 
@@ -1641,6 +1649,8 @@ static uint32_t JPEG_MCU_YCCK_ARGB_ConvertBlocks(uint8_t *pInBuffer,
     
     refline = JPEG_ConvertorParams.ScaledWidth * xRef + (JPEG_BYTES_PER_PIXEL*yRef);
 
+    columns = JPEG_MCU_Columns(yRef, 8);
+
     currentMCU++;
     
     pChrom = pInBuffer;
@@ -1651,41 +1661,20 @@ static uint32_t JPEG_MCU_YCCK_ARGB_ConvertBlocks(uint8_t *pInBuffer,
       {
         pOutAddr = pOutBuffer+ refline;        
 
-          for(j=0; j < 8; j++)
-          {           
-            color_k = (int32_t)(*(pChrom + 192));
-            c_red = (color_k * ((int32_t)(*pChrom)))/255;
-            
-            c_green = (color_k * (int32_t)(*(pChrom + 64)))/255;
-            
-            c_blue = (color_k * (int32_t)(*(pChrom + 128)))/255;
-                      
-#if (JPEG_RGB_FORMAT == JPEG_ARGB8888)
-          
-          *(__IO uint32_t *)pOutAddr = 
-            (c_red << JPEG_RED_OFFSET) | \
-            (c_green << JPEG_GREEN_OFFSET) | \
-            (c_blue << JPEG_BLUE_OFFSET);     
-            
-#elif (JPEG_RGB_FORMAT == JPEG_RGB888)
-            
-          pOutAddr[JPEG_RED_OFFSET/8]   =  c_red;
-          pOutAddr[JPEG_GREEN_OFFSET/8] =  c_green;
-          pOutAddr[JPEG_BLUE_OFFSET/8]  =  c_blue;
-          
-#elif (JPEG_RGB_FORMAT == JPEG_RGB565)
-            
-          *(__IO uint16_t *)pOutAddr = 
-            ((c_red >> 3) << JPEG_RED_OFFSET)     | \
-            ((c_green >> 2) << JPEG_GREEN_OFFSET) | \
-            ((c_blue >> 3) << JPEG_BLUE_OFFSET);         
-            
-#endif /* JPEG_RGB_FORMAT */          
+        for(j=0; j < columns; j++)
+        {           
+          color_k = (int32_t)(*(pChrom + j + 192));
+          c_red = (color_k * ((int32_t)(*(pChrom + j))))/255;
           
-            pOutAddr += JPEG_BYTES_PER_PIXEL;
+          c_green = (color_k * (int32_t)(*(pChrom + j + 64)))/255;
           
-            pChrom++;
-          }
+          c_blue = (color_k * (int32_t)(*(pChrom + j + 128)))/255;
+
+          JPEG_PUT_PIXEL(pOutAddr, c_red, c_green, c_blue);
+        
+          pOutAddr += JPEG_BYTES_PER_PIXEL;
+        }
+        pChrom += 8;
 
         refline += JPEG_ConvertorParams.ScaledWidth;          
       }
@@ -1790,6 +1779,7 @@ HAL_StatusTypeDef JPEG_GetDecodeColorConvertFunc(JPEG_ConfTypeDef *pJpegInfo, JP
  
   JPEG_ConvertorParams.WidthExtend = JPEG_ConvertorParams.ImageWidth + JPEG_ConvertorParams.LineOffset;
   JPEG_ConvertorParams.ScaledWidth = JPEG_BYTES_PER_PIXEL * JPEG_ConvertorParams.ImageWidth; 
+  JPEG_ConvertorParams.ClipWidth = JPEG_ConvertorParams.ImageWidth;
   
   hMCU = (JPEG_ConvertorParams.ImageWidth / JPEG_ConvertorParams.H_factor);
   if((JPEG_ConvertorParams.ImageWidth % JPEG_ConvertorParams.H_factor) != 0)
@@ -1808,6 +1798,23 @@ HAL_StatusTypeDef JPEG_GetDecodeColorConvertFunc(JPEG_ConfTypeDef *pJpegInfo, JP
   return HAL_OK;
 }
 
+/**
+  * @brief  Makes the decoding color conversion functions write straight into
+  *         a frame buffer, to be called after JPEG_GetDecodeColorConvertFunc.
+  *         Only the top left Width x Height pixels of the image are written,
+  *         so the padding of partial MCUs never lands outside of it.
+  * @param  LineStride : bytes from one line of the frame buffer to the next.
+  * @param  Width      : number of columns to write, at most the image width.
+  * @param  Height     : number of lines to write, at most the image height.
+  * @retval None
+  */
+void JPEG_SetDecodeDestination(uint32_t LineStride, uint32_t Width, uint32_t Height)
+{
+  JPEG_ConvertorParams.ScaledWidth = LineStride;
+  JPEG_ConvertorParams.ClipWidth = MIN(Width, JPEG_ConvertorParams.ImageWidth);
+  JPEG_ConvertorParams.ImageSize_Bytes = LineStride * MIN(Height, JPEG_ConvertorParams.ImageHeight);
+}
+
 /**
   * @brief  Initializes the YCbCr -> RGB colors conversion Look Up Tables  
   * @param  None
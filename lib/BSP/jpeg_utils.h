@@ -100,6 +100,7 @@ void JPEG_InitColorTables(void);
 
 #if (USE_JPEG_DECODER == 1)
 HAL_StatusTypeDef JPEG_GetDecodeColorConvertFunc(JPEG_ConfTypeDef *pJpegInfo, JPEG_YCbCrToRGB_Convert_Function *pFunction, uint32_t *ImageNbMCUs);
+void JPEG_SetDecodeDestination(uint32_t LineStride, uint32_t Width, uint32_t Height);
 #endif
 
 #if (USE_JPEG_ENCODER == 1)
@@ -244,6 +244,7 @@ static void LL_FillBuffer(uint32_t LayerIndex, void *pDst, uint32_t xSize,
                           uint32_t ColorIndex);
 static void LL_ConvertLineToARGB8888(void *pSrc, void *pDst, uint32_t xSize,
                                      uint32_t ColorMode);
+static uint32_t LL_PixelAddress(uint16_t Xpos, uint16_t Ypos);
 static uint16_t LCD_IO_GetID(void);
 /**
  * @}
@@ -830,6 +831,40 @@ void BSP_LCD_LayerDefaultInit(uint16_t LayerIndex, uint32_t FB_Address) {
   DrawProp[LayerIndex].TextColor = LCD_COLOR_BLACK;
 }
 
+/**
+ * @brief  Initializes the LCD layer in RGB565 format (16 bits per pixel).
+ *         Colors are still given in ARGB8888 and converted when drawn.
+ * @param  LayerIndex: Layer foreground or background
+ * @param  FB_Address: Layer frame buffer
+ * @retval None
+ */
+void BSP_LCD_LayerRgb565Init(uint16_t LayerIndex, uint32_t FB_Address) {
+  LCD_LayerCfgTypeDef Layercfg;
+
+  /* Layer Init */
+  Layercfg.WindowX0 = 0;
+  Layercfg.WindowX1 = BSP_LCD_GetXSize();
+  Layercfg.WindowY0 = 0;
+  Layercfg.WindowY1 = BSP_LCD_GetYSize();
+  Layercfg.PixelFormat = LTDC_PIXEL_FORMAT_RGB565;
+  Layercfg.FBStartAdress = FB_Address;
+  Layercfg.Alpha = 255;
+  Layercfg.Alpha0 = 0;
+  Layercfg.Backcolor.Blue = 0;
+  Layercfg.Backcolor.Green = 0;
+  Layercfg.Backcolor.Red = 0;
+  Layercfg.BlendingFactor1 = LTDC_BLENDING_FACTOR1_PAxCA;
+  Layercfg.BlendingFactor2 = LTDC_BLENDING_FACTOR2_PAxCA;
+  Layercfg.ImageWidth = BSP_LCD_GetXSize();
+  Layercfg.ImageHeight = BSP_LCD_GetYSize();
+
+  HAL_LTDC_ConfigLayer(&hltdc_discovery, &Layercfg, LayerIndex);
+
+  DrawProp[LayerIndex].BackColor = LCD_COLOR_WHITE;
+  DrawProp[LayerIndex].pFont = &Font24;
+  DrawProp[LayerIndex].TextColor = LCD_COLOR_BLACK;
+}
+
 /**
  * @brief  Selects the LCD Layer.
  * @param  LayerIndex: Layer foreground or background
@@ -1121,8 +1156,7 @@ void BSP_LCD_DrawHLine(uint16_t Xpos, uint16_t Ypos, uint16_t Length) {
   uint32_t Xaddress = 0;
 
   /* Get the line address */
-  Xaddress = (hltdc_discovery.LayerCfg[ActiveLayer].FBStartAdress) +
-             4 * (BSP_LCD_GetXSize() * Ypos + Xpos);
+  Xaddress = LL_PixelAddress(Xpos, Ypos);
 
   /* Write line */
   LL_FillBuffer(ActiveLayer, (uint32_t *)Xaddress, Length, 1, 0,
@@ -1139,8 +1173,7 @@ void BSP_LCD_DrawVLine(uint16_t Xpos, uint16_t Ypos, uint16_t Length) {
   uint32_t Xaddress = 0;
 
   /* Get the line address */
-  Xaddress = (hltdc_discovery.LayerCfg[ActiveLayer].FBStartAdress) +
-             4 * (BSP_LCD_GetXSize() * Ypos + Xpos);
+  Xaddress = LL_PixelAddress(Xpos, Ypos);
 
   /* Write line */
   LL_FillBuffer(ActiveLayer, (uint32_t *)Xaddress, 1, Length,
@@ -1411,8 +1444,7 @@ void BSP_LCD_FillRect(uint16_t Xpos, uint16_t Ypos, uint16_t Width,
   BSP_LCD_SetTextColor(DrawProp[ActiveLayer].TextColor);
 
   /* Get the rectangle start address */
-  Xaddress = (hltdc_discovery.LayerCfg[ActiveLayer].FBStartAdress) +
-             4 * (BSP_LCD_GetXSize() * Ypos + Xpos);
+  Xaddress = LL_PixelAddress(Xpos, Ypos);
 
   /* Fill the rectangle */
   LL_FillBuffer(ActiveLayer, (uint32_t *)Xaddress, Width, Height,
@@ -1725,8 +1757,15 @@ __weak void BSP_LCD_MspInit(void) {
  */
 void BSP_LCD_DrawPixel(uint16_t Xpos, uint16_t Ypos, uint32_t RGB_Code) {
   /* Write data value to all SDRAM memory */
-  *(__IO uint32_t *)(hltdc_discovery.LayerCfg[ActiveLayer].FBStartAdress +
-                     (4 * (Ypos * BSP_LCD_GetXSize() + Xpos))) = RGB_Code;
+  if (hltdc_discovery.LayerCfg[ActiveLayer].PixelFormat ==
+      LTDC_PIXEL_FORMAT_RGB565) {
+    *(__IO uint16_t *)LL_PixelAddress(Xpos, Ypos) =
+        (uint16_t)(((RGB_Code & 0x00F80000) >> 8) |
+                   ((RGB_Code & 0x0000FC00) >> 5) |
+                   ((RGB_Code & 0x000000F8) >> 3));
+  } else {
+    *(__IO uint32_t *)LL_PixelAddress(Xpos, Ypos) = RGB_Code;
+  }
 }
 
 /**
@@ -1861,9 +1900,15 @@ static void FillTriangle(uint16_t x1, uint16_t x2, uint16_t x3, uint16_t y1,
 static void LL_FillBuffer(uint32_t LayerIndex, void *pDst, uint32_t xSize,
                           uint32_t ySize, uint32_t OffLine,
                           uint32_t ColorIndex) {
-  /* Register to memory mode with ARGB8888 as color Mode */
+  /* Register to memory mode with the color Mode of the layer, the HAL converts
+     the ARGB8888 color to it */
   hdma2d_discovery.Init.Mode = DMA2D_R2M;
-  hdma2d_discovery.Init.ColorMode = DMA2D_OUTPUT_ARGB8888;
+  if (hltdc_discovery.LayerCfg[LayerIndex].PixelFormat ==
+      LTDC_PIXEL_FORMAT_RGB565) {
+    hdma2d_discovery.Init.ColorMode = DMA2D_OUTPUT_RGB565;
+  } else {
+    hdma2d_discovery.Init.ColorMode = DMA2D_OUTPUT_ARGB8888;
+  }
   hdma2d_discovery.Init.OutputOffset = OffLine;
 
   hdma2d_discovery.Instance = DMA2D;
@@ -1880,6 +1925,22 @@ static void LL_FillBuffer(uint32_t LayerIndex, void *pDst, uint32_t xSize,
   }
 }
 
+/**
+ * @brief  Gets the address of a pixel in the frame buffer of the active layer.
+ * @param  Xpos: X position
+ * @param  Ypos: Y position
+ * @retval Address of the pixel
+ */
+static uint32_t LL_PixelAddress(uint16_t Xpos, uint16_t Ypos) {
+  uint32_t bytes = (hltdc_discovery.LayerCfg[ActiveLayer].PixelFormat ==
+                    LTDC_PIXEL_FORMAT_RGB565)
+                       ? 2
+                       : 4;
+
+  return hltdc_discovery.LayerCfg[ActiveLayer].FBStartAdress +
+         bytes * (BSP_LCD_GetXSize() * Ypos + Xpos);
+}
+
 /**
  * @brief  Converts a line to an ARGB8888 pixel format.
  * @param  pSrc: Pointer to source buffer
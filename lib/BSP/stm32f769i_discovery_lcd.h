@@ -322,6 +322,7 @@ void BSP_LCD_SetXSize(uint32_t imageWidthPixels);
 void BSP_LCD_SetYSize(uint32_t imageHeightPixels);
 
 void BSP_LCD_LayerDefaultInit(uint16_t LayerIndex, uint32_t FB_Address);
+void BSP_LCD_LayerRgb565Init(uint16_t LayerIndex, uint32_t FB_Address);
 void BSP_LCD_SetTransparency(uint32_t LayerIndex, uint8_t Transparency);
 void BSP_LCD_SetLayerAddress(uint32_t LayerIndex, uint32_t Address);
 void BSP_LCD_SetColorKeying(uint32_t LayerIndex, uint32_t RGBValue);
@@ -54,6 +54,14 @@
 #include "diskio.h"
 #include "ff_gen_drv.h"
 
+#if _USE_DISKIO_STATS == 1
+#include <stdio.h>
+#include <string.h>
+#if !defined(__arm__)
+#include <time.h>
+#endif
+#endif
+
 #if defined ( __GNUC__ )
 #ifndef __weak
 #define __weak __attribute__((weak))
@@ -65,8 +73,72 @@
 /* Private variables ---------------------------------------------------------*/
 extern Disk_drvTypeDef  disk;
 
+#if _USE_DISKIO_STATS == 1
+static DISKIO_CLASS diskio_class = DISKIO_CLASS_OTHER;
+static DISKIO_STATS diskio_stats[DISKIO_CLASS_COUNT][DISKIO_OP_COUNT];
+static const char *const diskio_class_names[DISKIO_CLASS_COUNT] = {
+  "other", "song", "cover", "meta", "dir", "fat"
+};
+#endif
+
 /* Private function prototypes -----------------------------------------------*/
+#if _USE_DISKIO_STATS == 1
+static void diskio_record(DISKIO_OP op, UINT count, DRESULT res, DWORD start);
+#endif
+
 /* Private functions ---------------------------------------------------------*/
+#if _USE_DISKIO_STATS == 1
+/**
+  * @brief  Gets a timestamp, a monotonic clock in us on the host. The
+  *         application overrides it on target
+  * @retval Timestamp to be passed to disk_elapsed_us()
+  */
+__weak DWORD disk_timestamp (void)
+{
+#if defined(__arm__)
+  return 0;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (DWORD)(ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+#endif
+}
+
+/**
+  * @brief  Gets the time passed since a timestamp. The application overrides
+  *         it on target
+  * @param  start: Timestamp from disk_timestamp()
+  * @retval Elapsed time in us
+  */
+__weak DWORD disk_elapsed_us (DWORD start)
+{
+  return disk_timestamp() - start;
+}
+
+/**
+  * @brief  Adds one disk access to the statistics of the current class
+  * @param  op: Direction of the access
+  * @param  count: Number of sectors transferred
+  * @param  res: Result returned by the driver
+  * @param  start: Timestamp from disk_timestamp() taken before the access
+  * @retval None
+  */
+static void diskio_record(DISKIO_OP op, UINT count, DRESULT res, DWORD start)
+{
+  DISKIO_STATS *stats = &diskio_stats[diskio_class][op];
+  DWORD us = disk_elapsed_us(start);
+  UINT bucket = (us == 0) ? 0 : 32 - __builtin_clz(us);
+
+  if (bucket >= DISKIO_HIST_BUCKETS) bucket = DISKIO_HIST_BUCKETS - 1;
+
+  stats->calls++;
+  stats->sectors += count;
+  if (res != RES_OK) stats->errors++;
+  stats->total_us += us;
+  if (us > stats->max_us) stats->max_us = us;
+  stats->hist[bucket]++;
+}
+#endif /* _USE_DISKIO_STATS == 1 */
 
 /**
   * @brief  Gets Disk Status
@@ -118,8 +190,14 @@ DRESULT disk_read (
 )
 {
   DRESULT res;
+#if _USE_DISKIO_STATS == 1
+  DWORD start = disk_timestamp();
+#endif
 
   res = disk.drv[pdrv]->disk_read(disk.lun[pdrv], buff, sector, count);
+#if _USE_DISKIO_STATS == 1
+  diskio_record(DISKIO_OP_READ, count, res, start);
+#endif
   return res;
 }
 
@@ -140,8 +218,14 @@ DRESULT disk_write (
 )
 {
   DRESULT res;
+#if _USE_DISKIO_STATS == 1
+  DWORD start = disk_timestamp();
+#endif
 
   res = disk.drv[pdrv]->disk_write(disk.lun[pdrv], buff, sector, count);
+#if _USE_DISKIO_STATS == 1
+  diskio_record(DISKIO_OP_WRITE, count, res, start);
+#endif
   return res;
 }
 #endif /* _USE_WRITE == 1 */
@@ -167,6 +251,83 @@ DRESULT disk_ioctl (
 }
 #endif /* _USE_IOCTL == 1 */
 
+#if _USE_DISKIO_STATS == 1
+/**
+  * @brief  Sets who the following disk accesses are made on behalf of
+  * @param  cls: Class to charge the accesses to
+  * @retval DISKIO_CLASS: The previous class, so it can be restored
+  */
+DISKIO_CLASS disk_set_class (
+	DISKIO_CLASS cls	/* Class of the following accesses */
+)
+{
+  DISKIO_CLASS prev = diskio_class;
+
+  diskio_class = cls;
+  return prev;
+}
+
+/**
+  * @brief  Gets the statistics of one class/direction of disk accesses
+  * @param  cls: Class of the accesses
+  * @param  op: Direction of the accesses
+  * @retval DISKIO_STATS: Pointer to the statistics
+  */
+const DISKIO_STATS* disk_get_stats (
+	DISKIO_CLASS cls,	/* Class of the accesses */
+	DISKIO_OP op		/* Direction of the accesses */
+)
+{
+  return &diskio_stats[cls][op];
+}
+
+/**
+  * @brief  Clears all statistics
+  * @param  None
+  * @retval None
+  */
+void disk_reset_stats (void)
+{
+  memset(diskio_stats, 0, sizeof(diskio_stats));
+}
+
+/**
+  * @brief  Prints the statistics of every class that has been used, with the
+  *         latency histogram as "<upper bound in us>:<calls>" pairs
+  * @param  None
+  * @retval None
+  */
+void disk_print_stats (void)
+{
+  static const char *const op_names[DISKIO_OP_COUNT] = { "rd", "wr" };
+  UINT cls, op, i;
+
+  for (cls = 0; cls < DISKIO_CLASS_COUNT; cls++)
+  {
+    for (op = 0; op < DISKIO_OP_COUNT; op++)
+    {
+      const DISKIO_STATS *stats = &diskio_stats[cls][op];
+      if (stats->calls == 0) continue;
+
+      printf("disk %-5s %s: %lu calls %lu sectors %lu errors %lu KB/s max %lu us\r\n",
+             diskio_class_names[cls], op_names[op],
+             (unsigned long)stats->calls, (unsigned long)stats->sectors,
+             (unsigned long)stats->errors,
+             (unsigned long)((stats->total_us == 0) ? 0 :
+                 (unsigned long long)stats->sectors * 512 * 1000000 / 1024 / stats->total_us),
+             (unsigned long)stats->max_us);
+      printf("  hist us:");
+      for (i = 0; i < DISKIO_HIST_BUCKETS; i++)
+      {
+        if (stats->hist[i] == 0) continue;
+        printf(" <%lu:%lu", 1UL << i, (unsigned long)stats->hist[i]);
+      }
+      printf("\r\n");
+    }
+  }
+}
+#endif /* _USE_DISKIO_STATS == 1 */
+
 /**
   * @brief  Gets Time from RTC
   * @param  None
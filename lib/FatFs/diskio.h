@@ -11,6 +11,7 @@ extern "C" {
 
 #define _USE_WRITE	1	/* 1: Enable disk_write function */
 #define _USE_IOCTL	1	/* 1: Enable disk_ioctl function */
+#define _USE_DISKIO_STATS	1	/* 1: Record latency/throughput of every disk_read/disk_write */
 
 #include "integer.h"
 
@@ -39,6 +40,53 @@ DRESULT disk_write (BYTE pdrv, const BYTE* buff, DWORD sector, UINT count);
 DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 DWORD get_fattime (void);
 
+/* Who a disk access is made on behalf of */
+typedef enum {
+	DISKIO_CLASS_OTHER = 0,	/* Anything not tagged below */
+	DISKIO_CLASS_SONG,		/* Audio data */
+	DISKIO_CLASS_COVER,		/* Album cover data */
+	DISKIO_CLASS_META,		/* Song title/artist data */
+	DISKIO_CLASS_DIR,		/* Directory entries (set by FatFs) */
+	DISKIO_CLASS_FAT,		/* FAT entries (set by FatFs) */
+	DISKIO_CLASS_COUNT
+} DISKIO_CLASS;
+
+/* Direction of a disk access */
+typedef enum {
+	DISKIO_OP_READ = 0,
+	DISKIO_OP_WRITE,
+	DISKIO_OP_COUNT
+} DISKIO_OP;
+
+/* Number of buckets in the latency histogram, bucket n counts the calls that
+   took [2^(n-1), 2^n) us, the last bucket also counts everything slower */
+#define DISKIO_HIST_BUCKETS	16
+
+/* Statistics of one class/direction of disk accesses */
+typedef struct {
+	DWORD calls;			/* Number of calls */
+	DWORD sectors;			/* Number of sectors transferred */
+	DWORD errors;			/* Number of calls that did not return RES_OK */
+	DWORD total_us;			/* Total time spent in the driver */
+	DWORD max_us;			/* Slowest single call */
+	DWORD hist[DISKIO_HIST_BUCKETS];	/* log2 latency histogram */
+} DISKIO_STATS;
+
+#if _USE_DISKIO_STATS == 1
+DISKIO_CLASS disk_set_class (DISKIO_CLASS cls);
+const DISKIO_STATS* disk_get_stats (DISKIO_CLASS cls, DISKIO_OP op);
+void disk_reset_stats (void);
+void disk_print_stats (void);
+
+/* Timing hooks of the statistics, the application provides a free running
+   timestamp and the microseconds passed since one (the weak defaults use a
+   monotonic clock on the host and time nothing on target) */
+DWORD disk_timestamp (void);
+DWORD disk_elapsed_us (DWORD start);
+#else
+static inline DISKIO_CLASS disk_set_class (DISKIO_CLASS cls) { (void)cls; return DISKIO_CLASS_OTHER; }
+#endif /* _USE_DISKIO_STATS == 1 */
+
 /* Disk Status Bits (DSTATUS) */
 
 #define STA_NOINIT		0x01	/* Drive not initialized */
@@ -922,10 +922,13 @@ FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERROR */
 		res = sync_window(fs);		/* Write-back changes */
 #endif
 		if (res == FR_OK) {			/* Fill sector window with new data */
+			/* The window holds either a FAT sector or directory/volume sectors */
+			DISKIO_CLASS cls = disk_set_class((sector - fs->fatbase < fs->n_fats * fs->fsize) ? DISKIO_CLASS_FAT : DISKIO_CLASS_DIR);
 			if (disk_read(fs->drv, fs->win, sector, 1) != RES_OK) {
 				sector = 0xFFFFFFFF;	/* Invalidate window if data is not reliable */
 				res = FR_DISK_ERR;
 			}
+			disk_set_class(cls);
 			fs->winsect = sector;
 		}
 	}
@@ -1963,6 +1966,7 @@ void get_xdir_info (
 	fno->altname[0] = 0;							/* No SFN */
 	fno->fattrib = dirb[XDIR_Attr];					/* Attribute */
 	fno->fsize = (fno->fattrib & AM_DIR) ? 0 : ld_qword(dirb + XDIR_FileSize);	/* Size */
+	fno->fclust = ld_dword(dirb + XDIR_FstClus);	/* Start cluster */
 	fno->ftime = ld_word(dirb + XDIR_ModTime + 0);	/* Time */
 	fno->fdate = ld_word(dirb + XDIR_ModTime + 2);	/* Date */
 }
@@ -2529,6 +2533,7 @@ void get_fileinfo (		/* No return code */
 
 	fno->fattrib = dp->dir[DIR_Attr];				/* Attribute */
 	fno->fsize = ld_dword(dp->dir + DIR_FileSize);	/* Size */
+	fno->fclust = ld_clust(dp->obj.fs, dp->dir);	/* Start cluster */
 	tm = ld_dword(dp->dir + DIR_ModTime);			/* Timestamp */
 	fno->ftime = (WORD)tm; fno->fdate = (WORD)(tm >> 16);
 }
@@ -0,0 +1,205 @@
+#!/usr/bin/env python3
+"""
+Checks on the host that the YCbCr to ARGB8888 converters in
+lib/BSP/jpeg_utils.c give the same pixels with the Cortex-M7 DSP instructions
+as with the scalar C code they replace.
+
+lib/BSP/jpeg_utils.c is compiled twice into shared libraries with the host's C
+compiler: once as is, which is the scalar path, and once with
+__ARM_FEATURE_DSP set and QADD16, USAT16, PKHBT and SMLAD emulated in C the way
+the Arm architecture defines them. Both convert the same corpus of MCUs for
+every subsampling at image sizes that are and aren't a multiple of the MCU,
+handed over in chunks like src/cover.c does, into framebuffers with a stride
+wider than the image. Every byte of the framebuffers has to match, including
+the ones the converters must not touch.
+
+    script/check_jpeg_convert.py
+"""
+
+import argparse
+import ctypes
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# just what lib/BSP/jpeg_utils.c needs of the HAL, the values of the
+# constants only have to be the same for both builds
+HAL_STUB = r"""
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#define __IO volatile
+#define __STATIC_INLINE static inline
+typedef enum { HAL_OK, HAL_ERROR, HAL_BUSY, HAL_TIMEOUT } HAL_StatusTypeDef;
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+static inline int32_t dsp_half(uint32_t x, int hi) { return (int16_t)(hi ? x >> 16 : x); }
+static inline uint32_t dsp_pack(int32_t lo, int32_t hi) { return ((uint32_t)hi << 16) | ((uint32_t)lo & 0xFFFF); }
+static inline int32_t dsp_clamp(int32_t x, int32_t lo, int32_t hi) { return x < lo ? lo : (x > hi ? hi : x); }
+
+static inline uint32_t __PKHBT(uint32_t a, uint32_t b, int shift) {
+    return (a & 0xFFFF) | ((b << shift) & 0xFFFF0000);
+}
+static inline uint32_t __QADD16(uint32_t a, uint32_t b) {
+    return dsp_pack(dsp_clamp(dsp_half(a, 0) + dsp_half(b, 0), -32768, 32767),
+                    dsp_clamp(dsp_half(a, 1) + dsp_half(b, 1), -32768, 32767));
+}
+static inline uint32_t __USAT16(uint32_t a, int bits) {
+    int32_t top = (1 << bits) - 1;
+    return dsp_pack(dsp_clamp(dsp_half(a, 0), 0, top), dsp_clamp(dsp_half(a, 1), 0, top));
+}
+static inline uint32_t __SMLAD(uint32_t a, uint32_t b, uint32_t acc) {
+    return (uint32_t)((int64_t)dsp_half(a, 0) * dsp_half(b, 0) + (int64_t)dsp_half(a, 1) * dsp_half(b, 1) + acc);
+}
+#endif
+"""
+
+JPEG_STUB = r"""
+#pragma once
+#include "stm32f7xx_hal.h"
+typedef struct { uint32_t ColorSpace, ChromaSubsampling, ImageHeight, ImageWidth, ImageQuality; } JPEG_ConfTypeDef;
+#define JPEG_444_SUBSAMPLING 0x00
+#define JPEG_420_SUBSAMPLING 0x01
+#define JPEG_422_SUBSAMPLING 0x02
+#define JPEG_GRAYSCALE_COLORSPACE 0x00
+#define JPEG_YCBCR_COLORSPACE 0x10
+#define JPEG_CMYK_COLORSPACE 0x30
+"""
+
+YCBCR = 0x10
+BYTES_PER_PIXEL = 4
+
+# subsampling, luma blocks per MCU, MCU width and height in pixels
+SUBSAMPLINGS = [
+    ("4:2:0", 0x01, 4, 16, 16),
+    ("4:2:2", 0x02, 2, 16, 8),
+    ("4:4:4", 0x00, 1, 8, 8),
+]
+
+# image sizes, the odd ones leave part of the last MCUs out like a cover
+# that isn't a multiple of the MCU does. The chroma walk gets through every
+# Cb, Cr pair in the largest one
+SIZES = [(16, 16), (40, 24), (37, 21), (1, 1), (17, 9), (8, 40), (127, 63), (512, 512)]
+
+# bytes handed to the converter at once, a whole image and odd chunks that
+# end in the middle of an MCU
+CHUNKS = [None, 64, 1000, 4096]
+
+
+class JPEG_ConfTypeDef(ctypes.Structure):
+    _fields_ = [(name, ctypes.c_uint32) for name in
+                ("ColorSpace", "ChromaSubsampling", "ImageHeight", "ImageWidth", "ImageQuality")]
+
+
+CONVERT = ctypes.CFUNCTYPE(ctypes.c_uint32, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_uint32,
+                           ctypes.c_uint32, ctypes.POINTER(ctypes.c_uint32))
+
+
+def build(compiler, directory, name, flags):
+    """Compiles lib/BSP/jpeg_utils.c into the shared library 'name' in 'directory'."""
+    path = os.path.join(directory, name)
+    subprocess.run([compiler, "-O2", "-std=gnu11", "-shared", "-fPIC", "-Wl,-Bsymbolic", "-w",
+                    "-I", directory, "-I", os.path.join(ROOT, "inc"), "-I", os.path.join(ROOT, "lib", "BSP"),
+                    *flags, "-o", path, os.path.join(ROOT, "lib", "BSP", "jpeg_utils.c")], check=True)
+    library = ctypes.CDLL(path)
+    library.JPEG_InitColorTables()
+    return library
+
+
+def corpus(rng, luma_blocks, mcus):
+    """Returns the named MCU data of 'mcus' MCUs of 'luma_blocks' luma blocks each."""
+    size = (luma_blocks + 2) * 64
+
+    def mcu_data(luma, chroma):
+        data = bytearray()
+        for mcu in range(mcus):
+            for block in range(luma_blocks):
+                data += bytes(luma(mcu, block, i) for i in range(64))
+            data += bytes(chroma(mcu, 0, i) for i in range(64))
+            data += bytes(chroma(mcu, 1, i) for i in range(64))
+        return bytes(data)
+
+    yield "random", bytes(rng.getrandbits(8) for _ in range(size * mcus))
+    yield "black", mcu_data(lambda m, b, i: 0, lambda m, c, i: 128)
+    yield "white", mcu_data(lambda m, b, i: 255, lambda m, c, i: 128)
+    # every pixel clamps at 0 or 255 in at least one color
+    yield "saturated", mcu_data(lambda m, b, i: 255 * ((i + b) & 1), lambda m, c, i: 255 * ((i >> c) & 1))
+    yield "low", mcu_data(lambda m, b, i: i & 7, lambda m, c, i: (i * 3 + c) & 15)
+    # walks through every Cb, Cr pair, the green offset of each is one SMLAD
+    yield "chroma", mcu_data(lambda m, b, i: (m * 7 + b * 31 + i * 13) & 0xFF,
+                             lambda m, c, i: ((m * 64 + i) >> (8 * c)) & 0xFF)
+
+
+def convert(library, subsampling, width, height, data, chunk):
+    """Returns the framebuffer the converter of 'library' wrote 'data' into."""
+    _, mode, luma_blocks, mcu_width, mcu_height = subsampling
+    conf = JPEG_ConfTypeDef(YCBCR, mode, -(-height // mcu_height) * mcu_height, -(-width // mcu_width) * mcu_width, 0)
+    function = ctypes.c_void_p()
+    mcus = ctypes.c_uint32()
+    if library.JPEG_GetDecodeColorConvertFunc(ctypes.byref(conf), ctypes.byref(function), ctypes.byref(mcus)) != 0:
+        raise SystemExit("no converter for %s" % subsampling[0])
+
+    # a wider stride than the image, whatever is written past its clip
+    # width or height shows up in the comparison
+    stride = (width + 3) * BYTES_PER_PIXEL
+    output = ctypes.create_string_buffer(b"\x5A" * (stride * (height + 2)), stride * (height + 2))
+    library.JPEG_SetDecodeDestination(ctypes.c_uint32(stride), ctypes.c_uint32(width), ctypes.c_uint32(height))
+
+    converter = CONVERT(function.value)
+    block = 0
+    offset = 0
+    while offset < len(data):
+        size = len(data) - offset if chunk is None else min(chunk, len(data) - offset)
+        piece = ctypes.create_string_buffer(data[offset:offset + size], size)
+        converted = ctypes.c_uint32()
+        block += converter(piece, output, block, size, ctypes.byref(converted))
+        if converted.value == 0:
+            break
+        offset += converted.value
+    return output.raw
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0].strip())
+    parser.add_argument("--cc", default=os.environ.get("CC", "cc"), help="host C compiler (default: cc)")
+    parser.add_argument("--seed", type=int, default=1, help="seed of the random MCUs (default: 1)")
+    args = parser.parse_args()
+
+    if shutil.which(args.cc) is None:
+        raise SystemExit("%s not found on the PATH" % args.cc)
+
+    rng = random.Random(args.seed)
+    checked = 0
+    failed = 0
+    with tempfile.TemporaryDirectory() as directory:
+        for name, text in (("stm32f7xx_hal.h", HAL_STUB), ("stm32f7xx_hal_jpeg.h", JPEG_STUB)):
+            with open(os.path.join(directory, name), "w") as file:
+                file.write(text)
+        scalar = build(args.cc, directory, "scalar.so", [])
+        dsp = build(args.cc, directory, "dsp.so", ["-D__ARM_FEATURE_DSP=1"])
+
+        for subsampling in SUBSAMPLINGS:
+            for width, height in SIZES:
+                mcus = -(-width // subsampling[3]) * -(-height // subsampling[4])
+                for case, data in corpus(rng, subsampling[2], mcus):
+                    for chunk in CHUNKS:
+                        expected = convert(scalar, subsampling, width, height, data, chunk)
+                        actual = convert(dsp, subsampling, width, height, data, chunk)
+                        checked += 1
+                        if actual != expected:
+                            failed += 1
+                            first = next(i for i in range(len(actual)) if actual[i] != expected[i])
+                            print("%s %dx%d %s chunk %s: differs at byte %d" % (
+                                subsampling[0], width, height, case, chunk, first), file=sys.stderr)
+
+    print("%d conversions checked, %d differ" % (checked, failed))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
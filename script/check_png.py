@@ -0,0 +1,319 @@
+#!/usr/bin/env python3
+"""
+Decodes a corpus of made up png images on the host with src/png.c and checks
+every pixel against what the image holds.
+
+src/png.c is compiled into a shared library with the host's C compiler, with
+FatFs reading from memory and the SDRAM buffers as arrays. The corpus is made
+here with zlib: every color type at every bit depth it allows (1 to 16 bits),
+rows using each of the filters 0 to 4, image data deflated into stored, fixed
+code and dynamic code blocks, split over many small IDAT chunks and flushed
+into several blocks in the middle of rows, and images large enough for
+matches to reach across the whole 32KB window. Each image is read through
+the file functions so the input buffer runs out in the middle of chunks.
+Broken images have to be refused without writing outside of the row.
+
+    script/check_png.py
+"""
+
+import argparse
+import ctypes
+import os
+import random
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import zlib
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# just what src/png.c needs of FatFs, the file is a buffer in memory
+FF_STUB = r"""
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#define _MIN_SS 512
+typedef unsigned int UINT;
+typedef uint32_t FSIZE_t;
+typedef enum { FR_OK = 0, FR_DISK_ERR } FRESULT;
+typedef struct { const uint8_t *data; uint32_t size; uint32_t position; } FIL;
+
+static inline FRESULT f_read(FIL *file, void *buffer, UINT len, UINT *bytes_read) {
+    if (len > file->size - file->position) len = file->size - file->position;
+    memcpy(buffer, file->data + file->position, len);
+    file->position += len;
+    *bytes_read = len;
+    return FR_OK;
+}
+static inline FRESULT f_lseek(FIL *file, FSIZE_t offset) {
+    if (offset > file->size) return FR_DISK_ERR;
+    file->position = offset;
+    return FR_OK;
+}
+#define f_tell(file) ((file)->position)
+"""
+
+# the window and the two rows src/png.c keeps in SDRAM
+SDRAM_STUB = r"""
+#pragma once
+#include <stdint.h>
+static uint8_t host_png_window[0x00008000];
+static uint8_t host_png_rows[0x00021000];
+#define SDRAM_PNG_WINDOW        ((uintptr_t)host_png_window)
+#define SDRAM_PNG_WINDOW_SIZE   sizeof(host_png_window)
+#define SDRAM_PNG_ROWS          ((uintptr_t)host_png_rows)
+#define SDRAM_PNG_ROWS_SIZE     sizeof(host_png_rows)
+"""
+
+LCD_STUB = "#pragma once\n"
+
+SIGNATURE = b"\x89PNG\r\n\x1a\n"
+CHANNELS = {0: 1, 2: 3, 3: 1, 4: 2, 6: 4}
+DEPTHS = {0: [1, 2, 4, 8, 16], 2: [8, 16], 3: [1, 2, 4, 8], 4: [8, 16], 6: [8, 16]}
+
+# how the image data is deflated: level, strategy and rows between flushes
+DEFLATES = {
+    "stored": (0, zlib.Z_DEFAULT_STRATEGY, 0),
+    "fixed": (6, zlib.Z_FIXED, 0),
+    "dynamic": (9, zlib.Z_DEFAULT_STRATEGY, 0),
+    "flushed": (6, zlib.Z_DEFAULT_STRATEGY, 3),
+}
+
+# guard bytes after a row that the decoder must leave alone
+GUARD = 64
+
+
+class FIL(ctypes.Structure):
+    _fields_ = [("data", ctypes.c_char_p), ("size", ctypes.c_uint32), ("position", ctypes.c_uint32)]
+
+
+def build(compiler, directory):
+    """Compiles src/png.c into a shared library in 'directory'."""
+    for name, text in (("ff.h", FF_STUB), ("sdram.h", SDRAM_STUB), ("lcd.h", LCD_STUB)):
+        with open(os.path.join(directory, name), "w") as file:
+            file.write(text)
+    path = os.path.join(directory, "png.so")
+    subprocess.run([compiler, "-O2", "-std=gnu11", "-shared", "-fPIC", "-Wall", "-Wno-unused-function",
+                    "-I", directory, "-I", os.path.join(ROOT, "inc"),
+                    "-o", path, os.path.join(ROOT, "src", "png.c")], check=True)
+    return ctypes.CDLL(path)
+
+
+def chunk(kind, data):
+    return struct.pack(">I", len(data)) + kind + data + struct.pack(">I", zlib.crc32(kind + data))
+
+
+def paeth(a, b, c):
+    p = a + b - c
+    pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+    if pa <= pb and pa <= pc:
+        return a
+    return b if pb <= pc else c
+
+
+def filter_row(kind, row, previous, bpp):
+    """Returns 'row' filtered with filter 'kind' against 'previous'."""
+    out = bytearray(len(row))
+    for i, value in enumerate(row):
+        a = row[i - bpp] if i >= bpp else 0
+        b = previous[i]
+        c = previous[i - bpp] if i >= bpp else 0
+        predictor = (0, a, b, (a + b) // 2, paeth(a, b, c))[kind]
+        out[i] = (value - predictor) & 0xFF
+    return bytes(out)
+
+
+def make_image(rng, width, height, color_type, depth, filters, deflate, idat_size, palette_size=None, repeat=False):
+    """
+    Returns a png of random pixels and the ARGB8888 pixels src/png.c has to
+    decode it to, row by row.
+    """
+    channels = CHANNELS[color_type]
+    levels = 1 << depth
+    bpp = max(1, channels * depth // 8)
+
+    palette = []
+    if color_type == 3:
+        count = palette_size if palette_size is not None else levels
+        palette = [tuple(rng.randrange(256) for _ in range(3)) for _ in range(count)]
+
+    rows = []
+    expected = []
+    for y in range(height):
+        # repeated rows give matches reaching far back in the window
+        if repeat and y >= 2 and rng.random() < 0.5:
+            samples = rows[rng.randrange(y)][0]
+        else:
+            samples = [[rng.randrange(levels) for _ in range(channels)] for _ in range(width)]
+        if depth < 8:
+            bits = "".join(format(pixel[0], "0%db" % depth) for pixel in samples)
+            bits += "0" * (-len(bits) % 8)
+            raw = bytes(int(bits[i:i + 8], 2) for i in range(0, len(bits), 8))
+        elif depth == 8:
+            raw = bytes(value for pixel in samples for value in pixel)
+        else:
+            raw = b"".join(struct.pack(">H", value) for pixel in samples for value in pixel)
+        rows.append((samples, raw))
+
+        pixels = []
+        for pixel in samples:
+            high = [value >> 8 if depth == 16 else value for value in pixel]
+            if color_type == 3:
+                red, green, blue = palette[pixel[0]] if pixel[0] < len(palette) else (0, 0, 0)
+            elif color_type in (0, 4):
+                red = green = blue = pixel[0] * 255 // (levels - 1) if depth < 8 else high[0]
+            else:
+                red, green, blue = high[:3]
+            pixels.append(0xFF000000 | (red << 16) | (green << 8) | blue)
+        expected.append(struct.pack("<%dI" % width, *pixels))
+
+    level, strategy, flush_rows = DEFLATES[deflate]
+    compressor = zlib.compressobj(level, zlib.DEFLATED, 15, 9, strategy)
+    data = bytearray()
+    previous = bytes(len(rows[0][1]))
+    for y, (_, raw) in enumerate(rows):
+        kind = filters[y % len(filters)]
+        line = bytes([kind]) + filter_row(kind, raw, previous, bpp)
+        previous = raw
+        if flush_rows and y % flush_rows == flush_rows - 1:
+            # the flush lands in the middle of the row
+            data += compressor.compress(line[:len(line) // 2]) + compressor.flush(zlib.Z_SYNC_FLUSH)
+            data += compressor.compress(line[len(line) // 2:])
+        else:
+            data += compressor.compress(line)
+    data += compressor.flush()
+
+    png = SIGNATURE + chunk(b"IHDR", struct.pack(">IIBBBBB", width, height, depth, color_type, 0, 0, 0))
+    png += chunk(b"tEXt", b"Comment\0skipped by its length")
+    if palette:
+        png += chunk(b"PLTE", bytes(value for entry in palette for value in entry))
+    for start in range(0, len(data), idat_size):
+        png += chunk(b"IDAT", bytes(data[start:start + idat_size]))
+    png += chunk(b"IEND", b"")
+    return png, expected, data
+
+
+def first_block(data):
+    """Returns the type of the first deflate block of zlib 'data'."""
+    return (data[2] >> 1) & 3
+
+
+def decode(library, png, width, height):
+    """
+    Decodes 'png' with src/png.c.
+    Returns the rows it decoded, None if it refused to start, and whether it
+    wrote past a row.
+    """
+    file = FIL(png, len(png), 0)
+    decoded_width = ctypes.c_uint32()
+    decoded_height = ctypes.c_uint32()
+    if not library.Png_Start(ctypes.byref(file), 0, len(png), ctypes.byref(decoded_width),
+                             ctypes.byref(decoded_height)):
+        return None, False
+    if (decoded_width.value, decoded_height.value) != (width, height):
+        raise SystemExit("decoded a %dx%d png as %dx%d" % (width, height, decoded_width.value, decoded_height.value))
+
+    rows = []
+    overrun = False
+    for _ in range(height):
+        buffer = ctypes.create_string_buffer(b"\xA5" * (width * 4 + GUARD), width * 4 + GUARD)
+        if not library.Png_Row(buffer):
+            break
+        rows.append(buffer.raw[:width * 4])
+        overrun |= buffer.raw[width * 4:] != b"\xA5" * GUARD
+    return rows, overrun
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0].strip())
+    parser.add_argument("--cc", default=os.environ.get("CC", "cc"), help="host C compiler (default: cc)")
+    parser.add_argument("--seed", type=int, default=1, help="seed of the random pixels (default: 1)")
+    args = parser.parse_args()
+
+    if shutil.which(args.cc) is None:
+        raise SystemExit("%s not found on the PATH" % args.cc)
+
+    rng = random.Random(args.seed)
+    cases = []
+    for color_type, depths in DEPTHS.items():
+        for depth in depths:
+            for deflate in DEFLATES:
+                for width, height in ((1, 1), (13, 7), (64, 11)):
+                    cases.append(("type %d depth %d %s %dx%d" % (color_type, depth, deflate, width, height),
+                                  dict(width=width, height=height, color_type=color_type, depth=depth,
+                                       filters=[0, 1, 2, 3, 4], deflate=deflate, idat_size=1 << 20)))
+    # one filter for a whole image, tiny IDAT chunks, a short palette and
+    # matches across the whole window
+    for kind in range(5):
+        cases.append(("rgb 8 filter %d only" % kind, dict(width=33, height=9, color_type=2, depth=8, filters=[kind],
+                                                         deflate="dynamic", idat_size=1 << 20)))
+    cases.append(("rgba 16 in 7-byte IDAT chunks", dict(width=29, height=13, color_type=6, depth=16,
+                                                         filters=[4, 3, 2, 1, 0], deflate="dynamic", idat_size=7)))
+    cases.append(("palette 4 with 5 entries", dict(width=40, height=6, color_type=3, depth=4, filters=[0, 1, 2, 3, 4],
+                                                   deflate="fixed", idat_size=100, palette_size=5)))
+    cases.append(("rgba 16 across the window", dict(width=300, height=64, color_type=6, depth=16,
+                                                    filters=[0, 1, 2, 3, 4], deflate="dynamic", idat_size=8192,
+                                                    repeat=True)))
+    cases.append(("rgb 8 stored across the window", dict(width=400, height=40, color_type=2, depth=8,
+                                                         filters=[1, 2, 3, 4, 0], deflate="stored",
+                                                         idat_size=65536)))
+
+    checked = 0
+    failed = 0
+    blocks = set()
+    with tempfile.TemporaryDirectory() as directory:
+        library = build(args.cc, directory)
+
+        for name, case in cases:
+            png, expected, data = make_image(rng, **case)
+            blocks.add(first_block(data))
+            rows, overrun = decode(library, png, case["width"], case["height"])
+            checked += 1
+            if rows is None or len(rows) != case["height"] or overrun:
+                failed += 1
+                print("%s: %s" % (name, "refused" if rows is None else "wrote past a row" if overrun else
+                                  "stopped after %d rows" % len(rows)), file=sys.stderr)
+                continue
+            for y, (row, wanted) in enumerate(zip(rows, expected)):
+                if row != wanted:
+                    failed += 1
+                    x = next(i for i in range(0, len(row), 4) if row[i:i + 4] != wanted[i:i + 4]) // 4
+                    print("%s: row %d pixel %d is %08X, not %08X" % (
+                        name, y, x, struct.unpack_from("<I", row, x * 4)[0],
+                        struct.unpack_from("<I", wanted, x * 4)[0]), file=sys.stderr)
+                    break
+
+        # broken images stop without writing past the row
+        png, expected, data = make_image(rng, 64, 32, 2, 8, [0, 1, 2, 3, 4], "dynamic", 1 << 20)
+        header = SIGNATURE + chunk(b"IHDR", struct.pack(">IIBBBBB", 64, 32, 8, 2, 0, 0, 0))
+        broken = [
+            ("truncated", png[:len(png) // 2], True),
+            ("interlaced", SIGNATURE + chunk(b"IHDR", struct.pack(">IIBBBBB", 64, 32, 8, 2, 0, 0, 1)) +
+             png[len(header):], False),
+            ("depth 16 palette", SIGNATURE + chunk(b"IHDR", struct.pack(">IIBBBBB", 64, 32, 16, 3, 0, 0, 0)) +
+             png[len(header):], False),
+            ("filter 5", header + chunk(b"IDAT", zlib.compress(b"\x05" + bytes(64 * 3))) + chunk(b"IEND", b""), True),
+            ("preset dictionary", header + chunk(b"IDAT", b"\x78\xbb" + data[2:]) + chunk(b"IEND", b""), False),
+            ("random image data", header + chunk(b"IDAT", b"\x78\x9c" + bytes(rng.randrange(256) for _ in range(500))) +
+             chunk(b"IEND", b""), True),
+        ]
+        for name, png, starts in broken:
+            rows, overrun = decode(library, png, 64, 32)
+            checked += 1
+            if overrun or (rows is None) == starts or (rows is not None and len(rows) == 32):
+                failed += 1
+                print("broken %s: %s" % (name, "wrote past a row" if overrun else "refused" if rows is None else
+                                         "decoded %d rows" % len(rows)), file=sys.stderr)
+
+    if blocks != {0, 1, 2}:
+        failed += 1
+        print("the corpus only starts with block types %s" % sorted(blocks), file=sys.stderr)
+
+    print("%d images checked, %d failed" % (checked, failed))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
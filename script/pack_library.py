@@ -0,0 +1,397 @@
+#!/usr/bin/env python3
+"""
+Packs a music library into the layout the player reads from the SD card.
+
+Every audio file under SOURCE becomes a directory in DEST holding a single
+track.pak (see inc/pack.h): its tags as meta.txt style key=value lines, its
+cover scaled down to a baseline JPEG if it has one and its audio as raw 16-bit
+stereo PCM at 44.1kHz, starting on a sector boundary. LIBRARY.IDX (see
+inc/catalog.h) is written next to them, so the player starts right away on the
+first boot. Where the directories are on the card isn't known here, the player
+looks a directory up by its name until its first rescan fills that in.
+
+Decoding is done by ffmpeg/ffprobe, which have to be on the PATH. Tracks are
+handed to a pool of worker processes, one per core by default. The manifest in
+DEST remembers the content hash of every source file, so only new and changed
+tracks are packed again and packing a library a second time only has to look
+at file sizes and modification times.
+
+    script/pack_library.py ~/Music /media/sdcard
+"""
+
+import argparse
+import hashlib
+import json
+import multiprocessing
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import time
+
+AUDIO_EXTENSIONS = {
+    ".aac", ".aif", ".aiff", ".ape", ".flac", ".m4a", ".mp3", ".ogg",
+    ".opus", ".wav", ".wma", ".wv",
+}
+# covers next to the audio files are preferred over embedded ones
+COVER_NAMES = ["cover", "folder", "front", "album"]
+COVER_EXTENSIONS = [".jpg", ".jpeg", ".png"]
+
+# bumping this repacks every track, do so when the output of a track changes
+PACKER_VERSION = 1
+MANIFEST_FILE = "pack_manifest.json"
+
+# inc/pack.h
+PACK_FILE = "track.pak"
+PACK_MAGIC = b"MPAK"
+PACK_VERSION = 1
+PACK_ALIGN = 512
+PACK_HEADER = struct.Struct("<4sHHIIIIII")
+
+# inc/catalog.h and src/catalog.c
+CATALOG_FILE = "LIBRARY.IDX"
+CATALOG_MAGIC = b"MPIX"
+CATALOG_VERSION = 6
+CATALOG_HEADER = struct.Struct("<4sHHIIIIII")
+CATALOG_ENTRY = struct.Struct("<6I4HI2H3IhHI2H")
+CATALOG_FLAG_PACKED = 0x0001
+CATALOG_MAX_ENTRIES = 20480
+CATALOG_MAX_STRING = 64
+CATALOG_IMAGE_SIZE = 0x00600000 // 2
+CATALOG_SONG_RATE = 44100 * 2 * 2
+
+assert PACK_HEADER.size == 32 and CATALOG_HEADER.size == 32 and CATALOG_ENTRY.size == 64
+
+
+def log(message):
+    print(message, file=sys.stderr, flush=True)
+
+
+def find_tracks(source):
+    """Returns the paths of all audio files under 'source', relative to it."""
+    tracks = []
+    for root, dirs, files in os.walk(source):
+        dirs.sort()
+        for name in sorted(files):
+            if os.path.splitext(name)[1].lower() in AUDIO_EXTENSIONS:
+                tracks.append(os.path.relpath(os.path.join(root, name), source))
+    return tracks
+
+
+def find_cover(path):
+    """Returns the cover image in the directory of 'path', or None."""
+    directory = os.path.dirname(path)
+    try:
+        files = {name.lower(): name for name in os.listdir(directory)}
+    except OSError:
+        return None
+    for name in COVER_NAMES:
+        for extension in COVER_EXTENSIONS:
+            if name + extension in files:
+                return os.path.join(directory, files[name + extension])
+    return None
+
+
+def hash_track(job):
+    """
+    Hashes the audio file and the cover next to it, along with everything
+    else that changes the packed track.
+    Returns the job with its 'hash' filled in.
+    """
+    digest = hashlib.sha1(b"%d %d" % (PACKER_VERSION, job["cover_size"]))
+    for path in (job["path"], find_cover(job["path"])):
+        if path is None:
+            continue
+        digest.update(os.path.basename(path).encode())
+        with open(path, "rb") as file:
+            for chunk in iter(lambda: file.read(1 << 20), b""):
+                digest.update(chunk)
+    job["hash"] = digest.hexdigest().upper()
+    return job
+
+
+def probe_tags(path):
+    """Returns the tags of 'path' with lowercase names."""
+    result = subprocess.run(
+        ["ffprobe", "-v", "error", "-print_format", "json", "-show_format", "-show_streams", path],
+        check=True, capture_output=True)
+    info = json.loads(result.stdout)
+    tags = {}
+    for stream in info.get("streams", []):
+        if stream.get("codec_type") == "audio":
+            tags.update({k.lower(): v for k, v in stream.get("tags", {}).items()})
+    tags.update({k.lower(): v for k, v in info.get("format", {}).get("tags", {}).items()})
+    return tags
+
+
+def leading_number(text):
+    """Returns the number at the start of 'text', so "3/12" is 3."""
+    digits = ""
+    for c in text.strip():
+        if not c.isdigit():
+            break
+        digits += c
+    return int(digits) if digits else 0
+
+
+def parse_gain(text):
+    """Returns a gain like "-6.57 dB" in hundredths of a dB."""
+    try:
+        return round(float(text.strip().split()[0]) * 100)
+    except (ValueError, IndexError):
+        return 0
+
+
+def clip(text):
+    """Returns 'text' cut to what the catalog keeps, on a character boundary."""
+    data = text.encode("utf-8")[:CATALOG_MAX_STRING - 1]
+    return data.decode("utf-8", "ignore")
+
+
+def read_meta(path, tags):
+    """Returns the fields of the track, named like the keys of meta.txt."""
+    title = tags.get("title") or os.path.splitext(os.path.basename(path))[0]
+    return {
+        "title": clip(" ".join(title.split())),
+        "artist": clip(" ".join((tags.get("artist") or tags.get("album_artist") or "").split())),
+        "album": clip(" ".join(tags.get("album", "").split())),
+        "track": min(leading_number(tags.get("track", tags.get("tracknumber", ""))), 0xFFFF),
+        "year": min(leading_number(tags.get("date", tags.get("year", ""))), 0xFFFF),
+        "gain": max(-0x8000, min(0x7FFF, parse_gain(tags.get("replaygain_track_gain", "")))),
+    }
+
+
+def decode_audio(path):
+    """Returns the first audio stream of 'path' as 16-bit stereo PCM at 44.1kHz."""
+    result = subprocess.run(
+        ["ffmpeg", "-v", "error", "-i", path, "-map", "0:a:0", "-vn",
+         "-f", "s16le", "-acodec", "pcm_s16le", "-ar", "44100", "-ac", "2", "-"],
+        check=True, capture_output=True)
+    return result.stdout
+
+
+def encode_cover(path, size):
+    """
+    Returns the cover of 'path' scaled down to fit 'size' pixels square as a
+    baseline 4:2:0 JPEG, the cover next to the file is preferred over the one
+    embedded in it. Returns b"" if there is no cover.
+    """
+    cover = find_cover(path)
+    source = cover if cover is not None else path
+    result = subprocess.run(
+        ["ffmpeg", "-v", "error", "-i", source, "-map", "0:v:0", "-frames:v", "1",
+         "-vf", "scale=%d:%d:force_original_aspect_ratio=decrease" % (size, size),
+         "-pix_fmt", "yuvj420p", "-q:v", "3", "-f", "mjpeg", "-"],
+        capture_output=True)
+    return result.stdout if result.returncode == 0 else b""
+
+
+def jpeg_size(data):
+    """Returns the width and height in the frame header of a JPEG."""
+    offset = 2
+    while offset + 9 <= len(data) and data[offset] == 0xFF:
+        marker = data[offset + 1]
+        if 0xC0 <= marker <= 0xCF and marker not in (0xC4, 0xC8, 0xCC):
+            height, width = struct.unpack(">HH", data[offset + 5:offset + 9])
+            return width, height
+        offset += 2 + struct.unpack(">H", data[offset + 2:offset + 4])[0]
+    return 0, 0
+
+
+def meta_text(meta):
+    """Returns the metadata as meta.txt contents."""
+    lines = ["%s=%s" % (key, meta[key]) for key in ("title", "artist", "album")]
+    lines += ["%s=%d" % (key, meta[key]) for key in ("track", "year") if meta[key]]
+    if meta["gain"]:
+        lines.append("gain=%.2f dB" % (meta["gain"] / 100))
+    return ("\n".join(lines) + "\n").encode("utf-8")
+
+
+def pack_track(job):
+    """
+    Writes the track.pak of one track to its directory in the destination.
+    Returns the record of the track for the manifest, or the job with an
+    'error' if it couldn't be packed.
+    """
+    try:
+        meta = read_meta(job["path"], probe_tags(job["path"]))
+        audio = decode_audio(job["path"])
+        cover = encode_cover(job["path"], job["cover_size"])
+    except (OSError, subprocess.CalledProcessError) as error:
+        job["error"] = str(error)
+        return job
+
+    # header, metadata, cover, then the audio on the next sector
+    text = meta_text(meta)
+    meta_offset = PACK_HEADER.size
+    cover_offset = meta_offset + len(text) if cover else 0
+    end = meta_offset + len(text) + len(cover)
+    audio_offset = (end + PACK_ALIGN - 1) // PACK_ALIGN * PACK_ALIGN
+    header = PACK_HEADER.pack(PACK_MAGIC, PACK_VERSION, PACK_HEADER.size,
+                              meta_offset, len(text), cover_offset, len(cover),
+                              audio_offset, len(audio))
+
+    directory = os.path.join(job["dest"], job["dir"])
+    os.makedirs(directory, exist_ok=True)
+    temporary = os.path.join(directory, PACK_FILE + ".tmp")
+    with open(temporary, "wb") as file:
+        file.write(header + text + cover)
+        file.write(b"\0" * (audio_offset - end))
+        file.write(audio)
+    os.replace(temporary, os.path.join(directory, PACK_FILE))
+
+    width, height = jpeg_size(cover) if cover else (0, 0)
+    return {
+        "path": job["rel"], "size": job["size"], "mtime": job["mtime"],
+        "hash": job["hash"], "dir": job["dir"], "meta": meta,
+        "cover": [cover_offset, len(cover), width, height],
+        "audio": [audio_offset, len(audio)],
+    }
+
+
+def assign_dirs(jobs, records):
+    """
+    Names the directories of new and changed tracks after their hash, the
+    firmware only reads 8.3 names so the first 8 hex digits that aren't taken
+    are used.
+    """
+    taken = {record["dir"] for record in records.values()}
+    for job in jobs:
+        for start in range(0, len(job["hash"]) - 8 + 1):
+            name = job["hash"][start:start + 8]
+            if name not in taken:
+                break
+        taken.add(name)
+        job["dir"] = name
+
+
+def write_index(dest, records):
+    """Writes LIBRARY.IDX for 'records', sorted by directory name."""
+    records = sorted(records, key=lambda record: record["dir"])
+    if len(records) > CATALOG_MAX_ENTRIES:
+        raise SystemExit("%d tracks, the player holds at most %d" % (len(records), CATALOG_MAX_ENTRIES))
+
+    # offset 0 is always the empty string, equal strings are only kept once
+    pool = bytearray(b"\0")
+    offsets = {"": 0}
+
+    def add_string(text):
+        if text not in offsets:
+            offsets[text] = len(pool)
+            pool.extend(text.encode("utf-8") + b"\0")
+        return offsets[text]
+
+    entries = bytearray()
+    for record in records:
+        meta = record["meta"]
+        audio_offset, audio_size = record["audio"]
+        cover_offset, cover_size, width, height = record["cover"]
+        # start cluster and timestamp of the directory are only known on the
+        # card, the player finds the directory by its name until its first
+        # rescan fills them in. The player also fills in the color of the
+        # cover once it decoded it
+        entries += CATALOG_ENTRY.pack(
+            add_string(record["dir"]), add_string(meta["title"]), add_string(meta["artist"]),
+            0, audio_offset + audio_size, audio_size // CATALOG_SONG_RATE,
+            0, 0, width, height,
+            add_string(meta["album"]), meta["track"], meta["year"],
+            audio_offset, cover_offset, cover_size,
+            meta["gain"], CATALOG_FLAG_PACKED, 0, 0, 0)
+
+    entries_offset = CATALOG_HEADER.size
+    pool_offset = entries_offset + len(entries)
+    size = pool_offset + len(pool)
+    if size > CATALOG_IMAGE_SIZE:
+        raise SystemExit("library index is %d bytes, the player holds at most %d" % (size, CATALOG_IMAGE_SIZE))
+
+    header = CATALOG_HEADER.pack(CATALOG_MAGIC, CATALOG_VERSION, CATALOG_ENTRY.size,
+                                 len(records), entries_offset, pool_offset, len(pool), size, 0)
+    temporary = os.path.join(dest, CATALOG_FILE + ".tmp")
+    with open(temporary, "wb") as file:
+        file.write(header + entries + pool)
+    os.replace(temporary, os.path.join(dest, CATALOG_FILE))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0].strip())
+    parser.add_argument("source", help="directory tree of audio files")
+    parser.add_argument("dest", help="root of the SD card (or a copy of it)")
+    parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count(),
+                        help="number of worker processes (default: number of cores)")
+    parser.add_argument("--cover-size", type=int, default=400,
+                        help="largest width and height of a cover in pixels (default: 400)")
+    parser.add_argument("--force", action="store_true", help="pack every track again")
+    args = parser.parse_args()
+
+    for tool in ("ffmpeg", "ffprobe"):
+        if shutil.which(tool) is None:
+            raise SystemExit("%s not found on the PATH" % tool)
+
+    start = time.monotonic()
+    os.makedirs(args.dest, exist_ok=True)
+    manifest_path = os.path.join(args.dest, MANIFEST_FILE)
+    records = {}
+    if os.path.exists(manifest_path) and not args.force:
+        with open(manifest_path) as file:
+            records = {record["path"]: record for record in json.load(file)}
+
+    # tracks whose size and modification time haven't changed are kept
+    # without even being hashed
+    tracks = find_tracks(args.source)
+    kept = {}
+    jobs = []
+    for rel in tracks:
+        path = os.path.join(args.source, rel)
+        stat = os.stat(path)
+        record = records.get(rel)
+        if (record is not None and record["size"] == stat.st_size and record["mtime"] == stat.st_mtime_ns and
+                os.path.exists(os.path.join(args.dest, record["dir"], PACK_FILE))):
+            kept[rel] = record
+            continue
+        jobs.append({"rel": rel, "path": path, "size": stat.st_size, "mtime": stat.st_mtime_ns,
+                     "dest": args.dest, "cover_size": args.cover_size})
+
+    with multiprocessing.Pool(args.jobs) as pool:
+        # changed files with the same contents as before only get a new
+        # size and modification time
+        if jobs:
+            log("hashing %d new or changed tracks" % len(jobs))
+        pack_jobs = []
+        for job in pool.imap_unordered(hash_track, jobs, chunksize=4):
+            record = records.get(job["rel"])
+            if (record is not None and record["hash"] == job["hash"] and
+                    os.path.exists(os.path.join(args.dest, record["dir"], PACK_FILE))):
+                kept[job["rel"]] = dict(record, size=job["size"], mtime=job["mtime"])
+            else:
+                pack_jobs.append(job)
+
+        assign_dirs(pack_jobs, kept)
+        packed = dict(kept)
+        failed = 0
+        for done, result in enumerate(pool.imap_unordered(pack_track, pack_jobs), 1):
+            if "error" in result:
+                failed += 1
+                log("failed %s: %s" % (result["rel"], result["error"]))
+            else:
+                packed[result["path"]] = result
+            log("[%d/%d] %s" % (done, len(pack_jobs), result.get("rel", result.get("path"))))
+
+    # directories of tracks that were removed, changed or failed are deleted
+    current = {record["dir"] for record in packed.values()}
+    for record in records.values():
+        if record["dir"] not in current:
+            shutil.rmtree(os.path.join(args.dest, record["dir"]), ignore_errors=True)
+
+    write_index(args.dest, packed.values())
+    with open(manifest_path + ".tmp", "w") as file:
+        json.dump(sorted(packed.values(), key=lambda record: record["path"]), file, indent=1)
+    os.replace(manifest_path + ".tmp", manifest_path)
+
+    log("%d tracks: %d packed, %d unchanged, %d failed in %.1f s" % (
+        len(tracks), len(pack_jobs) - failed, len(kept), failed, time.monotonic() - start))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
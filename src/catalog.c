@@ -0,0 +1,1322 @@
+/* clang-format off */
+
+#include "catalog.h"
+
+#include "cover.h"
+#include "diskio.h"
+#include "ff.h"
+#include "meta.h"
+#include "pack.h"
+#include "perf.h"
+#include "sdram.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <stdbool.h>
+#include <string.h>
+
+// library index file in the root of the card
+#define CATALOG_FILE        "/LIBRARY.IDX"
+// the index is written to this file first and then renamed over the old one
+#define CATALOG_TEMP        "/LIBRARY.TMP"
+// most songs the catalog can hold
+#define CATALOG_MAX_ENTRIES 20480
+// longest string (including the terminator) kept for a title, artist or album
+#define CATALOG_MAX_STRING  64
+// bytes per second of song.raw (16-bit stereo at 44.1kHz)
+#define CATALOG_SONG_RATE   (44100 * 2 * 2)
+// the SDRAM region holds two images of the index, the active catalog and the
+// one a rescan is building, they swap when the rescan is done
+#define CATALOG_IMAGE_SIZE  (SDRAM_CATALOG_SIZE / 2)
+// most directory entries read by one slice of a rescan
+#define CATALOG_SLICE_DIRS  8
+// bytes of string pool moved by one slice of a rescan
+#define CATALOG_SLICE_MOVE  16384
+// bytes of index written by one slice of a rescan
+#define CATALOG_SLICE_WRITE 2048
+// bytes of an old index whose clusters are freed by one slice of a rescan
+#define CATALOG_SLICE_FREE  262144
+// slots in the table of directory names, a power of two well over the most
+// entries so probe sequences stay short
+#define CATALOG_HASH_SIZE   32768
+// directory names added to the table by one slice of a rescan
+#define CATALOG_SLICE_HASH  1024
+// sort keys made by one slice of a sort
+#define CATALOG_SLICE_KEYS  1024
+// heap sift downs done by one slice of a sort
+#define CATALOG_SLICE_SIFTS 256
+
+// the active catalog, in the index file layout at the start of its image
+static struct {
+    FATFS *fs;
+    Catalog_Header *header;
+    Catalog_Entry *entries;
+    char *pool;
+    // bumped every time a rescanned catalog replaces the active one
+    uint32_t generation;
+    // generation the table of directory names was made for, and the one it
+    // is being made for with the number of names added to it so far
+    uint32_t hashed;
+    uint32_t hashing;
+    uint32_t hash_next;
+    // colors of covers added to entries since the index file was written
+    uint32_t colors;
+} catalog = {
+    .header = (Catalog_Header *)SDRAM_CATALOG,
+    .entries = (Catalog_Entry *)(SDRAM_CATALOG + sizeof(Catalog_Header)),
+    .pool = (char *)(SDRAM_CATALOG + sizeof(Catalog_Header)),
+    .hashed = UINT32_MAX,
+    .hashing = UINT32_MAX,
+};
+
+// table of directory names, open addressing with linear probing, each slot
+// holds the index of an entry plus one so that 0 is an empty slot
+static uint32_t *const catalog_table = (uint32_t *)SDRAM_CATALOG_HASH;
+
+_Static_assert(CATALOG_HASH_SIZE * sizeof(uint32_t) <= SDRAM_CATALOG_HASH_SIZE,
+               "table of directory names does not fit in its SDRAM region");
+_Static_assert(CATALOG_HASH_SIZE > CATALOG_MAX_ENTRIES, "table of directory names is too small");
+
+// the catalog a rescan is building in the other image, its string pool is
+// kept after the largest possible number of entries and moved down once the
+// number of entries is known. The index file is written by the same slices
+// into a temporary file that then replaces it
+static struct {
+    enum {
+        RESCAN_IDLE, RESCAN_HASH, RESCAN_WALK, RESCAN_SONG, RESCAN_META, RESCAN_META_FILE, RESCAN_COVER,
+        RESCAN_PACK, RESCAN_SORT, RESCAN_CLEAN, RESCAN_SAVE, RESCAN_REPLACE, RESCAN_RENAME, RESCAN_STATES
+    } state;
+    Catalog_Header *header;
+    Catalog_Entry *entries;
+    char *pool;
+    DIR dir;
+    FIL file;
+    // entry of the active catalog expected to be the next directory walked
+    uint32_t next;
+    // bytes of the pool moved or of the index written so far
+    uint32_t offset;
+    bool changed;
+    // reads of the tags of a song, its strings are added to the pool from here
+    char tags[META_TAG_BUFFER];
+    // longest slice since the rescan or save started and what it was doing
+    uint32_t longest_us;
+    uint32_t longest;
+} rescan;
+
+// what each state of a rescan does, for the longest slice
+static const char *const rescan_names[RESCAN_STATES] = {
+    "idle", "hash", "walk", "song", "tags", "meta.txt", "cover", "pack", "sort", "clean", "save", "replace", "rename",
+};
+
+// sort key of a song, the first 8 bytes of the string it is sorted by are
+// packed big-endian into 'prefix' so most comparisons are a single integer
+// compare that never touches the string pool
+typedef struct {
+    uint64_t prefix;
+    uint32_t string;    // offset of the whole string in the string pool
+    uint32_t index;     // entry of the song
+} Catalog_Key;
+
+_Static_assert(2 * CATALOG_MAX_ENTRIES * sizeof(Catalog_Key) <= SDRAM_CATALOG_KEYS_SIZE,
+               "sort keys do not fit in their SDRAM region");
+_Static_assert(2 * CATALOG_MAX_ENTRIES * sizeof(Catalog_Key) <= SDRAM_CATALOG_SEARCH_SIZE,
+               "search keys do not fit in their SDRAM region");
+
+// the play order, keys of the active catalog sorted by 'sort'
+static struct {
+    CATALOG_SORT sort;
+    Catalog_Key *keys;
+} order;
+
+// the search index, a key for every title and artist of the active catalog
+// with letter case and punctuation normalized away, sorted so that all the
+// strings starting with a query are next to each other. It is remade in the
+// background whenever the catalog changes and can't be used meanwhile
+static struct {
+    Catalog_Key *keys;
+    uint32_t count;
+    // generation of the catalog the keys are for
+    uint32_t generation;
+} search = {
+    .keys = (Catalog_Key *)SDRAM_CATALOG_SEARCH,
+    .generation = UINT32_MAX,
+};
+
+// a sort in progress, the keys are made in the array the play order isn't
+// using (or the search index) and heapsorted in place, which needs no memory
+// besides the keys and can be stopped after any sift down
+static struct {
+    enum { SORT_IDLE, SORT_KEYS, SORT_HEAPIFY, SORT_EXTRACT } state;
+    CATALOG_SORT sort;
+    bool search;
+    const Catalog_Header *header;
+    const Catalog_Entry *entries;
+    const char *pool;
+    Catalog_Key *keys;
+    uint32_t count;
+    uint32_t next;
+    uint32_t cycles;
+} sort;
+
+// memory left for the string pool while building
+#define CATALOG_MAX_POOL (CATALOG_IMAGE_SIZE - sizeof(Catalog_Header) - CATALOG_MAX_ENTRIES * sizeof(Catalog_Entry))
+
+_Static_assert(CATALOG_MAX_ENTRIES * sizeof(Catalog_Entry) < CATALOG_IMAGE_SIZE / 2,
+               "catalog entries leave no room for strings in their SDRAM image");
+_Static_assert(META_MAX_SIZE <= PACK_HEADER_READ, "metadata of a container is read into the buffer of its header");
+
+static bool catalog_load(void);
+static void catalog_walk(void);
+static const Catalog_Entry *catalog_find(const char *name);
+static void catalog_pack(void);
+static void catalog_start_sort(void);
+static void catalog_start_search(void);
+static void catalog_sort(void);
+static void catalog_make_key(uint32_t string, uint32_t index);
+static void catalog_sift(uint32_t root, uint32_t count);
+static int catalog_compare(const Catalog_Key *a, const Catalog_Key *b);
+static int catalog_compare_query(const Catalog_Key *key, const char *query, uint32_t len);
+static char catalog_normalize(char c);
+static bool catalog_hash_names(uint32_t count);
+static uint32_t catalog_hash(const char *name, uint32_t len);
+static bool catalog_name_equal(const char *name, uint32_t len, const char *entry);
+static void catalog_save(void);
+static void catalog_replace(void);
+static bool catalog_free(const char *path, FRESULT *res);
+static uint32_t catalog_add_string(const char *str, uint32_t len);
+static void catalog_read_song(Catalog_Entry *entry);
+static void catalog_read_pack(Catalog_Entry *entry, FIL *file);
+static bool catalog_read_tags(Catalog_Entry *entry);
+static void catalog_read_meta(Catalog_Entry *entry);
+static void catalog_add_meta(Catalog_Entry *entry, const Meta_Info *info);
+static void catalog_read_cover(Catalog_Entry *entry);
+static const char *catalog_song_file(const Catalog_Entry *entry);
+static DWORD catalog_cluster(uint32_t index);
+static FRESULT catalog_open(DWORD cluster, FIL *file, const char *name, BYTE mode);
+static FRESULT catalog_stat(DWORD cluster, const char *name, FILINFO *file_info);
+
+/*
+** Loads the catalog from the library index file on 'fs' and starts a rescan
+** of the card in the background, if the index is missing the catalog is built
+** from the directories in the root of 'fs' before returning
+** Returns 'true' if there is a usable catalog
+*/
+bool Catalog_Init(FATFS *fs) {
+    catalog.fs = fs;
+
+    DISKIO_CLASS cls = disk_set_class(DISKIO_CLASS_META);
+    bool loaded = catalog_load();
+    disk_set_class(cls);
+
+    // a loaded index can be played from straight away, whatever changed on
+    // the card since it was written is picked up during playback
+    if (loaded) {
+        Catalog_Sort(order.sort);
+        while (Catalog_Process());
+        Catalog_StartRescan();
+        return true;
+    }
+    return Catalog_Build(fs);
+}
+
+/*
+** Builds the catalog of songs from the directories in the root of 'fs' and
+** writes the library index file, entries of the current catalog whose
+** directory hasn't changed are reused as they are
+** Returns 'true' if the root directory could be read
+*/
+bool Catalog_Build(FATFS *fs) {
+    catalog.fs = fs;
+    if (!Catalog_StartRescan()) return false;
+    while (Catalog_Process());
+    return true;
+}
+
+/*
+** Starts comparing the directories in the root of the card with the catalog,
+** the work is done in slices by Catalog_Process()
+** Returns 'true' if a rescan is running
+*/
+bool Catalog_StartRescan(void) {
+    if (rescan.state != RESCAN_IDLE) return true;
+    if (f_opendir(&rescan.dir, "/") != FR_OK) return false;
+
+    // build in whichever image the active catalog isn't using
+    uint8_t *image = (uint8_t *)SDRAM_CATALOG;
+    if ((uint8_t *)catalog.header == image) image += CATALOG_IMAGE_SIZE;
+
+    Catalog_Header *header = (Catalog_Header *)image;
+    rescan.header = header;
+    rescan.entries = (Catalog_Entry *)(image + sizeof(Catalog_Header));
+    rescan.pool = (char *)(rescan.entries + CATALOG_MAX_ENTRIES);
+    rescan.next = 0;
+    rescan.offset = 0;
+    rescan.changed = false;
+
+    memcpy(header->magic, CATALOG_MAGIC, sizeof(header->magic));
+    header->version = CATALOG_VERSION;
+    header->entry_size = sizeof(Catalog_Entry);
+    header->count = 0;
+    header->entries = sizeof(Catalog_Header);
+    header->pool = 0;
+    header->size = 0;
+    header->reserved = 0;
+    // offset 0 of the pool is the empty string
+    header->pool_size = 1;
+    rescan.pool[0] = '\0';
+
+    // unchanged directories are looked up by name in the active catalog
+    rescan.state = RESCAN_HASH;
+    return true;
+}
+
+/*
+** Does one slice of the running sort or rescan, a slice looks up or reads at
+** most a few sectors of a file or two, or does a bounded part of a sort or of
+** the table of directory names, so it can be done between two refills of the
+** audio buffer. Directories with the same start cluster and timestamp as
+** their entry are kept as they are, only changed and new ones have their
+** song, meta.txt (or the tags of the song) and cover read, or just the header
+** of their track container. If anything changed the new catalog is sorted,
+** replaces the active one and is then written to a temporary file that
+** replaces the library index file, as is the active one once enough colors of
+** covers were added to it. Whenever the catalog changed its search index is
+** made again
+** Returns 'true' if there is still work left to do
+*/
+bool Catalog_Process(void) {
+    // the search index is remade whenever the catalog changed, unless the
+    // catalog is about to change again
+    if (sort.state == SORT_IDLE && rescan.state != RESCAN_SORT && search.generation != catalog.generation) {
+        catalog_start_search();
+    }
+
+    if (sort.state != SORT_IDLE) {
+        catalog_sort();
+        return true;
+    }
+
+    // enough colors of covers were added to be worth writing the index again
+    if (rescan.state == RESCAN_IDLE && catalog.colors >= CATALOG_SAVE_COLORS) {
+        catalog.colors = 0;
+        rescan.offset = 0;
+        rescan.state = RESCAN_CLEAN;
+    }
+    if (rescan.state == RESCAN_IDLE) return false;
+
+    // the entry of the directory being read
+    Catalog_Entry *entry = &rescan.entries[rescan.header->count - 1];
+    DISKIO_CLASS cls = disk_set_class(DISKIO_CLASS_META);
+    uint32_t state = rescan.state;
+    uint32_t start = Perf_Cycles();
+
+    switch (rescan.state) {
+    case RESCAN_IDLE: break;
+    case RESCAN_HASH:
+        if (catalog_hash_names(CATALOG_SLICE_HASH)) rescan.state = RESCAN_WALK;
+        break;
+    case RESCAN_WALK: catalog_walk(); break;
+    // a changed or new directory, one of its files is read per slice
+    case RESCAN_SONG:
+        catalog_read_song(entry);
+        rescan.state = RESCAN_META;
+        break;
+    case RESCAN_META:
+        rescan.state = catalog_read_tags(entry) ? RESCAN_COVER : RESCAN_META_FILE;
+        break;
+    case RESCAN_META_FILE:
+        catalog_read_meta(entry);
+        rescan.state = RESCAN_COVER;
+        break;
+    case RESCAN_COVER:
+        catalog_read_cover(entry);
+        rescan.state = RESCAN_WALK;
+        break;
+    case RESCAN_PACK: catalog_pack(); break;
+    // swapped in by catalog_sort() when the new catalog is sorted
+    case RESCAN_SORT: break;
+    // a temporary file left by a save that was cut short is removed first
+    case RESCAN_CLEAN: {
+        FRESULT res;
+        if (catalog_free(CATALOG_TEMP, &res)) rescan.state = RESCAN_SAVE;
+        break;
+    }
+    case RESCAN_SAVE: catalog_save(); break;
+    case RESCAN_REPLACE:
+    case RESCAN_RENAME: catalog_replace(); break;
+    case RESCAN_STATES: break;
+    }
+
+    disk_set_class(cls);
+
+    uint32_t us = Perf_CyclesToUs(Perf_Cycles() - start);
+    if (us > rescan.longest_us) {
+        rescan.longest_us = us;
+        rescan.longest = state;
+    }
+    if (rescan.state == RESCAN_IDLE) {
+        printf("catalog: longest slice %lu us (%s), %u us allowed\r\n", rescan.longest_us,
+               rescan_names[rescan.longest], CATALOG_SLICE_US);
+        rescan.longest_us = 0;
+    }
+    return rescan.state != RESCAN_IDLE;
+}
+
+/*
+** Returns the number of songs in the catalog
+*/
+uint32_t Catalog_Count(void) {
+    return catalog.header->count;
+}
+
+/*
+** Returns the entry of song 'index'
+*/
+const Catalog_Entry *Catalog_Get(uint32_t index) {
+    return &catalog.entries[index];
+}
+
+/*
+** Returns the string at 'offset' in the string pool
+*/
+const char *Catalog_String(uint32_t offset) {
+    return &catalog.pool[offset];
+}
+
+/*
+** Starts sorting the play order by 'sort', the work is done in slices by
+** Catalog_Process() and the order changes once the sort is done
+*/
+void Catalog_Sort(CATALOG_SORT sort) {
+    order.sort = sort;
+    catalog_start_sort();
+}
+
+/*
+** Returns 'true' while a sort started by Catalog_Sort() is still running
+*/
+bool Catalog_IsSorting(void) {
+    return sort.state != SORT_IDLE && !sort.search;
+}
+
+/*
+** Returns the index of the song at 'position' in the play order
+*/
+uint32_t Catalog_Sorted(uint32_t position) {
+    if (order.keys == NULL) return position;
+    return order.keys[position].index;
+}
+
+/*
+** Returns the position of song 'index' in the play order, or CATALOG_NONE if
+** it isn't in it. The whole order is searched
+*/
+uint32_t Catalog_Position(uint32_t index) {
+    for (uint32_t position = 0; position < catalog.header->count; position++) {
+        if (Catalog_Sorted(position) == index) return position;
+    }
+    return CATALOG_NONE;
+}
+
+#ifdef CATALOG_BENCHMARK
+/*
+** Sorts the play order by directory name, title and artist in turn, each
+** one to completion, and prints the time each took from start to finish over
+** UART next to the CPU time the sort prints itself. The order is left sorted
+** by directory name
+*/
+void Catalog_Benchmark(void) {
+    static const char *const names[] = { "name", "title", "artist" };
+    const CATALOG_SORT sorts[] = { CATALOG_SORT_TITLE, CATALOG_SORT_ARTIST, CATALOG_SORT_NAME };
+
+    for (uint32_t i = 0; i < sizeof(sorts) / sizeof(sorts[0]); i++) {
+        uint32_t start = Perf_Cycles();
+        Catalog_Sort(sorts[i]);
+        while (Catalog_IsSorting()) Catalog_Process();
+        printf("catalog: sort by %s of %lu songs took %lu us\r\n", names[sorts[i]], catalog.header->count,
+               Perf_CyclesToUs(Perf_Cycles() - start));
+    }
+}
+#endif
+
+/*
+** Returns a number that changes every time a rescan replaces the catalog,
+** song indexes from an older generation must be looked up again
+*/
+uint32_t Catalog_Generation(void) {
+    return catalog.generation;
+}
+
+/*
+** Looks up the song in the directory whose name is the first 'len'
+** characters of 'name', letter case is ignored like FAT does. The first
+** lookup after the catalog changed hashes all directory names
+** Returns the index of the song, or CATALOG_NONE if there is no such directory
+*/
+uint32_t Catalog_Find(const char *name, uint32_t len) {
+    if (catalog.hashed != catalog.generation) catalog_hash_names(UINT32_MAX);
+
+    uint32_t mask = CATALOG_HASH_SIZE - 1;
+    for (uint32_t slot = catalog_hash(name, len) & mask; catalog_table[slot] != 0; slot = (slot + 1) & mask) {
+        uint32_t index = catalog_table[slot] - 1;
+        if (catalog_name_equal(name, len, Catalog_String(catalog.entries[index].name))) return index;
+    }
+    return CATALOG_NONE;
+}
+
+/*
+** Starts a search that matches every title and artist in the catalog
+** Returns 'false' if the search index is still being made
+*/
+bool Catalog_SearchStart(Catalog_Search *search_range) {
+    search_range->first = 0;
+    search_range->count = 0;
+    search_range->generation = search.generation;
+    if (search.generation != catalog.generation) return false;
+
+    search_range->count = search.count;
+    return true;
+}
+
+/*
+** Narrows 'search_range' to the titles and artists that start with the first
+** 'len' characters of 'query', letter case is ignored and any character that
+** isn't a letter or digit matches any other such character. Only the matches
+** of the last narrowing are searched, so 'query' has to start with the query
+** it was last narrowed with
+** Returns 'false' if the search index changed since the search started
+*/
+bool Catalog_SearchNarrow(Catalog_Search *search_range, const char *query, uint32_t len) {
+    if (search_range->generation != search.generation || search.generation != catalog.generation) {
+        search_range->count = 0;
+        return false;
+    }
+
+    // first key that starts with the query or comes after it
+    uint32_t low = search_range->first;
+    uint32_t high = search_range->first + search_range->count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (catalog_compare_query(&search.keys[mid], query, len) < 0) low = mid + 1;
+        else high = mid;
+    }
+    uint32_t first = low;
+
+    // first key that comes after the query
+    high = search_range->first + search_range->count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (catalog_compare_query(&search.keys[mid], query, len) <= 0) low = mid + 1;
+        else high = mid;
+    }
+
+    search_range->first = first;
+    search_range->count = low - first;
+    return true;
+}
+
+/*
+** Returns the index of the song of match 'n' of 'search_range'
+*/
+uint32_t Catalog_SearchResult(const Catalog_Search *search_range, uint32_t n) {
+    return search.keys[search_range->first + n].index;
+}
+
+/*
+** Keeps 'color' as the dominant color of the cover of song 'index' in its
+** entry, the library index file is written again in the background once
+** CATALOG_SAVE_COLORS colors were added
+*/
+void Catalog_SetColor(uint32_t index, uint32_t color) {
+    if (index >= catalog.header->count || catalog.entries[index].color == color) return;
+
+    // a rescan that already copied the entry loses the color, it is just
+    // added again the next time the cover is shown
+    catalog.entries[index].color = color;
+    catalog.colors++;
+}
+
+/*
+** Opens the file 'name' in the directory of song 'index', the directory is
+** found by its start cluster so no path lookup is needed, or by its name the
+** first time if the index came without clusters
+** Returns the result of f_open()
+*/
+FRESULT Catalog_Open(uint32_t index, FIL *file, const char *name, BYTE mode) {
+    return catalog_open(catalog_cluster(index), file, name, mode);
+}
+
+/*
+** Opens the file holding the audio of song 'index' for reading, its track
+** container if it has one and its song.raw otherwise. The audio and any
+** embedded cover are at the offsets in its entry
+** Returns the result of f_open()
+*/
+FRESULT Catalog_OpenSong(uint32_t index, FIL *file) {
+    return Catalog_Open(index, file, catalog_song_file(&catalog.entries[index]), FA_READ);
+}
+
+/*
+** Opens the file holding the cover of song 'index' for reading, its song's
+** file if the cover is embedded at the offset in its entry and its cover.jpg
+** or cover.png otherwise. The one the rescan found is tried first
+** Returns the result of f_open()
+*/
+FRESULT Catalog_OpenCover(uint32_t index, FIL *file) {
+    const Catalog_Entry *entry = &catalog.entries[index];
+    if (entry->cover_size != 0) return Catalog_Open(index, file, catalog_song_file(entry), FA_READ);
+
+    bool png = (entry->flags & CATALOG_FLAG_PNG) != 0;
+    FRESULT res = Catalog_Open(index, file, png ? "cover.png" : "cover.jpg", FA_READ);
+    if (res != FR_NO_FILE) return res;
+    return Catalog_Open(index, file, png ? "cover.jpg" : "cover.png", FA_READ);
+}
+
+/*
+** Returns a key for song 'index' that stays the same across rescans and
+** reboots as long as its directory and cover don't change, made of the hash
+** of its directory name and the timestamp of the directory and its cover
+*/
+uint64_t Catalog_SongKey(uint32_t index) {
+    const Catalog_Entry *entry = &catalog.entries[index];
+    const char *name = Catalog_String(entry->name);
+    uint32_t stamp = ((uint32_t)entry->date << 16 | entry->time) ^ entry->cover_size ^ entry->cover_offset;
+    return (uint64_t)catalog_hash(name, strlen(name)) << 32 | stamp;
+}
+
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/* HELPERS                                                                    */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+
+/*
+** Reads the library index file straight into the catalog's SDRAM and checks
+** that everything in it can be used in place
+** Returns 'true' if the index was read and is valid
+*/
+bool catalog_load(void) {
+    Catalog_Header *header = catalog.header;
+    FIL file;
+    UINT bytes_read = 0;
+
+    header->count = 0;
+    header->size = 0;
+    // a save cut short between removing the old index and renaming the new
+    // one leaves only the new one, a partly written one fails the checks
+    if (f_open(&file, CATALOG_FILE, FA_READ) != FR_OK && f_open(&file, CATALOG_TEMP, FA_READ) != FR_OK) return false;
+
+    bool valid = f_read(&file, header, sizeof(*header), &bytes_read) == FR_OK &&
+                 bytes_read == sizeof(*header) &&
+                 memcmp(header->magic, CATALOG_MAGIC, sizeof(header->magic)) == 0 &&
+                 header->version == CATALOG_VERSION &&
+                 header->entry_size == sizeof(Catalog_Entry) &&
+                 header->size == f_size(&file) &&
+                 header->size <= CATALOG_IMAGE_SIZE &&
+                 header->count <= CATALOG_MAX_ENTRIES &&
+                 header->entries == sizeof(Catalog_Header) &&
+                 header->pool == header->entries + header->count * sizeof(Catalog_Entry) &&
+                 header->pool_size > 0 &&
+                 header->pool + header->pool_size == header->size;
+
+    // the rest of the index in one read
+    if (valid) {
+        uint32_t rest = header->size - sizeof(*header);
+        valid = f_read(&file, header + 1, rest, &bytes_read) == FR_OK && bytes_read == rest;
+    }
+    f_close(&file);
+
+    if (valid) {
+        catalog.entries = (Catalog_Entry *)((uint8_t *)header + header->entries);
+        catalog.pool = (char *)header + header->pool;
+        valid = catalog.pool[0] == '\0' && catalog.pool[header->pool_size - 1] == '\0';
+    }
+
+    // every string must be inside the pool
+    for (uint32_t i = 0; valid && i < header->count; i++) {
+        Catalog_Entry *entry = &catalog.entries[i];
+        valid = entry->name < header->pool_size &&
+                entry->title < header->pool_size &&
+                entry->artist < header->pool_size &&
+                entry->album < header->pool_size;
+    }
+
+    if (!valid) {
+        header->count = 0;
+        header->size = 0;
+    }
+    return valid;
+}
+
+/*
+** Reads the next few entries of the root directory, unchanged directories are
+** copied from the active catalog and the first changed or new one stops the
+** walk so its files can be read by the following slices
+*/
+void catalog_walk(void) {
+    Catalog_Header *header = rescan.header;
+    FILINFO file_info;
+
+    for (uint32_t i = 0; i < CATALOG_SLICE_DIRS; i++) {
+        // a directory that can't be read would look like every song after it
+        // was removed, so give up and keep the active catalog
+        if (f_readdir(&rescan.dir, &file_info) != FR_OK) {
+            f_closedir(&rescan.dir);
+            rescan.state = RESCAN_IDLE;
+            return;
+        }
+
+        if (file_info.fname[0] == 0 || header->count == CATALOG_MAX_ENTRIES) {
+            f_closedir(&rescan.dir);
+            // entries that weren't walked again were removed
+            bool changed = rescan.changed || header->count != catalog.header->count;
+            rescan.state = changed ? RESCAN_PACK : RESCAN_IDLE;
+            return;
+        }
+
+        // only directories hold songs, skip things like "System Volume Information"
+        if ((file_info.fattrib & AM_DIR) == 0) continue;
+        if (file_info.fattrib & (AM_HID | AM_SYS)) continue;
+
+        Catalog_Entry *entry = &rescan.entries[header->count++];
+        const Catalog_Entry *old = catalog_find(file_info.fname);
+
+        // an index written by script/pack_library.py can't know where the
+        // directories are on the card, the rest of their entries is what
+        // reading them would give so only the start cluster and timestamp
+        // are filled in
+        bool unresolved = (old != NULL && old->cluster == 0 && (old->flags & CATALOG_FLAG_PACKED) != 0);
+
+        // FAT keeps no size for directories, one that was deleted and created
+        // again shows up as a different start cluster instead
+        if (old != NULL && (unresolved ||
+            (old->cluster == file_info.fclust &&
+             old->date == file_info.fdate &&
+             old->time == file_info.ftime))) {
+            const char *title = Catalog_String(old->title);
+            const char *artist = Catalog_String(old->artist);
+            const char *album = Catalog_String(old->album);
+            *entry = *old;
+            entry->name = catalog_add_string(file_info.fname, strlen(file_info.fname));
+            entry->title = catalog_add_string(title, strlen(title));
+            entry->artist = catalog_add_string(artist, strlen(artist));
+            entry->album = catalog_add_string(album, strlen(album));
+            if (unresolved) {
+                entry->cluster = file_info.fclust;
+                entry->date = file_info.fdate;
+                entry->time = file_info.ftime;
+                rescan.changed = true;
+            }
+            continue;
+        }
+
+        memset(entry, 0, sizeof(*entry));
+        entry->name = catalog_add_string(file_info.fname, strlen(file_info.fname));
+        entry->cluster = file_info.fclust;
+        entry->date = file_info.fdate;
+        entry->time = file_info.ftime;
+        rescan.changed = true;
+        rescan.state = RESCAN_SONG;
+        return;
+    }
+}
+
+/*
+** Looks up the directory 'name' in the active catalog, directories are
+** usually walked in the same order as last time so the entry after the last
+** one found is tried first, then the table of directory names
+** Returns the entry, or NULL if the directory is new
+*/
+const Catalog_Entry *catalog_find(const char *name) {
+    uint32_t count = catalog.header->count;
+
+    if (rescan.next < count && strcmp(Catalog_String(catalog.entries[rescan.next].name), name) == 0) {
+        return &catalog.entries[rescan.next++];
+    }
+
+    uint32_t index = Catalog_Find(name, strlen(name));
+    if (index == CATALOG_NONE) return NULL;
+    rescan.next = index + 1;
+    return &catalog.entries[index];
+}
+
+/*
+** Moves a piece of the string pool of the new catalog down to right after its
+** entries, once all of it is there the new catalog becomes the active one
+*/
+void catalog_pack(void) {
+    Catalog_Header *header = rescan.header;
+    char *pool = (char *)(rescan.entries + header->count);
+
+    // the pool only moves down, so moving it front to back in pieces never
+    // overwrites a part that hasn't been moved yet
+    uint32_t len = header->pool_size - rescan.offset;
+    if (len > CATALOG_SLICE_MOVE) len = CATALOG_SLICE_MOVE;
+    memmove(pool + rescan.offset, rescan.pool + rescan.offset, len);
+    rescan.offset += len;
+    if (rescan.offset < header->pool_size) return;
+
+    header->pool = (uint32_t)(pool - (char *)header);
+    header->size = header->pool + header->pool_size;
+
+    rescan.state = RESCAN_SORT;
+    catalog_start_sort();
+}
+
+/*
+** Starts sorting the catalog being rescanned, or the active one if there is
+** no rescan waiting for its sort, by the sort order of the play order. A sort
+** that was already running is started over
+*/
+void catalog_start_sort(void) {
+    const Catalog_Header *header = (rescan.state == RESCAN_SORT) ? rescan.header : catalog.header;
+    Catalog_Key *keys = (Catalog_Key *)SDRAM_CATALOG_KEYS;
+    if (order.keys == keys) keys += CATALOG_MAX_ENTRIES;
+
+    sort.sort = order.sort;
+    sort.search = false;
+    sort.header = header;
+    sort.entries = (const Catalog_Entry *)((const uint8_t *)header + header->entries);
+    sort.pool = (const char *)header + header->pool;
+    sort.keys = keys;
+    sort.count = 0;
+    sort.next = 0;
+    sort.cycles = 0;
+    sort.state = SORT_KEYS;
+}
+
+/*
+** Starts making the search index of the active catalog
+*/
+void catalog_start_search(void) {
+    search.generation = UINT32_MAX;
+
+    sort.sort = CATALOG_SORT_NAME;
+    sort.search = true;
+    sort.header = catalog.header;
+    sort.entries = catalog.entries;
+    sort.pool = catalog.pool;
+    sort.keys = search.keys;
+    sort.count = 0;
+    sort.next = 0;
+    sort.cycles = 0;
+    sort.state = SORT_KEYS;
+}
+
+/*
+** Does one slice of the running sort: makes the keys, builds a heap out of
+** them and then takes the largest key off the heap until it is empty. When
+** the keys are sorted they become the play order, together with the catalog
+** they were made for if it is a rescan's, or the search index
+*/
+void catalog_sort(void) {
+    uint32_t count = sort.header->count;
+    uint32_t start = Perf_Cycles();
+
+    switch (sort.state) {
+    case SORT_IDLE: return;
+
+    case SORT_KEYS:
+        for (uint32_t i = 0; i < CATALOG_SLICE_KEYS && sort.next < count; i++, sort.next++) {
+            const Catalog_Entry *entry = &sort.entries[sort.next];
+
+            // songs can be searched for by both title and artist
+            if (sort.search) {
+                if (entry->title != 0) catalog_make_key(entry->title, sort.next);
+                if (entry->artist != 0) catalog_make_key(entry->artist, sort.next);
+                continue;
+            }
+
+            uint32_t string = entry->name;
+            if (sort.sort == CATALOG_SORT_TITLE && entry->title != 0) string = entry->title;
+            if (sort.sort == CATALOG_SORT_ARTIST && entry->artist != 0) string = entry->artist;
+            catalog_make_key(string, sort.next);
+        }
+        if (sort.next == count) {
+            sort.next = sort.count / 2;
+            sort.state = SORT_HEAPIFY;
+        }
+        break;
+
+    case SORT_HEAPIFY:
+        for (uint32_t i = 0; i < CATALOG_SLICE_SIFTS && sort.next > 0; i++) {
+            catalog_sift(--sort.next, sort.count);
+        }
+        if (sort.next == 0) {
+            sort.next = sort.count;
+            sort.state = SORT_EXTRACT;
+        }
+        break;
+
+    case SORT_EXTRACT:
+        for (uint32_t i = 0; i < CATALOG_SLICE_SIFTS && sort.next > 1; i++) {
+            sort.next--;
+            Catalog_Key largest = sort.keys[0];
+            sort.keys[0] = sort.keys[sort.next];
+            sort.keys[sort.next] = largest;
+            catalog_sift(0, sort.next);
+        }
+        if (sort.next <= 1) sort.state = SORT_IDLE;
+        break;
+    }
+
+    sort.cycles += Perf_Cycles() - start;
+    if (sort.state != SORT_IDLE) return;
+
+    if (sort.search) {
+        printf("catalog: indexed %lu titles and artists in %lu us\r\n", sort.count, Perf_CyclesToUs(sort.cycles));
+        search.count = sort.count;
+        search.generation = catalog.generation;
+        return;
+    }
+
+    printf("catalog: sorted %lu songs in %lu us\r\n", count, Perf_CyclesToUs(sort.cycles));
+
+    // a rescanned catalog goes live together with its play order
+    if (rescan.state == RESCAN_SORT) {
+        catalog.header = rescan.header;
+        catalog.entries = rescan.entries;
+        catalog.pool = (char *)rescan.header + rescan.header->pool;
+        catalog.generation++;
+        catalog.colors = 0;
+        rescan.offset = 0;
+        rescan.state = RESCAN_CLEAN;
+    }
+    order.keys = sort.keys;
+}
+
+/*
+** Adds the key for the string at 'string' of the string pool to the keys of
+** the running sort, the key is normalized if it is for the search index
+*/
+void catalog_make_key(uint32_t string, uint32_t index) {
+    Catalog_Key *key = &sort.keys[sort.count++];
+    const char *str = &sort.pool[string];
+
+    key->prefix = 0;
+    for (uint32_t i = 0; i < sizeof(key->prefix); i++) {
+        char c = sort.search ? catalog_normalize(*str) : *str;
+        key->prefix = (key->prefix << 8) | (uint8_t)c;
+        if (*str != '\0') str++;
+    }
+    key->string = string;
+    key->index = index;
+}
+
+/*
+** Moves the key at 'root' of the heap of the first 'count' sort keys down
+** until neither of its children is larger
+*/
+void catalog_sift(uint32_t root, uint32_t count) {
+    Catalog_Key *keys = sort.keys;
+    Catalog_Key key = keys[root];
+
+    for (;;) {
+        uint32_t child = 2 * root + 1;
+        if (child >= count) break;
+        if (child + 1 < count && catalog_compare(&keys[child], &keys[child + 1]) < 0) child++;
+        if (catalog_compare(&key, &keys[child]) >= 0) break;
+        keys[root] = keys[child];
+        root = child;
+    }
+    keys[root] = key;
+}
+
+/*
+** Compares two sort keys, equal strings are ordered by directory name so the
+** songs of an artist keep the order of their directories
+** Returns <0, 0 or >0 like strcmp()
+*/
+int catalog_compare(const Catalog_Key *a, const Catalog_Key *b) {
+    if (a->prefix != b->prefix) return (a->prefix < b->prefix) ? -1 : 1;
+
+    // equal prefixes without a terminator in them mean both strings go on
+    if ((a->prefix & 0xFF) != 0) {
+        const char *str_a = &sort.pool[a->string + sizeof(a->prefix)];
+        const char *str_b = &sort.pool[b->string + sizeof(b->prefix)];
+        int cmp = 0;
+        if (!sort.search) {
+            cmp = strcmp(str_a, str_b);
+        } else {
+            while (*str_a != '\0' && catalog_normalize(*str_a) == catalog_normalize(*str_b)) {
+                str_a++;
+                str_b++;
+            }
+            cmp = (uint8_t)catalog_normalize(*str_a) - (uint8_t)catalog_normalize(*str_b);
+        }
+        if (cmp != 0) return cmp;
+    }
+
+    if (sort.search || sort.sort != CATALOG_SORT_NAME) {
+        int cmp = strcmp(&sort.pool[sort.entries[a->index].name], &sort.pool[sort.entries[b->index].name]);
+        if (cmp != 0) return cmp;
+    }
+    return (a->index < b->index) ? -1 : (a->index > b->index);
+}
+
+/*
+** Compares the normalized string of search key 'key' with the first 'len'
+** characters of 'query'
+** Returns <0 if the string comes before the query, 0 if it starts with the
+** query and >0 if it comes after the query
+*/
+int catalog_compare_query(const Catalog_Key *key, const char *query, uint32_t len) {
+    const char *str = &catalog.pool[key->string];
+
+    for (uint32_t i = 0; i < len; i++) {
+        // the prefix is already normalized, and past a terminator in it the
+        // query can't match so the string is never read beyond its end
+        char c = (i < sizeof(key->prefix))
+            ? (char)(key->prefix >> (8 * (sizeof(key->prefix) - 1 - i)))
+            : catalog_normalize(str[i]);
+        char q = catalog_normalize(query[i]);
+        if (c != q) return ((uint8_t)c < (uint8_t)q) ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+** Normalizes a character of a search key, letters are made upper case and
+** everything else that isn't a digit becomes a space
+** Returns the normalized character
+*/
+char catalog_normalize(char c) {
+    if (c == '\0') return c;
+    c = toupper((uint8_t)c);
+    return isalnum((uint8_t)c) ? c : ' ';
+}
+
+/*
+** Adds up to 'count' more directory names of the active catalog to the table
+** of directory names, it is emptied first if it was for an older catalog
+** Returns 'true' once all of them are in it
+*/
+bool catalog_hash_names(uint32_t count) {
+    uint32_t mask = CATALOG_HASH_SIZE - 1;
+
+    if (catalog.hashing != catalog.generation) {
+        memset(catalog_table, 0, CATALOG_HASH_SIZE * sizeof(uint32_t));
+        catalog.hashing = catalog.generation;
+        catalog.hash_next = 0;
+    }
+
+    for (; count > 0 && catalog.hash_next < catalog.header->count; count--) {
+        uint32_t i = catalog.hash_next++;
+        const char *name = Catalog_String(catalog.entries[i].name);
+        uint32_t slot = catalog_hash(name, strlen(name)) & mask;
+        while (catalog_table[slot] != 0) slot = (slot + 1) & mask;
+        catalog_table[slot] = i + 1;
+    }
+    if (catalog.hash_next < catalog.header->count) return false;
+
+    catalog.hashed = catalog.generation;
+    return true;
+}
+
+/*
+** Hashes the first 'len' characters of 'name' ignoring letter case (FNV-1a)
+** Returns the hash
+*/
+uint32_t catalog_hash(const char *name, uint32_t len) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)toupper((uint8_t)name[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+** Returns 'true' if the first 'len' characters of 'name' are the directory
+** name 'entry', ignoring letter case
+*/
+bool catalog_name_equal(const char *name, uint32_t len, const char *entry) {
+    for (uint32_t i = 0; i < len; i++) {
+        if (entry[i] == '\0' || toupper((uint8_t)entry[i]) != toupper((uint8_t)name[i])) return false;
+    }
+    return entry[len] == '\0';
+}
+
+/*
+** Writes a piece of the active catalog to the temporary index file, which
+** starts out empty so no cluster chain of an old index is freed meanwhile
+*/
+void catalog_save(void) {
+    Catalog_Header *header = catalog.header;
+    UINT bytes_written = 0;
+
+    if (rescan.offset == 0 && f_open(&rescan.file, CATALOG_TEMP, FA_CREATE_NEW | FA_WRITE) != FR_OK) {
+        rescan.state = RESCAN_IDLE;
+        return;
+    }
+
+    uint32_t len = header->size - rescan.offset;
+    if (len > CATALOG_SLICE_WRITE) len = CATALOG_SLICE_WRITE;
+    FRESULT res = f_write(&rescan.file, (uint8_t *)header + rescan.offset, len, &bytes_written);
+    rescan.offset += bytes_written;
+    if (res == FR_OK && bytes_written == len && rescan.offset < header->size) return;
+
+    // the old index is kept if the new one couldn't be written whole
+    bool written = f_close(&rescan.file) == FR_OK && res == FR_OK && rescan.offset == header->size;
+    rescan.state = written ? RESCAN_REPLACE : RESCAN_IDLE;
+}
+
+/*
+** Removes the old library index file a piece per slice, then renames the
+** temporary one written by catalog_save() to take its place in the next
+** slice
+*/
+void catalog_replace(void) {
+    if (rescan.state == RESCAN_REPLACE) {
+        FRESULT res;
+        if (!catalog_free(CATALOG_FILE, &res)) return;
+        rescan.state = (res == FR_OK || res == FR_NO_FILE) ? RESCAN_RENAME : RESCAN_IDLE;
+        return;
+    }
+
+    f_rename(CATALOG_TEMP, CATALOG_FILE);
+    rescan.state = RESCAN_IDLE;
+}
+
+/*
+** Frees the clusters of the last CATALOG_SLICE_FREE bytes of the file 'path'
+** by cutting it short, or removes it once it is no larger than that, so
+** freeing the cluster chain of an index is spread over slices like writing
+** it is. Finding where to cut walks the chain from its start, a few FAT
+** sectors for a file the size of an index. A file cut short meanwhile can't
+** be mistaken for an index, its size doesn't match its header
+** Returns 'true' once the file is removed or an error stopped it, with the
+** result in 'res' (FR_NO_FILE if there was no file)
+*/
+bool catalog_free(const char *path, FRESULT *res) {
+    FIL file;
+    *res = f_open(&file, path, FA_READ | FA_WRITE);
+    if (*res != FR_OK) return true;
+
+    FSIZE_t size = f_size(&file);
+    if (size > CATALOG_SLICE_FREE) {
+        *res = f_lseek(&file, size - CATALOG_SLICE_FREE);
+        if (*res == FR_OK) *res = f_truncate(&file);
+    }
+    FRESULT closed = f_close(&file);
+    if (*res == FR_OK) *res = closed;
+    if (*res != FR_OK) return true;
+    if (size > CATALOG_SLICE_FREE) return false;
+
+    *res = f_unlink(path);
+    return true;
+}
+
+/*
+** Adds 'len' characters of 'str' to the string pool of the catalog being built
+** Returns the offset of the string, or the empty string if the pool is full
+*/
+uint32_t catalog_add_string(const char *str, uint32_t len) {
+    Catalog_Header *header = rescan.header;
+
+    if (len == 0 || header->pool_size + len + 1 > CATALOG_MAX_POOL) return 0;
+
+    uint32_t offset = header->pool_size;
+    memcpy(&rescan.pool[offset], str, len);
+    rescan.pool[offset + len] = '\0';
+    header->pool_size += len + 1;
+    return offset;
+}
+
+/*
+** Reads the size and length of the song.raw of 'entry', or everything in its
+** track container if it has one
+*/
+void catalog_read_song(Catalog_Entry *entry) {
+    FILINFO file_info;
+    FIL pack;
+
+    if (catalog_stat(entry->cluster, "song.raw", &file_info) == FR_OK) {
+        entry->song_size = file_info.fsize;
+        entry->duration = file_info.fsize / CATALOG_SONG_RATE;
+        return;
+    }
+
+    // everything of a song can be in a track container instead
+    if (catalog_open(entry->cluster, &pack, PACK_FILE, FA_READ) != FR_OK) return;
+    catalog_read_pack(entry, &pack);
+    f_close(&pack);
+}
+
+/*
+** Reads the header of the track container 'file' of 'entry' and the metadata
+** in it, which is usually part of the same read
+*/
+void catalog_read_pack(Catalog_Entry *entry, FIL *file) {
+    uint8_t buffer[PACK_HEADER_READ];
+    Pack_Header header;
+    Meta_Info info;
+    UINT bytes_read = 0;
+
+    if (!Pack_ReadHeader(file, buffer, &header)) return;
+    entry->flags |= CATALOG_FLAG_PACKED;
+    entry->audio_offset = header.audio;
+    entry->song_size = header.audio + header.audio_size;
+    entry->duration = header.audio_size / CATALOG_SONG_RATE;
+    entry->cover_offset = header.cover;
+    entry->cover_size = header.cover_size;
+
+    uint32_t meta_size = (header.meta_size < META_MAX_SIZE) ? header.meta_size : META_MAX_SIZE;
+    const char *meta = (const char *)buffer + header.meta;
+    if (header.meta + meta_size > sizeof(buffer)) {
+        if (f_lseek(file, header.meta) != FR_OK) return;
+        if (f_read(file, buffer, meta_size, &bytes_read) != FR_OK) return;
+        meta = (const char *)buffer;
+        meta_size = bytes_read;
+    }
+
+    Meta_Parse(meta, meta_size, &info);
+    catalog_add_meta(entry, &info);
+}
+
+/*
+** Reads the title, artist, album, track number, year and gain of 'entry' from
+** the ID3v2 or FLAC tags at the start of its song.raw, along with where the
+** audio and an embedded cover start
+** Returns 'false' if the song has no tags, so its meta.txt has to be read
+*/
+bool catalog_read_tags(Catalog_Entry *entry) {
+    FIL file;
+    Meta_Info info;
+
+    // read along with the header of the container
+    if (entry->flags & CATALOG_FLAG_PACKED) return true;
+
+    if (catalog_open(entry->cluster, &file, "song.raw", FA_READ) != FR_OK) return false;
+    bool tagged = Meta_ReadTags(&file, rescan.tags, &info);
+    f_close(&file);
+    if (!tagged) return false;
+
+    catalog_add_meta(entry, &info);
+    entry->audio_offset = info.audio;
+    entry->cover_offset = info.cover;
+    entry->cover_size = info.cover_size;
+    if (info.compressed) {
+        entry->flags |= CATALOG_FLAG_COMPRESSED;
+    } else if (entry->song_size > info.audio) {
+        entry->duration = (entry->song_size - info.audio) / CATALOG_SONG_RATE;
+    }
+    return true;
+}
+
+/*
+** Reads the title, artist, album, track number, year and gain of 'entry' from
+** its meta.txt with a single read, for a song without tags
+*/
+void catalog_read_meta(Catalog_Entry *entry) {
+    char buffer[META_MAX_SIZE];
+    FIL file;
+    UINT bytes_read = 0;
+    Meta_Info info;
+
+    if (catalog_open(entry->cluster, &file, "meta.txt", FA_READ) != FR_OK) return;
+    f_read(&file, buffer, sizeof(buffer), &bytes_read);
+    f_close(&file);
+
+    Meta_Parse(buffer, bytes_read, &info);
+    catalog_add_meta(entry, &info);
+}
+
+/*
+** Adds the strings of 'info' to the string pool and sets the fields of
+** 'entry', strings longer than the catalog keeps are cut at the last whole
+** UTF-8 character that fits
+*/
+void catalog_add_meta(Catalog_Entry *entry, const Meta_Info *info) {
+    const Meta_String *strings[] = { &info->title, &info->artist, &info->album };
+    uint32_t *fields[] = { &entry->title, &entry->artist, &entry->album };
+    for (uint32_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        uint32_t len = Meta_Clip(strings[i]->str, strings[i]->len, CATALOG_MAX_STRING - 1);
+        *fields[i] = catalog_add_string(strings[i]->str, len);
+    }
+    entry->track = info->track > UINT16_MAX ? 0 : info->track;
+    entry->year = info->year > UINT16_MAX ? 0 : info->year;
+    entry->gain = info->gain < INT16_MIN ? INT16_MIN : info->gain > INT16_MAX ? INT16_MAX : info->gain;
+}
+
+/*
+** Reads the size of the cover of 'entry' from its frame header or image
+** header, the cover is either embedded in the song's file or its cover.jpg,
+** or its cover.png if there is no cover.jpg
+*/
+void catalog_read_cover(Catalog_Entry *entry) {
+    FIL cover;
+
+    if (entry->cover_size != 0) {
+        if (catalog_open(entry->cluster, &cover, catalog_song_file(entry), FA_READ) != FR_OK) return;
+        if (f_lseek(&cover, entry->cover_offset) == FR_OK) {
+            Cover_ReadSize(&cover, &entry->cover_width, &entry->cover_height);
+        }
+        f_close(&cover);
+        return;
+    }
+
+    entry->flags &= ~CATALOG_FLAG_PNG;
+    FRESULT res = catalog_open(entry->cluster, &cover, "cover.jpg", FA_READ);
+    if (res == FR_NO_FILE) {
+        res = catalog_open(entry->cluster, &cover, "cover.png", FA_READ);
+        if (res == FR_OK) entry->flags |= CATALOG_FLAG_PNG;
+    }
+    if (res != FR_OK) return;
+    Cover_ReadSize(&cover, &entry->cover_width, &entry->cover_height);
+    f_close(&cover);
+}
+
+/*
+** Returns the name of the file holding the audio of 'entry'
+*/
+const char *catalog_song_file(const Catalog_Entry *entry) {
+    return (entry->flags & CATALOG_FLAG_PACKED) ? PACK_FILE : "song.raw";
+}
+
+/*
+** Returns the start cluster of the directory of song 'index'. One the index
+** came without is looked up by the directory's name and kept in its entry,
+** as is its timestamp, until the rescan writes them into the index
+** Returns 0, the root directory, if the directory can't be found
+*/
+DWORD catalog_cluster(uint32_t index) {
+    Catalog_Entry *entry = &catalog.entries[index];
+    if (entry->cluster != 0) return entry->cluster;
+
+    char path[CATALOG_MAX_STRING + 1];
+    FILINFO file_info;
+    snprintf(path, sizeof(path), "/%s", Catalog_String(entry->name));
+    if (f_stat(path, &file_info) != FR_OK || (file_info.fattrib & AM_DIR) == 0) return 0;
+
+    entry->cluster = file_info.fclust;
+    entry->date = file_info.fdate;
+    entry->time = file_info.ftime;
+    return entry->cluster;
+}
+
+/*
+** Opens the file 'name' in the directory starting at 'cluster'
+** Returns the result of f_open()
+*/
+FRESULT catalog_open(DWORD cluster, FIL *file, const char *name, BYTE mode) {
+    // relative paths are followed from the current directory, point it
+    // straight at the song's directory for the duration of the open
+    DWORD cdir = catalog.fs->cdir;
+    catalog.fs->cdir = cluster;
+    FRESULT res = f_open(file, name, mode);
+    catalog.fs->cdir = cdir;
+    return res;
+}
+
+/*
+** Gets the information of the file 'name' in the directory starting at 'cluster'
+** Returns the result of f_stat()
+*/
+FRESULT catalog_stat(DWORD cluster, const char *name, FILINFO *file_info) {
+    DWORD cdir = catalog.fs->cdir;
+    catalog.fs->cdir = cluster;
+    FRESULT res = f_stat(name, file_info);
+    catalog.fs->cdir = cdir;
+    return res;
+}
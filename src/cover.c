@@ -7,38 +7,228 @@
 #include "jpeg_utils.h"
 #include "ff.h"
 #include "helper_functions.h"
+#include "lcd.h"
+#include "perf.h"
+#include "png.h"
+#include "sdram.h"
+
+#include "cover.h"
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// most segments skipped looking for the frame header of a jpeg
+#define COVER_MAX_SEGMENTS 32
+// bytes of decoded MCUs handed over at a time, a multiple of the MCU size of
+// every subsampling (384, 256, 192 and 64 bytes) so no MCU is ever split
+#define COVER_CHUNK_SIZE (768 * 4)
+// bytes of the jpeg in each input buffer, whole sectors so every read after
+// the first one starts on a sector and FatFs reads straight into the buffer
+#define COVER_INPUT_SIZE (16 * _MIN_SS)
+// largest cover shown as it is, the size the library packer scales covers
+// down to, larger ones are scaled down to fit
+#define COVER_MAX_SIZE 400
+// pixels of a scaled cover box filtered in one Cover_Process() call, about 1ms
+#define COVER_SCALE_PIXELS (32 * 1024)
+// each slot of the cache holds one cover of up to COVER_MAX_SIZE squared, in
+// the pixel format of the screen
+#define COVER_CACHE_SLOT_SIZE (COVER_MAX_SIZE * COVER_MAX_SIZE * LCD_BYTES_PER_PIXEL)
+#define COVER_CACHE_SLOTS     (SDRAM_COVER_CACHE_SIZE / COVER_CACHE_SLOT_SIZE)
+// bits of each of red, green and blue a color is binned by to find the
+// dominant color of a cover
+#define COVER_COLOR_BITS 3
+#define COVER_COLOR_BINS (1 << (3 * COVER_COLOR_BITS))
+// every this many rows and pixels of a png cover a pixel is binned, about as
+// many as the one pixel per MCU of a jpeg
+#define COVER_PNG_SAMPLE 8
 
-#define LCD_FRAME_BUFFER        0xC0000000
-#define JPEG_OUTPUT_DATA_BUFFER 0xC0200000
+_Static_assert(PNG_MAX_WIDTH * LCD_BYTES_PER_PIXEL <= SDRAM_COVER_BAND_SIZE, "a png row must fit in the band");
+
+/*
+** a pixel of the screen and its color components, a scaled cover is averaged
+** in the precision of the screen and colors are binned in 8 bits
+*/
+#ifdef LCD_RGB565
+typedef uint16_t Cover_Pixel;
+#define COVER_PIXEL(red, green, blue) (((red) << 11) | ((green) << 5) | (blue))
+#define COVER_RED(pixel)              ((pixel) >> 11)
+#define COVER_GREEN(pixel)            (((pixel) >> 5) & 0x3F)
+#define COVER_BLUE(pixel)             ((pixel) & 0x1F)
+#define COVER_RED8(pixel)             (COVER_RED(pixel) << 3)
+#define COVER_GREEN8(pixel)           (COVER_GREEN(pixel) << 2)
+#define COVER_BLUE8(pixel)            (COVER_BLUE(pixel) << 3)
+#else
+typedef uint32_t Cover_Pixel;
+#define COVER_PIXEL(red, green, blue) (0xFF000000 | ((red) << 16) | ((green) << 8) | (blue))
+#define COVER_RED(pixel)              (((pixel) >> 16) & 0xFF)
+#define COVER_GREEN(pixel)            (((pixel) >> 8) & 0xFF)
+#define COVER_BLUE(pixel)             ((pixel) & 0xFF)
+#define COVER_RED8(pixel)             COVER_RED(pixel)
+#define COVER_GREEN8(pixel)           COVER_GREEN(pixel)
+#define COVER_BLUE8(pixel)            COVER_BLUE(pixel)
+#endif
 
 /*
-** keeping track of processed bytes
+** keeping track of processed MCUs
 */
 uint32_t MCU_TotalNb = 0;
-uint32_t num_bytes_decoded = 0;
 
 /*
-** needed for processing jpeg
+** needed for processing jpeg, Cover_Process() reads the file into one input
+** buffer while the JPEG interrupt feeds the decoder from the other one
 */
 FIL *jpeg_file;
-unsigned int jpeg_num_bytes_read = 0;
 unsigned int jpeg_file_offset = 0;
-uint8_t jpeg_buffer[10000];
-int jpeg_complete = 0;
+unsigned int jpeg_file_end = 0;
+static uint8_t jpeg_input[2][COVER_INPUT_SIZE] __attribute__((aligned(4)));
+volatile int jpeg_complete = 0;
+
+/*
+** decoded MCUs, the JPEG interrupt fills one chunk while Cover_Process()
+** color converts the other one straight into the framebuffer
+*/
+static uint8_t jpeg_output[2][COVER_CHUNK_SIZE];
+
+/*
+** progress of the cover being displayed, the JPEG interrupt can't use FatFs
+** so it moves on to the other input buffer when it used up one, and only
+** pauses the decoder if Cover_Process() hasn't read into that one yet. It
+** also pauses the output while both chunks are waiting to be converted. A
+** png is decoded by Cover_Process() alone, a few rows per call
+*/
+static struct {
+    enum { COVER_IDLE, COVER_DECODE, COVER_PNG, COVER_STORE, COVER_BLIT } state;
+    volatile bool need_input;
+    volatile bool output_paused;
+    volatile bool failed;
+    // bytes of the jpeg waiting in each input buffer, 0 once it's used up
+    volatile uint32_t input_size[2];
+    // input buffer the decoder reads, bytes of it it has used so far and
+    // next input buffer to read the file into
+    volatile uint32_t input_read;
+    uint32_t input_used;
+    uint32_t input_write;
+    // an end of image marker was made up for a jpeg that ended too soon
+    bool ended;
+    // bytes of the jpeg read from the card
+    uint32_t bytes_read;
+    // bytes of MCUs waiting in each chunk, 0 once it's converted
+    volatile uint32_t chunk_size[2];
+    // chunk being filled by the interrupt and next chunk to convert
+    uint32_t chunk_write;
+    uint32_t chunk_read;
+    // bytes of the next chunk already converted
+    uint32_t chunk_used;
+    // next MCU to convert (next row of a png), where the top left pixel of
+    // the image goes and the bytes from one of its lines to the next
+    uint32_t block;
+    uint8_t *destination;
+    uint32_t stride;
+    // size of the image, larger than the cover if it's scaled
+    uint16_t image_width, image_height;
+    bool scaled;
+    // part of the screen the cover covers
+    uint16_t x, y, width, height;
+    // cache key of the cover and the slot it goes into or comes from, a
+    // prefetched cover is decoded straight into its slot
+    uint64_t key;
+    uint32_t slot;
+    bool prefetch;
+    // when the cover was started and CPU cycles spent on it since
+    uint32_t start;
+    uint32_t cycles;
+    bool displayed;
+    // dominant color once the cover is done, 0 until then
+    uint32_t color;
+} cover;
+
+/*
+** histogram of the colors of the cover, the top left pixel of every MCU is
+** binned straight from the decoded MCUs as they are converted, so the colors
+** come for free whether the cover is scaled or not. The sums give the
+** average color of a bin
+*/
+static struct {
+    uint32_t counts[COVER_COLOR_BINS];
+    uint32_t sums[COVER_COLOR_BINS][3];
+    // bytes of an MCU, 0 if they aren't binned (CMYK or png), and where its
+    // blue chroma block starts, 0 for grayscale
+    uint32_t mcu_size;
+    uint32_t chroma;
+} histogram;
+
+/*
+** a cover larger than COVER_MAX_SIZE is color converted one band of MCU rows
+** at a time into SDRAM, then each line of the band is box filtered down into
+** the running sums of the line of the cover it falls on. Only a band and one
+** line of sums are ever kept, whatever the size of the image
+*/
+static struct {
+    // MCUs and lines in a band, bytes of one decoded MCU and of a band line
+    uint32_t mcus;
+    uint32_t lines;
+    uint32_t mcu_size;
+    uint32_t line_size;
+    // lines of the last converted band that aren't scaled yet
+    uint32_t next;
+    uint32_t end;
+    // line of the cover being summed up and the image lines summed into it
+    uint32_t row;
+    uint32_t rows;
+    // sums of the red, green and blue of each pixel of that line and the
+    // image columns that go into each of them
+    uint32_t sums[COVER_MAX_SIZE * 3];
+    uint16_t columns[COVER_MAX_SIZE];
+} scale;
+
+/*
+** decoded covers in SDRAM, ready to be copied to the screen as they are
+*/
+typedef struct {
+    uint64_t key;           // COVER_NO_KEY if the slot is empty
+    uint32_t used;          // value of the use counter when last shown
+    uint32_t decode_us;     // time it took to decode the cover
+    uint32_t color;         // dominant color of the cover
+    uint16_t x, y;          // where the cover goes on the screen
+    uint16_t width, height;
+} Cover_Slot;
+
+static struct {
+    Cover_Slot slots[COVER_CACHE_SLOTS];
+    uint32_t uses;
+    uint32_t hits;
+    uint32_t lookups;
+    uint32_t saved_ms;
+} cache;
 
 /*
 ** global variables for HAL
 */
 JPEG_HandleTypeDef jpeg_handle;
-JPEG_ConfTypeDef jpeg_info;
 DMA2D_HandleTypeDef DMA2D_Handle;
 
-/*
-** Helper function for copying data with DMA2D
-*/
-static bool DMA2D_CopyBuffer(uint32_t *pSrc, uint32_t *pDst, uint16_t x, uint16_t y, JPEG_ConfTypeDef *jpeg_info);
+static bool cover_decode(FIL *file, FSIZE_t offset, uint32_t size, uint64_t key, bool prefetch);
+static void cover_place(uint32_t width, uint32_t height);
+static bool cover_png_start(FSIZE_t offset, uint32_t size);
+static bool cover_png(void);
+static void cover_read(void);
+static bool cover_convert(void);
+static void cover_scale(void);
+static void cover_scale_setup(JPEG_ConfTypeDef *info);
+static void cover_scale_start(void);
+static void cover_flush(void);
+static void cover_histogram_setup(JPEG_ConfTypeDef *info);
+static void cover_histogram_add(const uint8_t *data, uint32_t size);
+static void cover_histogram_bin(int32_t red, int32_t green, int32_t blue);
+static uint32_t cover_histogram_color(void);
+static void cover_done(void);
+static uint32_t cover_find(uint64_t key);
+static uint32_t cover_reserve(void);
+static bool cover_blit(uint32_t source, uint32_t source_offset, uint32_t destination, uint32_t destination_offset);
+static uint8_t *cover_slot(uint32_t slot);
+static uint8_t *cover_screen(uint16_t x, uint16_t y);
 
 /*
 ** Initializes everything needed for displaying the album cover
@@ -51,87 +241,360 @@ bool Cover_Init(void) {
     if (res != HAL_OK) return false;
     JPEG_InitColorTables();
 
-    DMA2D_Handle.Init.Mode                  = DMA2D_M2M_PFC;
-    DMA2D_Handle.Init.ColorMode             = DMA2D_OUTPUT_ARGB8888;
+    DMA2D_Handle.Init.Mode                  = DMA2D_M2M;
+    DMA2D_Handle.Init.ColorMode             = LCD_DMA2D_OUTPUT;
     DMA2D_Handle.Init.AlphaInverted         = DMA2D_REGULAR_ALPHA;
     DMA2D_Handle.Init.RedBlueSwap           = DMA2D_RB_REGULAR;
     DMA2D_Handle.XferCpltCallback           = NULL;
-    DMA2D_Handle.LayerCfg[1].AlphaMode      = DMA2D_REPLACE_ALPHA;
+    DMA2D_Handle.LayerCfg[1].AlphaMode      = DMA2D_NO_MODIF_ALPHA;
     DMA2D_Handle.LayerCfg[1].InputAlpha     = 0xFF;
-    DMA2D_Handle.LayerCfg[1].InputColorMode = DMA2D_INPUT_ARGB8888;
+    DMA2D_Handle.LayerCfg[1].InputColorMode = LCD_DMA2D_INPUT;
     DMA2D_Handle.LayerCfg[1].RedBlueSwap    = DMA2D_RB_REGULAR;
     DMA2D_Handle.LayerCfg[1].AlphaInverted  = DMA2D_REGULAR_ALPHA;
     DMA2D_Handle.Instance                   = DMA2D;
 
+    for (uint32_t i = 0; i < COVER_CACHE_SLOTS; i++) cache.slots[i].key = COVER_NO_KEY;
     return true;
 }
 
 /*
-** Displays the jpeg image in 'file' in the center of the LCD screen
+** Displays the jpeg or png image in 'file' in the center of the LCD screen
 ** Returns 'true' if everything initializes correctly
 */
 bool Cover_Display(FIL *file) {
-    num_bytes_decoded = 0;
-    jpeg_num_bytes_read = 0;
-    jpeg_file_offset = 0;
-    jpeg_complete = 0;
-    jpeg_file = file;
+    return Cover_DisplayAt(file, 0, f_size(file));
+}
+
+/*
+** Displays the jpeg or png image of 'size' bytes at 'offset' in 'file' in
+** the center of the LCD screen, so a cover embedded in the tags of a song is
+** decoded in place
+** Returns 'true' if everything initializes correctly
+*/
+bool Cover_DisplayAt(FIL *file, FSIZE_t offset, uint32_t size) {
+    if (!Cover_Start(file, offset, size, COVER_NO_KEY)) return false;
+    while (Cover_Process());
+    return cover.displayed;
+}
 
-    f_read(jpeg_file, jpeg_buffer, sizeof(jpeg_buffer), &jpeg_num_bytes_read);
-    jpeg_file_offset = jpeg_num_bytes_read;
+/*
+** Starts copying the cover cached for 'key' to the screen, Cover_Process()
+** finishes the copy. A cover that is still being decoded is stopped
+** Returns 'false' if the cover isn't cached
+*/
+bool Cover_StartCached(uint64_t key) {
+    Cover_Stop();
+    if (key == COVER_NO_KEY) return false;
 
-    // Decode the passed file without DMA
-    HAL_StatusTypeDef status = HAL_JPEG_Decode(&jpeg_handle,
-                                               jpeg_buffer,
-                                               jpeg_num_bytes_read,
-                                               (uint8_t*)JPEG_OUTPUT_DATA_BUFFER,
-                                               10000,
-                                               HAL_MAX_DELAY);
-    if (status != HAL_OK) return false;
-    while (!jpeg_complete);
+    cache.lookups++;
+    uint32_t slot = cover_find(key);
+    if (slot == COVER_CACHE_SLOTS) return false;
 
-    // Get the info
-    HAL_JPEG_GetInfo(&jpeg_handle, &jpeg_info);
+    cache.hits++;
+    cache.slots[slot].used = ++cache.uses;
+    cover.key = key;
+    cover.slot = slot;
+    cover.prefetch = false;
+    cover.start = Perf_Cycles();
+    cover.cycles = 0;
+    cover.displayed = false;
+    cover.color = cache.slots[slot].color;
+    cover.state = COVER_BLIT;
+    return true;
+}
 
-    // Do the color conversion on decoded data
-    uint8_t *raw_output = colorConversion((uint8_t *)JPEG_OUTPUT_DATA_BUFFER, num_bytes_decoded);
+/*
+** Returns 'true' if the cover for 'key' is cached
+*/
+bool Cover_IsCached(uint64_t key) {
+    return key != COVER_NO_KEY && cover_find(key) != COVER_CACHE_SLOTS;
+}
 
-    uint32_t width_offset = 0;
-    if (jpeg_info.ChromaSubsampling == JPEG_420_SUBSAMPLING) {
-        if ((jpeg_info.ImageWidth % 16) != 0)
-            width_offset = 16 - (jpeg_info.ImageWidth % 16);
-    }
+/*
+** Starts decoding the jpeg or png image of 'size' bytes at 'offset' in 'file'
+** straight into the cache without showing it, so Cover_StartCached() finds
+** it later. Cover_Process() does the rest like for Cover_Start() and
+** Cover_Stop() drops a prefetch that isn't done yet
+** Returns 'true' if the decode started
+*/
+bool Cover_Prefetch(FIL *file, FSIZE_t offset, uint32_t size, uint64_t key) {
+    Cover_Stop();
+    if (key == COVER_NO_KEY) return false;
+    return cover_decode(file, offset, size, key, true);
+}
+
+/*
+** Starts decoding the jpeg or png image of 'size' bytes at 'offset' in 'file'
+** and returns right away, the JPEG interrupt and Cover_Process() do the rest
+** and the image appears in the center of the LCD screen once it is done,
+** scaled down to fit 400x400 if it is larger. It is decoded into the
+** framebuffer being drawn into, so LCD_Present() mustn't be called until
+** then. 'file' must stay open until then and a cover that is still being
+** decoded is stopped. Unless 'key' is COVER_NO_KEY the decoded cover is cached
+** for Cover_StartCached()
+** Returns 'true' if the decode started
+*/
+bool Cover_Start(FIL *file, FSIZE_t offset, uint32_t size, uint64_t key) {
+    Cover_Stop();
+    return cover_decode(file, offset, size, key, false);
+}
+
+/*
+** Does the part of displaying the cover that can't be done in the JPEG
+** interrupt: reading more of the file and color converting the MCUs decoded
+** so far straight into the framebuffer being drawn into, or scaling them down
+** first for a cover larger than 400x400, then copying the cover into the
+** cache with the DMA2D. A png is decoded here a few rows at a time instead
+** and a cached cover is copied to the screen. A call takes at most about
+** COVER_SLICE_US
+** Returns 'true' while the cover isn't on the screen or in the cache yet
+*/
+bool Cover_Process(void) {
+    uint32_t start = Perf_Cycles();
+    bool busy = (cover.state != COVER_IDLE);
+
+    switch (cover.state) {
+    case COVER_IDLE: break;
+
+    case COVER_DECODE:
+        // a cover that can't be decoded is left blank rather than half drawn
+        if (cover.failed) {
+            HAL_JPEG_Abort(&jpeg_handle);
+            if (!cover.prefetch) Cover_Blank();
+            cover.state = COVER_IDLE;
+            break;
+        }
+        // read ahead into the input buffer the decoder is done with, it
+        // only waits if it got through the other one in the meantime
+        cover_read();
+        if (cover.need_input && jpeg_file_offset == jpeg_file_end &&
+            cover.input_size[0] == 0 && cover.input_size[1] == 0) {
+            // the file ended in the middle of the image, like a short
+            // cover.jpg or a wrong size in the song's file. The decoder would
+            // wait for more forever, an end of image marker lets it finish
+            // what it has and a second wait means it can't
+            if (cover.ended) {
+                cover.failed = true;
+                break;
+            }
+            uint32_t input = cover.input_read;
+            jpeg_input[input][0] = 0xFF;
+            jpeg_input[input][1] = 0xD9;
+            cover.input_size[input] = 2;
+            cover.input_write = input ^ 1;
+            cover.ended = true;
+        }
+        if (cover.need_input) {
+            uint32_t input = cover.input_read;
+            cover.need_input = false;
+            HAL_JPEG_ConfigInputBuffer(&jpeg_handle, jpeg_input[input], cover.input_size[input]);
+            HAL_JPEG_Resume(&jpeg_handle, JPEG_PAUSE_RESUME_INPUT);
+        }
+        // the DMA2D may still be restoring the screen from behind the
+        // search keyboard, it would paint over the cover, and nothing can be
+        // drawn while the last frame waits to be shown
+        if (!cover.prefetch && LCD_IsBusy()) break;
+        if (!cover.prefetch && cover.destination != NULL) LCD_MarkDrawn(cover.x, cover.y, cover.width, cover.height);
+        // the last chunk is handed over before the decode completes, so
+        // the flag is read first: if it was set, everything the interrupt
+        // handed over is converted by this call
+        bool complete = jpeg_complete;
+        if (cover_convert() && complete && cover.chunk_size[cover.chunk_read] == 0) cover_done();
+        break;
+
+    case COVER_PNG:
+        if (!cover.prefetch && LCD_IsBusy()) break;
+        if (!cover.prefetch) LCD_MarkDrawn(cover.x, cover.y, cover.width, cover.height);
+        if (cover_png()) {
+            cover_done();
+        } else if (cover.failed) {
+            if (!cover.prefetch) Cover_Blank();
+            cover.state = COVER_IDLE;
+        }
+        break;
 
-    if (jpeg_info.ChromaSubsampling == JPEG_422_SUBSAMPLING) {
-        if ((jpeg_info.ImageWidth % 16) != 0)
-            width_offset = 16 - (jpeg_info.ImageWidth % 16);
+    case COVER_STORE:
+    case COVER_BLIT:
+        if ((DMA2D->CR & DMA2D_CR_START) != 0) break;
+        // the copy hasn't been started yet, the DMA2D was busy before or the
+        // last frame waits to be shown
+        if (DMA2D_Handle.State != HAL_DMA2D_STATE_BUSY) {
+            Cover_Slot *slot = &cache.slots[cover.slot];
+            if (cover.state == COVER_BLIT && LCD_IsBusy()) break;
+            if (cover.state == COVER_BLIT) LCD_MarkDrawn(slot->x, slot->y, slot->width, slot->height);
+            bool started = (cover.state == COVER_STORE)
+                ? cover_blit((uint32_t)cover_screen(slot->x, slot->y), BSP_LCD_GetXSize() - slot->width,
+                             (uint32_t)cover_slot(cover.slot), 0)
+                : cover_blit((uint32_t)cover_slot(cover.slot), 0,
+                             (uint32_t)cover_screen(slot->x, slot->y), BSP_LCD_GetXSize() - slot->width);
+            if (!started) cover.state = COVER_IDLE;
+            break;
+        }
+        // let the HAL see the copy is done so the DMA2D can be started again
+        HAL_DMA2D_PollForTransfer(&DMA2D_Handle, 0);
+        cover_done();
+        break;
     }
 
-    if (jpeg_info.ChromaSubsampling == JPEG_444_SUBSAMPLING) {
-        if ((jpeg_info.ImageWidth % 8) != 0)
-            width_offset = 8 - (jpeg_info.ImageWidth % 8);
+    cover.cycles += Perf_Cycles() - start;
+    return busy && cover.state != COVER_IDLE;
+}
+
+/*
+** Stops decoding the cover, the part of it that is already on the screen
+** stays there. A copy to or from the cache that already started is finished
+** first
+*/
+void Cover_Stop(void) {
+    if (cover.state == COVER_DECODE) HAL_JPEG_Abort(&jpeg_handle);
+
+    // a copy that already started is finished, so a cover being stored
+    // still ends up in the cache
+    if (DMA2D_Handle.State == HAL_DMA2D_STATE_BUSY) {
+        HAL_DMA2D_PollForTransfer(&DMA2D_Handle, HAL_MAX_DELAY);
+        if (cover.state == COVER_STORE) cover_done();
     }
+    cover.state = COVER_IDLE;
+}
+
+/*
+** Leaves the place of the cover blank from the next LCD_Present() on, for a
+** song without one
+*/
+void Cover_Blank(void) {
+    // the largest cover there is, placed like cover_place() does
+    uint32_t x = (BSP_LCD_GetXSize() - COVER_MAX_SIZE) / 2;
+    uint32_t y = (BSP_LCD_GetYSize() - COVER_MAX_SIZE) / 2 - 100;
+    LCD_Clear(x, y, COVER_MAX_SIZE, COVER_MAX_SIZE);
+}
 
-    DMA2D_Handle.Init.OutputOffset  = BSP_LCD_GetXSize() - jpeg_info.ImageWidth;
-    DMA2D_Handle.LayerCfg[1].InputOffset = width_offset;
+/*
+** Returns the dominant color of the cover last put on the screen or into the
+** cache in ARGB8888, the average color of the most common of the color bins
+** one pixel of every MCU (or of every 8x8 pixels of a png) went into while it
+** was converted. A cached cover keeps its color
+** Returns 0 if the cover didn't finish or has no colors to bin (CMYK)
+*/
+uint32_t Cover_Color(void) {
+    return cover.color;
+}
 
-    /* DMA2D Initialization */
-    if (HAL_DMA2D_DeInit(&DMA2D_Handle) != HAL_OK) return false;
-    if (HAL_DMA2D_Init(&DMA2D_Handle) != HAL_OK) return false;
+/*
+** Reads the width and height of the jpeg or png image at the current position
+** of 'file' from its frame header or image header without decoding it, the
+** file is seeked back to where the image starts afterwards
+** Returns 'true' if a header was found
+*/
+bool Cover_ReadSize(FIL *file, uint16_t *width, uint16_t *height) {
+    if (Png_ReadSize(file, width, height)) return true;
 
-    /* DMA2D Config Layer */
-    if (HAL_DMA2D_ConfigLayer(&DMA2D_Handle, 1) != HAL_OK) return false;
+    uint8_t segment[9];
+    UINT bytes_read = 0;
+    FSIZE_t start = f_tell(file);
+    FSIZE_t offset = start + 2;
+    bool found = false;
 
-    // Copy decoded data to the LCD
-    uint32_t xPos = (BSP_LCD_GetXSize() - jpeg_info.ImageWidth)/2;
-    uint32_t yPos = (BSP_LCD_GetYSize() - jpeg_info.ImageHeight)/2 - 100;
-    if (!DMA2D_CopyBuffer((uint32_t *)raw_output, (uint32_t *)LCD_FRAME_BUFFER, xPos , yPos, &jpeg_info)) {
+    // start of image marker
+    if (f_read(file, segment, 2, &bytes_read) != FR_OK || bytes_read != 2 ||
+        segment[0] != 0xFF || segment[1] != 0xD8) {
+        f_lseek(file, start);
         return false;
     }
 
-    return true;
+    // skip every segment before the frame header by its length, so even a
+    // large EXIF thumbnail only costs a seek
+    for (int i = 0; i < COVER_MAX_SEGMENTS && !found; i++) {
+        if (f_lseek(file, offset) != FR_OK) break;
+        if (f_read(file, segment, sizeof(segment), &bytes_read) != FR_OK) break;
+        if (bytes_read != sizeof(segment) || segment[0] != 0xFF) break;
+
+        // SOF0-SOF15, except DHT, JPG and DAC which share the range
+        uint8_t marker = segment[1];
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            *height = (segment[5] << 8) | segment[6];
+            *width = (segment[7] << 8) | segment[8];
+            found = true;
+        }
+        offset += 2 + ((segment[2] << 8) | segment[3]);
+    }
+
+    f_lseek(file, start);
+    return found;
 }
 
+#ifdef COVER_BENCHMARK
+/*
+** Color converts a 400x400 image of made up MCUs of each subsampling into a
+** slot of the cache, binning their colors like a decode does, and prints the
+** cycles per MCU and the time per image of each over UART. Then decodes a
+** made up 400x400 png from another slot and prints the time it took. The
+** cache must not hold any covers yet
+*/
+void Cover_Benchmark(void) {
+    static const struct {
+        const char *name;
+        uint32_t color_space;
+        uint32_t subsampling;
+        uint32_t mcu_size;
+    } modes[] = {
+        {"4:2:0", JPEG_YCBCR_COLORSPACE, JPEG_420_SUBSAMPLING, 384},
+        {"4:2:2", JPEG_YCBCR_COLORSPACE, JPEG_422_SUBSAMPLING, 256},
+        {"4:4:4", JPEG_YCBCR_COLORSPACE, JPEG_444_SUBSAMPLING, 192},
+        {"gray", JPEG_GRAYSCALE_COLORSPACE, JPEG_444_SUBSAMPLING, 64},
+    };
+
+    // random samples, so the colors get clamped as often as in a real image
+    uint32_t seed = 1;
+    for (uint32_t i = 0; i < COVER_CHUNK_SIZE; i++) {
+        seed = seed * 1103515245 + 12345;
+        jpeg_output[0][i] = seed >> 24;
+    }
+
+    for (uint32_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        JPEG_ConfTypeDef info = {0};
+        info.ColorSpace = modes[m].color_space;
+        info.ChromaSubsampling = modes[m].subsampling;
+        info.ImageWidth = COVER_MAX_SIZE;
+        info.ImageHeight = COVER_MAX_SIZE;
+        if (JPEG_GetDecodeColorConvertFunc(&info, &pConvert_Function, &MCU_TotalNb) != HAL_OK) continue;
+        JPEG_SetDecodeDestination(COVER_MAX_SIZE * LCD_BYTES_PER_PIXEL, COVER_MAX_SIZE, COVER_MAX_SIZE);
+        cover_histogram_setup(&info);
+
+        // converted and binned a chunk at a time like a decode does
+        uint32_t start = Perf_Cycles();
+        for (uint32_t block = 0; block < MCU_TotalNb;) {
+            uint32_t size = (MCU_TotalNb - block) * modes[m].mcu_size;
+            uint32_t converted = 0;
+            if (size > COVER_CHUNK_SIZE) size = COVER_CHUNK_SIZE;
+            block += pConvert_Function(jpeg_output[0], cover_slot(0), block, size, &converted);
+            cover_histogram_add(jpeg_output[0], converted);
+        }
+        uint32_t cycles = Perf_Cycles() - start;
+
+        printf("cover: %s %lu MCUs, %lu cycles per MCU, %lu us per %ux%u image\r\n", modes[m].name, MCU_TotalNb,
+               cycles / MCU_TotalNb, Perf_CyclesToUs(cycles), COVER_MAX_SIZE, COVER_MAX_SIZE);
+    }
+
+    // inflated from SDRAM rather than the card, so only the decoding counts
+    uint8_t *data = cover_slot(1);
+    uint32_t size = Png_MakeBenchmark(data, COVER_MAX_SIZE, COVER_MAX_SIZE);
+    uint32_t width = 0, height = 0;
+    uint32_t start = Perf_Cycles();
+    bool decoded = Png_StartMemory(data, size, &width, &height);
+    for (uint32_t row = 0; decoded && row < height; row++) {
+        decoded = Png_Row(cover_slot(0) + row * width * LCD_BYTES_PER_PIXEL);
+    }
+    uint32_t cycles = Perf_Cycles() - start;
+
+    if (!decoded) {
+        printf("cover: png failed to decode\r\n");
+        return;
+    }
+    printf("cover: png %lu bytes, %lu cycles per pixel, %lu ms per %ux%u image\r\n", size,
+           cycles / (width * height), Perf_CyclesToUs(cycles) / 1000, COVER_MAX_SIZE, COVER_MAX_SIZE);
+}
+#endif
+
 /*----------------------------------------------------------------------------*/
 /*                                                                            */
 /* CALLBACKS                                                                  */
@@ -142,22 +605,44 @@ bool Cover_Display(FIL *file) {
  * Callback called whenever the JPEG needs more data
  */
 void HAL_JPEG_GetDataCallback(JPEG_HandleTypeDef *hjpeg, uint32_t NbDecodedData) {
-    if (NbDecodedData != jpeg_num_bytes_read) {
-        jpeg_file_offset = jpeg_file_offset - jpeg_num_bytes_read + NbDecodedData;
-        f_lseek(jpeg_file, jpeg_file_offset);
+    uint32_t input = cover.input_read;
+
+    // the decoder stopped short of the end of the buffer, carry on with the
+    // rest of it rather than reading it again
+    cover.input_used += NbDecodedData;
+    if (cover.input_used < cover.input_size[input]) {
+        HAL_JPEG_ConfigInputBuffer(hjpeg, jpeg_input[input] + cover.input_used,
+                                   cover.input_size[input] - cover.input_used);
+        return;
     }
 
-    f_read(jpeg_file, jpeg_buffer, sizeof(jpeg_buffer), &jpeg_num_bytes_read);
-    jpeg_file_offset += jpeg_num_bytes_read;
-    HAL_JPEG_ConfigInputBuffer(hjpeg, jpeg_buffer, jpeg_num_bytes_read);
+    // hand the buffer back to Cover_Process() and carry on in the other one,
+    // FatFs can't be used from the interrupt so wait if it isn't read yet
+    cover.input_size[input] = 0;
+    cover.input_used = 0;
+    input ^= 1;
+    cover.input_read = input;
+    if (cover.input_size[input] == 0) {
+        HAL_JPEG_Pause(hjpeg, JPEG_PAUSE_RESUME_INPUT);
+        cover.need_input = true;
+        return;
+    }
+    HAL_JPEG_ConfigInputBuffer(hjpeg, jpeg_input[input], cover.input_size[input]);
 }
 
 /*
  * Callback called whenever the JPEG has filled the output buffer
  */
 void HAL_JPEG_DataReadyCallback(JPEG_HandleTypeDef *hjpeg, uint8_t *pDataOut, uint32_t OutDataLength) {
-    num_bytes_decoded += OutDataLength;
-    HAL_JPEG_ConfigOutputBuffer(hjpeg, (uint8_t*)(pDataOut+OutDataLength), 10000);
+    // hand the chunk over to Cover_Process() and carry on in the other one,
+    // unless that one isn't converted yet
+    cover.chunk_size[cover.chunk_write] = OutDataLength;
+    cover.chunk_write ^= 1;
+    if (cover.chunk_size[cover.chunk_write] != 0) {
+        HAL_JPEG_Pause(hjpeg, JPEG_PAUSE_RESUME_OUTPUT);
+        cover.output_paused = true;
+    }
+    HAL_JPEG_ConfigOutputBuffer(hjpeg, jpeg_output[cover.chunk_write], COVER_CHUNK_SIZE);
 }
 
 /*
@@ -165,12 +650,19 @@ void HAL_JPEG_DataReadyCallback(JPEG_HandleTypeDef *hjpeg, uint8_t *pDataOut, ui
  */
 void HAL_JPEG_DecodeCpltCallback(JPEG_HandleTypeDef *hjpeg) { jpeg_complete = 1; }
 
+/*
+ * Callback called whenever the JPEG can't decode the image
+ */
+void HAL_JPEG_ErrorCallback(JPEG_HandleTypeDef *hjpeg) { cover.failed = true; }
+
 // Provided code for callback
 // Called when the jpeg header has been parsed
 // Adjust the width to be a multiple of 8 or 16 (depending on image configuration) (from STM examples)
 // Get the correct color conversion function to use to convert to RGB
 void HAL_JPEG_InfoReadyCallback(JPEG_HandleTypeDef *hjpeg, JPEG_ConfTypeDef *pInfo) {
-    // Have to add padding for DMA2D
+    cover_place(pInfo->ImageWidth, pInfo->ImageHeight);
+
+    // the converter works on whole MCUs
     if (pInfo->ChromaSubsampling == JPEG_420_SUBSAMPLING) {
         if ((pInfo->ImageWidth % 16) != 0)
             pInfo->ImageWidth += (16 - (pInfo->ImageWidth % 16));
@@ -195,8 +687,21 @@ void HAL_JPEG_InfoReadyCallback(JPEG_HandleTypeDef *hjpeg, JPEG_ConfTypeDef *pIn
             pInfo->ImageHeight += (8 - (pInfo->ImageHeight % 8));
     }
 
+    // a color space or subsampling there is no converter for leaves the
+    // cover blank, Cover_Process() sees it failed and stops
     if (JPEG_GetDecodeColorConvertFunc(pInfo, &pConvert_Function, &MCU_TotalNb) != HAL_OK) {
-        while(1);
+        cover.failed = true;
+        HAL_JPEG_Abort(hjpeg);
+        return;
+    }
+
+    cover_histogram_setup(pInfo);
+
+    // the padding of the last MCUs is left out
+    if (!cover.scaled) {
+        JPEG_SetDecodeDestination(cover.stride, cover.width, cover.height);
+    } else {
+        cover_scale_setup(pInfo);
     }
 }
 
@@ -211,19 +716,570 @@ void HAL_JPEG_MspInit(JPEG_HandleTypeDef *hjpeg) {
 }
 
 /*
-** Helper function for copying data with DMA2D
+** Color converts every chunk of MCUs the decoder handed over into the
+** framebuffer and lets the decoder carry on if it was waiting for a chunk.
+** The MCUs of a scaled cover go into the band in SDRAM instead, converting
+** stops once the band is full and the next calls scale it down before the
+** rest of the chunk is converted into it
+** Returns 'true' if everything handed over so far is on the screen
 */
-bool DMA2D_CopyBuffer(uint32_t *pSrc, uint32_t *pDst, uint16_t x, uint16_t y, JPEG_ConfTypeDef *jpeg_info) {
-    uint32_t destination = (uint32_t)pDst + (y * BSP_LCD_GetXSize() + x) * 4;
-    uint32_t source      = (uint32_t)pSrc;
+bool cover_convert(void) {
+    // nothing to convert into before the frame header was read
+    if (cover.destination == NULL) return cover.chunk_size[cover.chunk_read] == 0;
 
-    /* DMA2D Start */
-    if (HAL_DMA2D_Start(&DMA2D_Handle, source, destination, jpeg_info->ImageWidth, jpeg_info->ImageHeight) != HAL_OK) {
+    if (scale.next < scale.end) {
+        cover_scale();
         return false;
     }
 
-    /* DMA2D Poll for Transfer */
-    if (HAL_DMA2D_PollForTransfer(&DMA2D_Handle, HAL_MAX_DELAY) != HAL_OK) return false;
+    while (cover.chunk_size[cover.chunk_read] != 0) {
+        uint8_t *data = jpeg_output[cover.chunk_read] + cover.chunk_used;
+        uint32_t size = cover.chunk_size[cover.chunk_read] - cover.chunk_used;
+        uint32_t converted = 0;
+
+        if (!cover.scaled) {
+            cover.block += pConvert_Function(data, cover.destination, cover.block, size, &converted);
+        } else {
+            // the converter places the MCUs by their index, counted from the
+            // start of the band they are in
+            uint32_t left = scale.mcus - cover.block % scale.mcus;
+            if (size > left * scale.mcu_size) size = left * scale.mcu_size;
+            cover.block += pConvert_Function(data, (uint8_t *)SDRAM_COVER_BAND, cover.block % scale.mcus, size,
+                                             &converted);
+        }
+
+        cover_histogram_add(data, converted);
+        cover.chunk_used += converted;
+        if (converted == 0 || cover.chunk_used >= cover.chunk_size[cover.chunk_read]) {
+            cover.chunk_used = 0;
+            cover.chunk_size[cover.chunk_read] = 0;
+            cover.chunk_read ^= 1;
+
+            if (cover.output_paused) {
+                cover.output_paused = false;
+                HAL_JPEG_Resume(&jpeg_handle, JPEG_PAUSE_RESUME_OUTPUT);
+            }
+        }
 
+        if (cover.scaled && cover.block % scale.mcus == 0) {
+            scale.next = (cover.block / scale.mcus - 1) * scale.lines;
+            scale.end = scale.next + scale.lines;
+            if (scale.end > cover.image_height) scale.end = cover.image_height;
+            return false;
+        }
+    }
     return true;
 }
+
+/*
+** Box filters the lines of the last converted band into the sums of the
+** lines of the cover they fall on, a line of the cover is written out once
+** all of its image lines are summed up. Stops after about
+** COVER_SCALE_PIXELS so a large band takes several calls
+*/
+void cover_scale(void) {
+    uint32_t pixels = 0;
+
+    while (scale.next < scale.end && pixels < COVER_SCALE_PIXELS) {
+        uint32_t row = scale.next * cover.height / cover.image_height;
+        if (row != scale.row) {
+            cover_flush();
+            scale.row = row;
+        }
+
+        // the image columns of each pixel of the cover are next to each
+        // other, move on to the next pixel whenever the position on the
+        // cover passes its right edge
+        uint32_t offset = (scale.next % scale.lines) * scale.line_size;
+        const Cover_Pixel *line = (const Cover_Pixel *)(SDRAM_COVER_BAND + offset);
+        uint32_t *sum = scale.sums;
+        uint32_t position = 0;
+        uint32_t edge = cover.image_width;
+        for (uint32_t i = 0; i < cover.image_width; i++) {
+            Cover_Pixel pixel = line[i];
+            sum[0] += COVER_RED(pixel);
+            sum[1] += COVER_GREEN(pixel);
+            sum[2] += COVER_BLUE(pixel);
+            position += cover.width;
+            if (position >= edge) {
+                edge += cover.image_width;
+                sum += 3;
+            }
+        }
+
+        scale.rows++;
+        scale.next++;
+        pixels += cover.image_width;
+        if (scale.next == cover.image_height) cover_flush();
+    }
+}
+
+/*
+** Prepares scaling down the cover described by 'info', its bands of MCUs
+** are converted into SDRAM with the padding of the last MCUs left out. An
+** image too wide for the band fails like one that can't be decoded
+*/
+void cover_scale_setup(JPEG_ConfTypeDef *info) {
+    uint32_t mcu_width = (info->ChromaSubsampling == JPEG_444_SUBSAMPLING) ? 8 : 16;
+    scale.lines = (info->ChromaSubsampling == JPEG_420_SUBSAMPLING) ? 16 : 8;
+    scale.mcus = info->ImageWidth / mcu_width;
+    scale.line_size = info->ImageWidth * LCD_BYTES_PER_PIXEL;
+
+    // bytes of the MCUs the decoder hands over, by the blocks they're made of
+    if (info->ColorSpace == JPEG_GRAYSCALE_COLORSPACE) {
+        scale.mcu_size = 64;
+    } else if (info->ColorSpace == JPEG_CMYK_COLORSPACE) {
+        scale.mcu_size = 4 * 64;
+    } else {
+        scale.mcu_size = (mcu_width / 8) * (scale.lines / 8) * 64 + 2 * 64;
+    }
+
+    if (scale.line_size * scale.lines > SDRAM_COVER_BAND_SIZE) {
+        cover.failed = true;
+        return;
+    }
+    JPEG_SetDecodeDestination(scale.line_size, cover.image_width, scale.lines);
+    cover_scale_start();
+}
+
+/*
+** Works out the image columns summed up into each pixel of a line of the
+** cover and empties the sums, before the first line of the image is scaled
+*/
+void cover_scale_start(void) {
+    uint32_t position = 0;
+    uint32_t edge = cover.image_width;
+    uint32_t column = 0;
+    for (uint32_t i = 0; i < cover.width; i++) scale.columns[i] = 0;
+    for (uint32_t i = 0; i < cover.image_width; i++) {
+        scale.columns[column]++;
+        position += cover.width;
+        if (position >= edge) {
+            edge += cover.image_width;
+            column++;
+        }
+    }
+
+    for (uint32_t i = 0; i < cover.width * 3; i++) scale.sums[i] = 0;
+    scale.next = 0;
+    scale.end = 0;
+    scale.row = 0;
+    scale.rows = 0;
+}
+
+/*
+** Writes the line of the cover whose sums are complete as the average of
+** the image pixels that went into each pixel and clears the sums
+*/
+void cover_flush(void) {
+    if (scale.rows == 0) return;
+
+    Cover_Pixel *out = (Cover_Pixel *)(cover.destination + scale.row * cover.stride);
+    uint32_t *sum = scale.sums;
+    for (uint32_t i = 0; i < cover.width; i++, sum += 3) {
+        uint32_t count = scale.columns[i] * scale.rows;
+        out[i] = COVER_PIXEL(sum[0] / count, sum[1] / count, sum[2] / count);
+        sum[0] = 0;
+        sum[1] = 0;
+        sum[2] = 0;
+    }
+    scale.rows = 0;
+}
+
+/*
+** Empties the histogram of the colors of the cover and works out where the
+** pixel binned of each MCU is, CMYK MCUs aren't binned. 'info' is NULL for
+** a png
+*/
+void cover_histogram_setup(JPEG_ConfTypeDef *info) {
+    for (uint32_t i = 0; i < COVER_COLOR_BINS; i++) {
+        histogram.counts[i] = 0;
+        histogram.sums[i][0] = 0;
+        histogram.sums[i][1] = 0;
+        histogram.sums[i][2] = 0;
+    }
+
+    // a png is binned from its decoded pixels
+    if (info == NULL) {
+        histogram.mcu_size = 0;
+        return;
+    }
+
+    // the luma blocks of an MCU come first, then one block of each chroma
+    if (info->ColorSpace == JPEG_GRAYSCALE_COLORSPACE) {
+        histogram.mcu_size = 64;
+        histogram.chroma = 0;
+    } else if (info->ColorSpace == JPEG_YCBCR_COLORSPACE) {
+        uint32_t blocks = (info->ChromaSubsampling == JPEG_420_SUBSAMPLING) ? 4
+                        : (info->ChromaSubsampling == JPEG_422_SUBSAMPLING) ? 2 : 1;
+        histogram.mcu_size = blocks * 64 + 2 * 64;
+        histogram.chroma = blocks * 64;
+    } else {
+        histogram.mcu_size = 0;
+    }
+}
+
+/*
+** Bins the top left pixel of each of the decoded MCUs in the 'size' bytes at
+** 'data' by its color
+*/
+void cover_histogram_add(const uint8_t *data, uint32_t size) {
+    if (histogram.mcu_size == 0) return;
+
+    for (const uint8_t *end = data + size; data < end; data += histogram.mcu_size) {
+        int32_t y = data[0] << 16;
+        int32_t cb = (histogram.chroma == 0) ? 0 : data[histogram.chroma] - 128;
+        int32_t cr = (histogram.chroma == 0) ? 0 : data[histogram.chroma + 64] - 128;
+
+        // JFIF YCbCr to RGB in 16.16 fixed point
+        int32_t red = (y + 91881 * cr) >> 16;
+        int32_t green = (y - 22554 * cb - 46802 * cr) >> 16;
+        int32_t blue = (y + 116130 * cb) >> 16;
+        red = (red < 0) ? 0 : (red > 255) ? 255 : red;
+        green = (green < 0) ? 0 : (green > 255) ? 255 : green;
+        blue = (blue < 0) ? 0 : (blue > 255) ? 255 : blue;
+        cover_histogram_bin(red, green, blue);
+    }
+}
+
+/*
+** Bins a pixel of 'red', 'green' and 'blue' from 0 to 255 by its color
+*/
+void cover_histogram_bin(int32_t red, int32_t green, int32_t blue) {
+    uint32_t bin = (red >> (8 - COVER_COLOR_BITS)) << (2 * COVER_COLOR_BITS) |
+                   (green >> (8 - COVER_COLOR_BITS)) << COVER_COLOR_BITS |
+                   (blue >> (8 - COVER_COLOR_BITS));
+    histogram.counts[bin]++;
+    histogram.sums[bin][0] += red;
+    histogram.sums[bin][1] += green;
+    histogram.sums[bin][2] += blue;
+}
+
+/*
+** Returns the average color of the most common bin of the histogram in
+** ARGB8888, or 0 if nothing was binned
+*/
+uint32_t cover_histogram_color(void) {
+    uint32_t bin = 0;
+    for (uint32_t i = 1; i < COVER_COLOR_BINS; i++) {
+        if (histogram.counts[i] > histogram.counts[bin]) bin = i;
+    }
+
+    uint32_t count = histogram.counts[bin];
+    if (count == 0) return 0;
+    return 0xFF000000 | (histogram.sums[bin][0] / count) << 16 | (histogram.sums[bin][1] / count) << 8 |
+           (histogram.sums[bin][2] / count);
+}
+
+/*
+** Starts decoding the jpeg or png image of 'size' bytes at 'offset' in 'file'
+** onto the screen, or into a slot of the cache if 'prefetch' is set
+** Returns 'true' if the decode started
+*/
+bool cover_decode(FIL *file, FSIZE_t offset, uint32_t size, uint64_t key, bool prefetch) {
+    if (prefetch) cover.slot = cover_reserve();
+
+    jpeg_complete = 0;
+    jpeg_file = file;
+    jpeg_file_offset = offset;
+    jpeg_file_end = offset + size;
+    cover.need_input = false;
+    cover.input_size[0] = 0;
+    cover.input_size[1] = 0;
+    cover.input_read = 0;
+    cover.input_used = 0;
+    cover.input_write = 0;
+    cover.ended = false;
+    cover.bytes_read = 0;
+    cover.output_paused = false;
+    cover.failed = false;
+    cover.chunk_size[0] = 0;
+    cover.chunk_size[1] = 0;
+    cover.chunk_write = 0;
+    cover.chunk_read = 0;
+    cover.chunk_used = 0;
+    cover.block = 0;
+    cover.destination = NULL;
+    cover.scaled = false;
+    cover.image_width = 0;
+    cover.image_height = 0;
+    scale.next = 0;
+    scale.end = 0;
+    cover.width = 0;
+    cover.height = 0;
+    cover.key = key;
+    cover.prefetch = prefetch;
+    cover.start = Perf_Cycles();
+    cover.cycles = 0;
+    cover.displayed = false;
+    cover.color = 0;
+    histogram.mcu_size = 0;
+
+    if (f_lseek(jpeg_file, offset) != FR_OK) return false;
+    if (Png_IsPng(jpeg_file)) return cover_png_start(offset, size);
+    cover_read();
+    if (cover.failed) return false;
+
+    HAL_StatusTypeDef status = HAL_JPEG_Decode_IT(&jpeg_handle,
+                                                  jpeg_input[0],
+                                                  cover.input_size[0],
+                                                  jpeg_output[0],
+                                                  COVER_CHUNK_SIZE);
+    if (status != HAL_OK) return false;
+
+    cover.cycles = Perf_Cycles() - cover.start;
+    cover.state = COVER_DECODE;
+    return true;
+}
+
+/*
+** Works out the size of the cover of an image of 'width' by 'height', scaled
+** down to fit COVER_MAX_SIZE keeping its aspect ratio if it is larger, where
+** it goes on the screen and where its pixels are written
+*/
+void cover_place(uint32_t width, uint32_t height) {
+    cover.image_width = width;
+    cover.image_height = height;
+    cover.scaled = (width > COVER_MAX_SIZE || height > COVER_MAX_SIZE);
+    if (cover.scaled && width >= height) {
+        height = (height * COVER_MAX_SIZE < width) ? 1 : height * COVER_MAX_SIZE / width;
+        width = COVER_MAX_SIZE;
+    } else if (cover.scaled) {
+        width = (width * COVER_MAX_SIZE < height) ? 1 : width * COVER_MAX_SIZE / height;
+        height = COVER_MAX_SIZE;
+    }
+
+    // centered like before, and never written outside of the framebuffer
+    uint32_t x = (width < BSP_LCD_GetXSize()) ? (BSP_LCD_GetXSize() - width)/2 : 0;
+    uint32_t y = (height + 200 < BSP_LCD_GetYSize()) ? (BSP_LCD_GetYSize() - height)/2 - 100 : 0;
+    if (width > BSP_LCD_GetXSize() - x) width = BSP_LCD_GetXSize() - x;
+    if (height > BSP_LCD_GetYSize() - y) height = BSP_LCD_GetYSize() - y;
+
+    cover.x = x;
+    cover.y = y;
+    cover.width = width;
+    cover.height = height;
+
+    // the pixels go straight into the framebuffer, or the cache slot of a
+    // prefetched cover, which always fits as it is at most COVER_MAX_SIZE
+    if (!cover.prefetch) {
+        cover.destination = cover_screen(x, y);
+        cover.stride = BSP_LCD_GetXSize() * LCD_BYTES_PER_PIXEL;
+    } else {
+        cover.destination = cover_slot(cover.slot);
+        cover.stride = width * LCD_BYTES_PER_PIXEL;
+        cache.slots[cover.slot].x = x;
+        cache.slots[cover.slot].y = y;
+        cache.slots[cover.slot].width = width;
+        cache.slots[cover.slot].height = height;
+    }
+}
+
+/*
+** Starts decoding the png image of 'size' bytes at 'offset' in the file of
+** the cover, Cover_Process() decodes its rows. A scaled png goes through the
+** band one row at a time
+** Returns 'true' if the decode started
+*/
+bool cover_png_start(FSIZE_t offset, uint32_t size) {
+    uint32_t width, height;
+    if (!Png_Start(jpeg_file, offset, size, &width, &height)) return false;
+
+    cover_place(width, height);
+    cover_histogram_setup(NULL);
+    if (cover.scaled) {
+        scale.lines = 1;
+        scale.line_size = width * LCD_BYTES_PER_PIXEL;
+        cover_scale_start();
+    }
+
+    cover.cycles = Perf_Cycles() - cover.start;
+    cover.state = COVER_PNG;
+    return true;
+}
+
+/*
+** Decodes rows of the png cover for about half of COVER_SLICE_US, leaving
+** time for the reads of the file in between. Rows go straight into the
+** framebuffer, or into the band to be copied over if the cover is cut off by
+** the edge of the screen, or to be box filtered into the cover if it is
+** scaled. A pixel of every few is binned by its color
+** Returns 'true' once every row is done
+*/
+bool cover_png(void) {
+    uint32_t start = Perf_Cycles();
+
+    while (cover.block < cover.image_height) {
+        uint32_t row = cover.block;
+        bool direct = !cover.scaled && cover.width == cover.image_width && row < cover.height;
+        uint8_t *line = direct ? cover.destination + row * cover.stride : (uint8_t *)SDRAM_COVER_BAND;
+        if (!Png_Row(line)) {
+            cover.failed = true;
+            return false;
+        }
+
+        if (row % COVER_PNG_SAMPLE == 0) {
+            const Cover_Pixel *pixels = (const Cover_Pixel *)line;
+            for (uint32_t i = 0; i < cover.image_width; i += COVER_PNG_SAMPLE) {
+                cover_histogram_bin(COVER_RED8(pixels[i]), COVER_GREEN8(pixels[i]), COVER_BLUE8(pixels[i]));
+            }
+        }
+
+        if (cover.scaled) {
+            scale.next = row;
+            scale.end = row + 1;
+            cover_scale();
+        } else if (!direct && row < cover.height) {
+            memcpy(cover.destination + row * cover.stride, line, cover.width * LCD_BYTES_PER_PIXEL);
+        }
+
+        cover.block++;
+        if (Perf_CyclesToUs(Perf_Cycles() - start) >= COVER_SLICE_US / 2) break;
+    }
+    return cover.block == cover.image_height;
+}
+
+/*
+** Moves on from a cover that is on the screen: a decoded one is copied into
+** the least recently used slot of the cache if it has a key and fits, then
+** the time it took is printed. A prefetched cover is already in its slot
+*/
+void cover_done(void) {
+    uint32_t us = Perf_CyclesToUs(Perf_Cycles() - cover.start);
+    uint32_t cpu_us, pixels;
+    Cover_Slot *slot = &cache.slots[cover.slot];
+
+    switch (cover.state) {
+    case COVER_DECODE:
+    case COVER_PNG:
+        if (cover.state == COVER_PNG) cover.bytes_read = Png_BytesRead();
+        cover.state = COVER_IDLE;
+        cover.color = cover_histogram_color();
+        // the CPU time per megapixel of the image shows what scaling costs
+        cpu_us = Perf_CyclesToUs(cover.cycles);
+        pixels = (uint32_t)cover.image_width * cover.image_height;
+        printf("cover: %s %ux%u as %ux%u in %lu us (%lu us CPU, %lu us per megapixel), %lu bytes read\r\n",
+               cover.prefetch ? "prefetched" : "decoded", cover.image_width, cover.image_height, cover.width,
+               cover.height, us, cpu_us, pixels == 0 ? 0 : (uint32_t)((uint64_t)cpu_us * 1000000 / pixels),
+               cover.bytes_read);
+        if (cover.prefetch) {
+            slot->key = cover.key;
+            slot->used = ++cache.uses;
+            slot->decode_us = us;
+            slot->color = cover.color;
+            break;
+        }
+        cover.displayed = true;
+        if (cover.key == COVER_NO_KEY || cover.width == 0) break;
+        if ((uint32_t)cover.width * cover.height * LCD_BYTES_PER_PIXEL > COVER_CACHE_SLOT_SIZE) break;
+
+        cover.slot = cover_reserve();
+        slot = &cache.slots[cover.slot];
+        slot->decode_us = us;
+        slot->color = cover.color;
+        slot->x = cover.x;
+        slot->y = cover.y;
+        slot->width = cover.width;
+        slot->height = cover.height;
+        cover.state = COVER_STORE;
+        break;
+
+    case COVER_STORE:
+        slot->key = cover.key;
+        slot->used = ++cache.uses;
+        cover.state = COVER_IDLE;
+        break;
+
+    case COVER_BLIT:
+        cover.displayed = true;
+        cover.state = COVER_IDLE;
+        if (slot->decode_us > us) cache.saved_ms += (slot->decode_us - us) / 1000;
+        printf("cover: cache hit in %lu us, %lu of %lu lookups hit (%lu%%), %lu ms of decoding saved\r\n", us,
+               cache.hits, cache.lookups, cache.hits * 100 / cache.lookups, cache.saved_ms);
+        break;
+
+    case COVER_IDLE: break;
+    }
+}
+
+/*
+** Starts a DMA2D copy of the cover in the current slot from 'source' to
+** 'destination', the offsets are the pixels skipped at the end of each line
+** Returns 'true' if the copy started
+*/
+bool cover_blit(uint32_t source, uint32_t source_offset, uint32_t destination, uint32_t destination_offset) {
+    Cover_Slot *slot = &cache.slots[cover.slot];
+
+    DMA2D_Handle.Init.OutputOffset = destination_offset;
+    DMA2D_Handle.LayerCfg[1].InputOffset = source_offset;
+    if (HAL_DMA2D_DeInit(&DMA2D_Handle) != HAL_OK) return false;
+    if (HAL_DMA2D_Init(&DMA2D_Handle) != HAL_OK) return false;
+    if (HAL_DMA2D_ConfigLayer(&DMA2D_Handle, 1) != HAL_OK) return false;
+
+    // Cover_Process() polls for the end of the transfer
+    return HAL_DMA2D_Start(&DMA2D_Handle, source, destination, slot->width, slot->height) == HAL_OK;
+}
+
+/*
+** Returns the slot of the cache holding the cover for 'key', or
+** COVER_CACHE_SLOTS if it isn't cached
+*/
+uint32_t cover_find(uint64_t key) {
+    for (uint32_t i = 0; i < COVER_CACHE_SLOTS; i++) {
+        if (cache.slots[i].key == key) return i;
+    }
+    return COVER_CACHE_SLOTS;
+}
+
+/*
+** Empties the least recently used slot of the cache for a new cover, empty
+** slots were never used so they go first
+** Returns the slot
+*/
+uint32_t cover_reserve(void) {
+    uint32_t slot = 0;
+    for (uint32_t i = 1; i < COVER_CACHE_SLOTS; i++) {
+        if (cache.slots[i].used < cache.slots[slot].used) slot = i;
+    }
+    cache.slots[slot].key = COVER_NO_KEY;
+    cache.slots[slot].used = 0;
+    return slot;
+}
+
+/*
+** Returns the address of cache slot 'slot' in SDRAM
+*/
+uint8_t *cover_slot(uint32_t slot) {
+    return (uint8_t *)SDRAM_COVER_CACHE + slot * COVER_CACHE_SLOT_SIZE;
+}
+
+/*
+** Returns the address of the pixel at 'x', 'y' in the framebuffer being
+** drawn into
+*/
+uint8_t *cover_screen(uint16_t x, uint16_t y) {
+    return (uint8_t *)LCD_DrawBuffer() + ((uint32_t)y * BSP_LCD_GetXSize() + x) * LCD_BYTES_PER_PIXEL;
+}
+
+/*
+** Reads the next part of the jpeg into the next input buffer if the decoder
+** is done with it, never past the end of the jpeg. The first read stops at
+** the end of a sector so all the others are whole sectors
+*/
+void cover_read(void) {
+    uint32_t input = cover.input_write;
+    if (cover.input_size[input] != 0 || jpeg_file_offset == jpeg_file_end) return;
+
+    UINT len = COVER_INPUT_SIZE - jpeg_file_offset % _MIN_SS;
+    if (jpeg_file_end - jpeg_file_offset < len) len = jpeg_file_end - jpeg_file_offset;
+
+    UINT bytes_read = 0;
+    if (f_read(jpeg_file, jpeg_input[input], len, &bytes_read) != FR_OK || bytes_read == 0) {
+        cover.failed = true;
+        return;
+    }
+    jpeg_file_offset += bytes_read;
+    cover.bytes_read += bytes_read;
+    cover.input_write = input ^ 1;
+    cover.input_size[input] = bytes_read;
+}
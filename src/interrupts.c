@@ -9,6 +9,7 @@
 #include "stm32f7xx_hal.h"
 #include "stm32f7xx_hal_dma.h"
 #include "stm32f7xx_hal_jpeg.h"
+#include "stm32f7xx_hal_ltdc.h"
 #include "stm32f7xx_hal_sai.h"
 
 /*
@@ -26,3 +27,12 @@ extern JPEG_HandleTypeDef jpeg_handle;
 void JPEG_IRQHandler(void) {
     HAL_JPEG_IRQHandler(&jpeg_handle);
 }
+
+/*
+** Interrupts for the LCD, the reload at the vertical blanking swaps the
+** framebuffers
+*/
+extern LTDC_HandleTypeDef hltdc_discovery;
+void LTDC_IRQHandler(void) {
+    HAL_LTDC_IRQHandler(&hltdc_discovery);
+}
@@ -2,20 +2,28 @@
 
 #include "lcd.h"
 
+#include "diskio.h"
 #include "music.h"
+#include "perf.h"
+#include "sdram.h"
 #include "stm32f769i_discovery_lcd.h"
 #include "stm32f769i_discovery_ts.h"
 #include "stm32f7xx_hal.h"
+#include "stm32f7xx_hal_dma2d.h"
+#include "stm32f7xx_hal_ltdc.h"
 
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #define SQRT_3 1.73
 
-#define LCD_FRAME_BUFFER 0xC0000000
+// colors of the UI unless LCD_SetTheme() picked some that go with the cover
 #define LCD_FG           0xFFCDD6F4
 #define LCD_BG           0xFF1E1E2E
+// luma of a background above which the text is dark
+#define LCD_LIGHT        128
 
 // leeway we are giving to touch-screen UI elements
 #define UI_TS_LEEWAY 10
@@ -54,12 +62,249 @@
 // scale factor of next
 #define UI_NEXT_S 80
 
+// y position of previous
+#define UI_PREV_Y 690
+// x position of previous
+#define UI_PREV_X (UI_X/4)
+// scale factor of previous
+#define UI_PREV_S 80
+
+// y position of the center of shuffle
+#define UI_SHUFFLE_Y 630
+// x position of the center of shuffle
+#define UI_SHUFFLE_X (UI_X/2)
+// width of shuffle
+#define UI_SHUFFLE_W 200
+// height of shuffle
+#define UI_SHUFFLE_H 30
+
+// y position of the center of search
+#define UI_SEARCH_Y 520
+// width of search
+#define UI_SEARCH_W 140
+// height of search
+#define UI_SEARCH_H 30
+
+// y position of the center of sort, on the row of search
+#define UI_SORT_Y   UI_SEARCH_Y
+// x position of the center of sort
+#define UI_SORT_X   (UI_X/2 + UI_X/3)
+// width of sort
+#define UI_SORT_W   120
+// height of sort
+#define UI_SORT_H   30
+// longest label of sort, in characters
+#define UI_SORT_MAX 6
+
+// y position of the first search result
+#define UI_RESULT_Y    110
+// height of each search result
+#define UI_RESULT_H    40
+// number of search results shown
+#define UI_RESULT_ROWS LCD_SEARCH_RESULTS
+
+// y position of the top of the keyboard
+#define UI_KEY_Y    440
+// height of each key
+#define UI_KEY_H    64
+// width of each key
+#define UI_KEY_W    (UI_X / UI_KEY_COLS)
+// keys in each row of the keyboard
+#define UI_KEY_COLS 10
+// rows of the keyboard
+#define UI_KEY_ROWS 5
+
+// y position of the bottom of the disk latency histogram
+#define UI_HIST_Y 795
+// height of the tallest disk latency histogram bar
+#define UI_HIST_H 50
+// width of each disk latency histogram bar
+#define UI_HIST_W (UI_X / DISKIO_HIST_BUCKETS)
+
+// width of the framebuffer, text centered by the BSP spans all of it
+#define UI_W        480
+// width and height of a character of the font of the UI (Font24)
+#define UI_TEXT_W   17
+#define UI_TEXT_H   24
+// longest title or artist kept, in bytes
+#define UI_TEXT_MAX 64
+
+// y position of the title
+#define UI_TITLE_Y  30
+// y position of the artist
+#define UI_ARTIST_Y 60
+
+// y position of the volume
+#define UI_VOL_TEXT_Y 570
+// width of the volume, "VOL: 100"
+#define UI_VOL_TEXT_W (8 * UI_TEXT_W)
+
+// width of shuffle, "SHUFFLE OFF"
+#define UI_SHUFFLE_TEXT_W (11 * UI_TEXT_W)
+
+// most rectangles kept apart in a list of dirty or drawn ones, any more are
+// merged into the one that holds them all
+#define LCD_REGIONS 16
+
+
+// keys of the keyboard, one character per column, a key that repeats over
+// several columns is one wide key
+static const char *const keyboard[UI_KEY_ROWS] = {
+    "1234567890",
+    "QWERTYUIOP",
+    "ASDFGHJKL",
+    "ZXCVBNM",
+    "    \b\b\b\x1B\x1B\x1B",
+};
+
+typedef struct {
+    uint16_t x, y, width, height;
+} LCD_Rect;
+
+// widgets of the player screen, each one is drawn whole by its function
+typedef enum {
+    UI_WIDGET_TITLE,
+    UI_WIDGET_ARTIST,
+    UI_WIDGET_SEARCH,
+    UI_WIDGET_SORT,
+    UI_WIDGET_VOL_DOWN,
+    UI_WIDGET_VOL_UP,
+    UI_WIDGET_VOL,
+    UI_WIDGET_SHUFFLE,
+    UI_WIDGET_PREV,
+    UI_WIDGET_PAUSE_PLAY,
+    UI_WIDGET_NEXT,
+#if _USE_DISKIO_STATS == 1
+    UI_WIDGET_DISK_STATS,
+#endif
+    UI_WIDGETS
+} UI_Widget;
+
+/*
+** colors the UI is drawn in and what its widgets show, so any of them can
+** be drawn again at any time. Changing what a widget shows only marks its
+** rectangle dirty, the dirty rectangles are merged wherever they overlap and
+** LCD_Present() draws the widgets in them again
+*/
+static struct {
+    uint32_t fg;
+    uint32_t bg;
+    bool paused;
+    bool shuffle;
+    uint32_t volume;
+    char title[UI_TEXT_MAX];
+    char artist[UI_TEXT_MAX];
+    char sort[UI_SORT_MAX + 1];
+#if _USE_DISKIO_STATS == 1
+    // heights of the bars of the disk latency histogram, if it is shown
+    bool stats;
+    uint8_t bars[DISKIO_HIST_BUCKETS];
+#endif
+    // parts of the screen to draw again, none of them overlap. They wait
+    // while the search keyboard covers the screen
+    LCD_Rect dirty[LCD_REGIONS];
+    uint32_t dirty_count;
+    bool keyboard;
+} ui = {
+    .fg = LCD_FG,
+    .bg = LCD_BG,
+};
+
+// framebuffers the screen is drawn into and scanned out of in turn
+static const uint32_t frame_buffers[2] = { LCD_FRAME_BUFFER_0, LCD_FRAME_BUFFER_1 };
+
+/*
+** the screen is drawn into one framebuffer while the LTDC scans out the
+** other, LCD_Present() swaps them at the vertical blanking and the regions
+** that were drawn are then copied into the one that left the screen, so both
+** are the same again before anything else is drawn
+*/
+static struct {
+    // framebuffer being drawn into
+    uint32_t back;
+    // the reload interrupt moves a frame from swapping to swapped
+    volatile enum { LCD_FRAME_DRAWING, LCD_FRAME_SWAPPING, LCD_FRAME_SWAPPED, LCD_FRAME_COPYING } state;
+    // regions drawn since the last present, none of them overlap, and how
+    // many of them are copied
+    LCD_Rect regions[LCD_REGIONS];
+    uint32_t count;
+    uint32_t copied;
+    // when the frame was presented, then the frames, the time from present
+    // until drawing could carry on, the pixels drawn and the bytes copied
+    // since LCD_PrintStats()
+    uint32_t start;
+    uint32_t frames;
+    uint32_t total_us;
+    uint32_t max_us;
+    uint32_t pixels;
+    uint32_t max_pixels;
+    uint32_t bytes;
+} frame;
 
 TS_StateTypeDef TS_State;
+DMA2D_HandleTypeDef LCD_DMA2D_Handle;
+extern LTDC_HandleTypeDef hltdc_discovery;
 
+static bool LCD_Touch(uint16_t *x, uint16_t *y);
+static void LCD_DrawScreen(void);
+static void LCD_Invalidate(const LCD_Rect *rect);
+static void LCD_Compose(void);
+static bool LCD_CopyRect(uint32_t src, uint32_t dst, const LCD_Rect *rect);
+static void LCD_AddRect(LCD_Rect *rects, uint32_t *count, LCD_Rect rect);
+static bool LCD_Inside(const LCD_Rect *inner, const LCD_Rect *outer);
+static bool LCD_Overlaps(const LCD_Rect *a, const LCD_Rect *b);
+static LCD_Rect LCD_Union(const LCD_Rect *a, const LCD_Rect *b);
+static void LCD_DrawTitle(void);
+static void LCD_DrawArtist(void);
+static void LCD_DrawSearchButton(void);
+static void LCD_DrawSortButton(void);
 static void LCD_DrawVolUp(void);
 static void LCD_DrawVolDown(void);
+static void LCD_DrawVolText(void);
+static void LCD_DrawShuffleText(void);
 static void LCD_DrawNext(void);
+static void LCD_DrawPrev(void);
+static void LCD_DrawPausePlay(void);
+#if _USE_DISKIO_STATS == 1
+static void LCD_DrawHistogram(void);
+#endif
+
+// where each widget of the player screen is and what draws it, a dirty
+// rectangle that covers part of a widget grows to cover all of it
+static const struct {
+    LCD_Rect rect;
+    void (*draw)(void);
+} widgets[UI_WIDGETS] = {
+    [UI_WIDGET_TITLE] = {
+        { 0, UI_TITLE_Y, UI_W, UI_TEXT_H }, LCD_DrawTitle },
+    [UI_WIDGET_ARTIST] = {
+        { 0, UI_ARTIST_Y, UI_W, UI_TEXT_H }, LCD_DrawArtist },
+    [UI_WIDGET_SEARCH] = {
+        { UI_X/2 - UI_SEARCH_W/2, UI_SEARCH_Y - UI_SEARCH_H/2, UI_SEARCH_W + 1, UI_SEARCH_H + 1 },
+        LCD_DrawSearchButton },
+    [UI_WIDGET_SORT] = {
+        { UI_SORT_X - UI_SORT_W/2, UI_SORT_Y - UI_SORT_H/2, UI_SORT_W + 1, UI_SORT_H + 1 }, LCD_DrawSortButton },
+    [UI_WIDGET_VOL_DOWN] = {
+        { UI_VOL_DN_X - UI_VOL_R, UI_VOL_Y - UI_VOL_R, 2*UI_VOL_R + 1, 2*UI_VOL_R + 1 }, LCD_DrawVolDown },
+    [UI_WIDGET_VOL_UP] = {
+        { UI_VOL_UP_X - UI_VOL_R, UI_VOL_Y - UI_VOL_R, 2*UI_VOL_R + 1, 2*UI_VOL_R + 1 }, LCD_DrawVolUp },
+    [UI_WIDGET_VOL] = {
+        { (UI_W - UI_VOL_TEXT_W)/2, UI_VOL_TEXT_Y, UI_VOL_TEXT_W, UI_TEXT_H }, LCD_DrawVolText },
+    [UI_WIDGET_SHUFFLE] = {
+        { (UI_W - UI_SHUFFLE_TEXT_W)/2, UI_SHUFFLE_Y - UI_TEXT_H/2, UI_SHUFFLE_TEXT_W, UI_TEXT_H },
+        LCD_DrawShuffleText },
+    [UI_WIDGET_PREV] = {
+        { UI_PREV_X - UI_PREV_S/2, UI_PREV_Y - UI_PREV_S/2, UI_PREV_S + 1, UI_PREV_S + 1 }, LCD_DrawPrev },
+    [UI_WIDGET_PAUSE_PLAY] = {
+        { UI_PAUSE_PLAY_X - UI_PAUSE_PLAY_S/2 - 1, UI_PAUSE_PLAY_Y - UI_PAUSE_PLAY_S/2 - 1,
+          UI_PAUSE_PLAY_S + 2, UI_PAUSE_PLAY_S + 2 }, LCD_DrawPausePlay },
+    [UI_WIDGET_NEXT] = {
+        { UI_NEXT_X - UI_NEXT_S/2, UI_NEXT_Y - UI_NEXT_S/2, UI_NEXT_S + 1, UI_NEXT_S + 1 }, LCD_DrawNext },
+#if _USE_DISKIO_STATS == 1
+    [UI_WIDGET_DISK_STATS] = {
+        { 0, UI_HIST_Y - UI_HIST_H, UI_X, UI_HIST_H + 1 }, LCD_DrawHistogram },
+#endif
+};
 
 /*
 ** Initializes everything needed for LCD and TS
@@ -67,17 +312,22 @@ static void LCD_DrawNext(void);
 */
 bool LCD_Init(void) {
     BSP_LCD_InitEx(LCD_ORIENTATION_PORTRAIT);
-    BSP_LCD_LayerDefaultInit(0, LCD_FRAME_BUFFER);
+#ifdef LCD_RGB565
+    BSP_LCD_LayerRgb565Init(0, LCD_FRAME_BUFFER_0);
+#else
+    BSP_LCD_LayerDefaultInit(0, LCD_FRAME_BUFFER_0);
+#endif
     BSP_LCD_SelectLayer(0);
-    BSP_LCD_Clear(LCD_BG);
-    BSP_LCD_SetBackColor(LCD_BG);
-    BSP_LCD_SetTextColor(LCD_FG);
 
-    LCD_DrawNext();
-    LCD_DrawPause();
-    LCD_DrawVolUp();
-    LCD_DrawVolDown();
-    LCD_DrawVol();
+    // the first framebuffer is on the screen, the drawing functions of the
+    // BSP draw into the second one as its address only waits in the shadow
+    // register until LCD_Present()
+    frame.back = 1;
+    HAL_LTDC_SetAddress_NoReload(&hltdc_discovery, frame_buffers[frame.back], 0);
+    ui.volume = Music_GetVolume();
+    LCD_DrawScreen();
+    LCD_Present();
+    while (LCD_IsBusy());
 
     BSP_TS_Init(BSP_LCD_GetXSize(), BSP_LCD_GetYSize());
 
@@ -85,24 +335,47 @@ bool LCD_Init(void) {
 }
 
 /*
-** Displays the song title
+** Switches the UI to colors that go with a cover whose dominant color is
+** 'color': it becomes the background and the text is dark or light,
+** whichever stands out. The default colors come back for 0. If the colors
+** changed the whole screen is drawn again
+** Returns 'true' if the screen was cleared, so the cover has to be drawn
+** again
+*/
+bool LCD_SetTheme(uint32_t color) {
+    uint32_t bg = LCD_BG;
+    uint32_t fg = LCD_FG;
+
+    if (color != 0) {
+        uint32_t luma = (77 * ((color >> 16) & 0xFF) + 150 * ((color >> 8) & 0xFF) + 29 * (color & 0xFF)) >> 8;
+        bg = 0xFF000000 | color;
+        fg = (luma > LCD_LIGHT) ? LCD_BG : LCD_FG;
+    }
+    if (bg == ui.bg && fg == ui.fg) return false;
+
+    ui.bg = bg;
+    ui.fg = fg;
+    LCD_DrawScreen();
+    return true;
+}
+
+/*
+** Displays the song title from the next LCD_Present() on
 ** Returns 'true' if everything initializes correctly
 */
 bool LCD_SongTitle(char *title) {
-    BSP_LCD_SetTextColor(LCD_BG);
-    BSP_LCD_FillRect(0, 0, 480, 100);
-    BSP_LCD_SetTextColor(LCD_FG);
-
-    BSP_LCD_DisplayStringAt(0,30, (uint8_t *)title, CENTER_MODE);
+    snprintf(ui.title, sizeof(ui.title), "%s", title);
+    LCD_Invalidate(&widgets[UI_WIDGET_TITLE].rect);
     return true;
 }
 
 /*
-** Displays the song artist
+** Displays the song artist from the next LCD_Present() on
 ** Returns 'true' if everything initializes correctly
 */
 bool LCD_SongArtist(char *artist) {
-    BSP_LCD_DisplayStringAt(0,60, (uint8_t *)artist, CENTER_MODE);
+    snprintf(ui.artist, sizeof(ui.artist), "%s", artist);
+    LCD_Invalidate(&widgets[UI_WIDGET_ARTIST].rect);
     return true;
 }
 
@@ -110,90 +383,575 @@ bool LCD_SongArtist(char *artist) {
 ** Returns enum value of user input
 */
 TS_Input LCD_GetUserInput(void) {
-    // this function is so weird because of "phantom" presses that happen after
-    // not pressing the TS for some period of time (usually 20-30 seconds)
-    // the way it works, is by waiting until the press is released and then
-    // ensuring that it lasted >= X ms (via HAL SysTick)
+    uint16_t x1, y1;
+    TS_Input input = TS_INPUT_NONE;
+
+    if (!LCD_Touch(&x1, &y1)) return TS_INPUT_NONE;
+
+    //Next Song
+    if (y1 < UI_NEXT_Y + (UI_NEXT_S/2) + UI_TS_LEEWAY &&
+        y1 > UI_NEXT_Y - (UI_NEXT_S/2) + UI_TS_LEEWAY &&
+        x1 < UI_NEXT_X + (UI_NEXT_S/2) + UI_TS_LEEWAY &&
+        x1 > UI_NEXT_X - (UI_NEXT_S/2) + UI_TS_LEEWAY){
+        input = TS_INPUT_SKIP;
+    }
+    //Previous Song
+    if (y1 < UI_PREV_Y + (UI_PREV_S/2) + UI_TS_LEEWAY &&
+        y1 > UI_PREV_Y - (UI_PREV_S/2) + UI_TS_LEEWAY &&
+        x1 < UI_PREV_X + (UI_PREV_S/2) + UI_TS_LEEWAY &&
+        x1 > UI_PREV_X - (UI_PREV_S/2) + UI_TS_LEEWAY){
+        input = TS_INPUT_PREV;
+    }
+    //Shuffle
+    if (y1 < UI_SHUFFLE_Y + (UI_SHUFFLE_H/2) + UI_TS_LEEWAY &&
+        y1 > UI_SHUFFLE_Y - (UI_SHUFFLE_H/2) + UI_TS_LEEWAY &&
+        x1 < UI_SHUFFLE_X + (UI_SHUFFLE_W/2) + UI_TS_LEEWAY &&
+        x1 > UI_SHUFFLE_X - (UI_SHUFFLE_W/2) + UI_TS_LEEWAY){
+        input = TS_INPUT_SHUFFLE;
+    }
+    //volume up
+    if ((y1 < UI_VOL_Y + UI_VOL_R + UI_TS_LEEWAY) &&
+        (y1 > UI_VOL_Y - UI_VOL_R + UI_TS_LEEWAY) &&
+        (x1 < UI_VOL_UP_X + UI_VOL_R + UI_TS_LEEWAY) &&
+        (x1 > UI_VOL_UP_X - UI_VOL_R + UI_TS_LEEWAY)) {
+        input = TS_INPUT_VOL_UP;
+    }
+    //volume down
+    if ((y1 < UI_VOL_Y + UI_VOL_R + UI_TS_LEEWAY) &&
+        (y1 > UI_VOL_Y - UI_VOL_R + UI_TS_LEEWAY) &&
+        (x1 < UI_VOL_DN_X + UI_VOL_R + UI_TS_LEEWAY) &&
+        (x1 > UI_VOL_DN_X - UI_VOL_R + UI_TS_LEEWAY)) {
+        input = TS_INPUT_VOL_DOWN;
+    }
+
+    //Pause and Play button
+    if (y1 < UI_PAUSE_PLAY_Y + (UI_PAUSE_PLAY_S/2) + UI_TS_LEEWAY &&
+        y1 > UI_PAUSE_PLAY_Y - (UI_PAUSE_PLAY_S/2) + UI_TS_LEEWAY &&
+        x1 < UI_PAUSE_PLAY_X + (UI_PAUSE_PLAY_S/2) + UI_TS_LEEWAY &&
+        x1 > UI_PAUSE_PLAY_X - (UI_PAUSE_PLAY_S/2) + UI_TS_LEEWAY) {
+        input = TS_INPUT_PAUSE_PLAY;
+    }
+    //Search
+    if (y1 < UI_SEARCH_Y + (UI_SEARCH_H/2) + UI_TS_LEEWAY &&
+        y1 > UI_SEARCH_Y - (UI_SEARCH_H/2) + UI_TS_LEEWAY &&
+        x1 < UI_X/2 + (UI_SEARCH_W/2) + UI_TS_LEEWAY &&
+        x1 > UI_X/2 - (UI_SEARCH_W/2) + UI_TS_LEEWAY) {
+        input = TS_INPUT_SEARCH;
+    }
+    //Sort
+    if (y1 < UI_SORT_Y + (UI_SORT_H/2) + UI_TS_LEEWAY &&
+        y1 > UI_SORT_Y - (UI_SORT_H/2) + UI_TS_LEEWAY &&
+        x1 < UI_SORT_X + (UI_SORT_W/2) + UI_TS_LEEWAY &&
+        x1 > UI_SORT_X - (UI_SORT_W/2) + UI_TS_LEEWAY) {
+        input = TS_INPUT_SORT;
+    }
+
+    return input;
+}
+
+/*
+** Returns the key of the search keyboard that was touched, LCD_KEY_RESULT + n
+** for the n-th search result or LCD_KEY_NONE
+*/
+int LCD_GetKey(void) {
+    uint16_t x, y;
+
+    if (!LCD_Touch(&x, &y)) return LCD_KEY_NONE;
+
+    if (y >= UI_RESULT_Y && y < UI_RESULT_Y + UI_RESULT_ROWS * UI_RESULT_H) {
+        return LCD_KEY_RESULT + (y - UI_RESULT_Y) / UI_RESULT_H;
+    }
+    if (y < UI_KEY_Y || y >= UI_KEY_Y + UI_KEY_ROWS * UI_KEY_H) return LCD_KEY_NONE;
+
+    const char *row = keyboard[(y - UI_KEY_Y) / UI_KEY_H];
+    uint32_t col = x / UI_KEY_W;
+    if (col >= strlen(row)) return LCD_KEY_NONE;
+    return row[col];
+}
+
+/*
+** Copies the screen as drawn so far to SDRAM with the DMA2D, nothing may be
+** drawn until LCD_IsBusy() returns 'false'
+** Returns 'true' if the copy started
+*/
+bool LCD_SaveScreen(void) {
+    // the saved screen comes back after the search, with what changed before
+    LCD_Compose();
+    LCD_Rect screen = { 0, 0, BSP_LCD_GetXSize(), BSP_LCD_GetYSize() };
+    return LCD_CopyRect(LCD_DrawBuffer(), SDRAM_SCREEN_SAVE, &screen);
+}
+
+/*
+** Copies the screen saved by LCD_SaveScreen() back with the DMA2D, it is
+** shown by the next LCD_Present(). Nothing may be drawn until LCD_IsBusy()
+** returns 'false'
+** Returns 'true' if the copy started
+*/
+bool LCD_RestoreScreen(void) {
+    LCD_Rect screen = { 0, 0, BSP_LCD_GetXSize(), BSP_LCD_GetYSize() };
+    ui.keyboard = false;
+    LCD_MarkDrawn(0, 0, screen.width, screen.height);
+    return LCD_CopyRect(SDRAM_SCREEN_SAVE, LCD_DrawBuffer(), &screen);
+}
+
+/*
+** Returns 'true' while a copy of the screen is in progress, or while the
+** frame last presented isn't on the screen and copied into the other
+** framebuffer yet. Nothing may be drawn until it returns 'false'
+*/
+bool LCD_IsBusy(void) {
+    if ((DMA2D->CR & DMA2D_CR_START) != 0) return true;
+
+    // the HAL keeps the handle locked until it has seen the copy finish,
+    // without this the next copy could never start
+    if (LCD_DMA2D_Handle.State == HAL_DMA2D_STATE_BUSY) HAL_DMA2D_PollForTransfer(&LCD_DMA2D_Handle, 0);
+
+    switch (frame.state) {
+    case LCD_FRAME_DRAWING: return false;
+    case LCD_FRAME_SWAPPING: return true;
+    case LCD_FRAME_SWAPPED:
+        // draw into the framebuffer that just left the screen, its address
+        // waits in the shadow register until the next present
+        frame.back ^= 1;
+        HAL_LTDC_SetAddress_NoReload(&hltdc_discovery, frame_buffers[frame.back], 0);
+        frame.state = LCD_FRAME_COPYING;
+        break;
+    case LCD_FRAME_COPYING: break;
+    }
+
+    // it is missing the regions drawn into the one on the screen, they are
+    // copied over one at a time
+    while (frame.copied < frame.count) {
+        const LCD_Rect *rect = &frame.regions[frame.copied++];
+        if (LCD_CopyRect(frame_buffers[frame.back ^ 1], frame_buffers[frame.back], rect)) {
+            frame.bytes += (uint32_t)rect->width * rect->height * LCD_BYTES_PER_PIXEL;
+            return true;
+        }
+    }
+
+    uint32_t us = Perf_CyclesToUs(Perf_Cycles() - frame.start);
+    frame.frames++;
+    frame.total_us += us;
+    if (us > frame.max_us) frame.max_us = us;
+    frame.count = 0;
+    frame.state = LCD_FRAME_DRAWING;
+    return false;
+}
+
+/*
+** Draws the widgets in the dirty rectangles again, then shows everything
+** drawn since the last call at the next vertical blanking by swapping the
+** framebuffer the LTDC scans out. The regions that were drawn are then copied
+** into the other framebuffer with the DMA2D and drawing carries on there.
+** Nothing may be drawn until LCD_IsBusy() returns 'false'
+** Returns 'false' if nothing was drawn or the last frame isn't done yet
+*/
+bool LCD_Present(void) {
+    if (LCD_IsBusy()) return false;
+    LCD_Compose();
+    if (frame.count == 0) return false;
+
+    uint32_t pixels = 0;
+    for (uint32_t i = 0; i < frame.count; i++) pixels += (uint32_t)frame.regions[i].width * frame.regions[i].height;
+    frame.pixels += pixels;
+    if (pixels > frame.max_pixels) frame.max_pixels = pixels;
+
+    // the address of the framebuffer drawn into already waits in the shadow
+    // register, the LTDC loads it once it is done with the current frame
+    frame.start = Perf_Cycles();
+    frame.copied = 0;
+    frame.state = LCD_FRAME_SWAPPING;
+    HAL_LTDC_Reload(&hltdc_discovery, LTDC_RELOAD_VERTICAL_BLANKING);
+    return true;
+}
+
+/*
+** Marks the 'width' by 'height' pixels at 'x', 'y' as drawn since the last
+** LCD_Present(), for pixels written into LCD_DrawBuffer() without the
+** drawing functions
+*/
+void LCD_MarkDrawn(uint16_t x, uint16_t y, uint16_t width, uint16_t height) {
+    if (x >= BSP_LCD_GetXSize() || y >= BSP_LCD_GetYSize() || width == 0 || height == 0) return;
+    if (width > BSP_LCD_GetXSize() - x) width = BSP_LCD_GetXSize() - x;
+    if (height > BSP_LCD_GetYSize() - y) height = BSP_LCD_GetYSize() - y;
+    LCD_Rect drawn = { x, y, width, height };
+
+    LCD_AddRect(frame.regions, &frame.count, drawn);
+}
+
+/*
+** Fills the 'width' by 'height' pixels at 'x', 'y' with the background from
+** the next LCD_Present() on, the widgets in them are drawn again
+*/
+void LCD_Clear(uint16_t x, uint16_t y, uint16_t width, uint16_t height) {
+    LCD_Rect rect = { x, y, width, height };
+    LCD_Invalidate(&rect);
+}
+
+/*
+** Returns the address of the framebuffer being drawn into, it changes once a
+** frame presented by LCD_Present() is on the screen
+*/
+uint32_t LCD_DrawBuffer(void) {
+    return frame_buffers[frame.back];
+}
+
+/*
+** Prints the frames presented since the last call, the average and longest
+** time from LCD_Present() until drawing could carry on (the wait for the
+** vertical blanking and the copies), the average and most pixels drawn per
+** frame and the bytes copied between the framebuffers over UART
+*/
+void LCD_PrintStats(void) {
+    printf("lcd: %lu frames, %lu us average and %lu us longest from present to drawing, %lu KB copied\r\n",
+           frame.frames, (frame.frames == 0) ? 0 : frame.total_us / frame.frames, frame.max_us, frame.bytes / 1024);
+    printf("lcd: %lu pixels average and %lu pixels most drawn per frame\r\n",
+           (frame.frames == 0) ? 0 : frame.pixels / frame.frames, frame.max_pixels);
+    frame.frames = 0;
+    frame.total_us = 0;
+    frame.max_us = 0;
+    frame.pixels = 0;
+    frame.max_pixels = 0;
+    frame.bytes = 0;
+}
+
+/*
+** Callback called by the LTDC interrupt once the shadow registers were loaded
+** at the vertical blanking, the framebuffer presented is now on the screen
+*/
+void HAL_LTDC_ReloadEventCallback(LTDC_HandleTypeDef *hltdc) {
+    if (frame.state == LCD_FRAME_SWAPPING) frame.state = LCD_FRAME_SWAPPED;
+}
+
+#ifdef LCD_BENCHMARK
+/*
+** Times a copy of the whole screen to SDRAM and back with the DMA2D, a fill
+** of the whole screen and a present of the whole screen, then prints the
+** bytes moved and the throughput of each over UART next to the bytes the
+** LTDC reads per frame. Build with and without -DLCD_RGB565 to compare them
+*/
+void LCD_Benchmark(void) {
+    uint32_t frame_size = BSP_LCD_GetXSize() * BSP_LCD_GetYSize() * LCD_BYTES_PER_PIXEL;
+
+    uint32_t start = Perf_Cycles();
+    LCD_SaveScreen();
+    while (LCD_IsBusy());
+    uint32_t copy_us = Perf_CyclesToUs(Perf_Cycles() - start);
+
+    start = Perf_Cycles();
+    BSP_LCD_Clear(ui.bg);
+    uint32_t fill_us = Perf_CyclesToUs(Perf_Cycles() - start);
+
+    LCD_RestoreScreen();
+    while (LCD_IsBusy());
+
+    // waits for the vertical blanking, then copies the whole screen into
+    // the other framebuffer
+    start = Perf_Cycles();
+    LCD_Present();
+    while (LCD_IsBusy());
+    uint32_t present_us = Perf_CyclesToUs(Perf_Cycles() - start);
+
+    // a copy reads and writes every byte of the frame, the LTDC reads it
+    // once per refresh on top of that
+    printf("lcd: %u bytes per pixel, %lu KB per frame scanned out by the LTDC\r\n", LCD_BYTES_PER_PIXEL,
+           frame_size / 1024);
+    printf("lcd: screen copy %lu us (%lu MB/s), screen fill %lu us (%lu MB/s)\r\n", copy_us,
+           2 * frame_size / (copy_us + 1), fill_us, frame_size / (fill_us + 1));
+    printf("lcd: present of the whole screen %lu us\r\n", present_us);
+}
+#endif
+
+/*
+** Returns the number of characters of the current font that fit across the
+** screen
+*/
+uint32_t LCD_LineLength(void) {
+    return UI_X / BSP_LCD_GetFont()->Width;
+}
+
+/*
+** Clears the screen and draws the search keyboard
+*/
+void LCD_DrawKeyboard(void) {
+    sFONT *font = BSP_LCD_GetFont();
+
+    ui.keyboard = true;
+    BSP_LCD_Clear(ui.bg);
+    BSP_LCD_SetTextColor(ui.fg);
+    LCD_MarkDrawn(0, 0, BSP_LCD_GetXSize(), BSP_LCD_GetYSize());
+
+    for (uint32_t row = 0; row < UI_KEY_ROWS; row++) {
+        const char *keys = keyboard[row];
+        uint32_t y = UI_KEY_Y + row * UI_KEY_H;
+
+        for (uint32_t col = 0; keys[col] != '\0';) {
+            // a wide key covers all the columns it repeats over
+            uint32_t width = 1;
+            while (keys[col + width] == keys[col]) width++;
+
+            char label[2] = { keys[col], '\0' };
+            const char *text = label;
+            if (keys[col] == ' ') text = "SPACE";
+            if (keys[col] == LCD_KEY_DELETE) text = "DEL";
+            if (keys[col] == LCD_KEY_EXIT) text = "EXIT";
+
+            uint32_t x = col * UI_KEY_W;
+            uint32_t text_x = x + (width * UI_KEY_W - strlen(text) * font->Width) / 2;
+            BSP_LCD_DrawRect(x + 2, y + 2, width * UI_KEY_W - 4, UI_KEY_H - 4);
+            BSP_LCD_DisplayStringAt(text_x, y + (UI_KEY_H - font->Height) / 2, (uint8_t *)text, LEFT_MODE);
+            col += width;
+        }
+    }
+}
+
+/*
+** Displays the search 'query' and the number of 'matches', or that the search
+** index isn't 'ready' yet
+*/
+void LCD_DrawSearch(const char *query, uint32_t matches, bool ready) {
+    char buf[32] = {0};
+
+    BSP_LCD_SetTextColor(ui.bg);
+    BSP_LCD_FillRect(0, 0, UI_X, UI_RESULT_Y);
+    BSP_LCD_SetTextColor(ui.fg);
+    LCD_MarkDrawn(0, 0, BSP_LCD_GetXSize(), UI_RESULT_Y);
+
+    snprintf(buf, sizeof(buf), "FIND: %s_", query);
+    BSP_LCD_DisplayStringAt(0, 30, (uint8_t *)buf, CENTER_MODE);
+    if (ready) snprintf(buf, sizeof(buf), "%lu MATCHES", matches);
+    else snprintf(buf, sizeof(buf), "INDEXING...");
+    BSP_LCD_DisplayStringAt(0, 60, (uint8_t *)buf, CENTER_MODE);
+}
 
-    static TS_Input pressed_input = TS_INPUT_NONE;
+/*
+** Displays 'text' as search result 'row', or clears the row if 'text' is NULL
+*/
+void LCD_DrawSearchResult(uint32_t row, const char *text) {
+    uint32_t y = UI_RESULT_Y + row * UI_RESULT_H;
+
+    BSP_LCD_SetTextColor(ui.bg);
+    BSP_LCD_FillRect(0, y, UI_X, UI_RESULT_H);
+    BSP_LCD_SetTextColor(ui.fg);
+    LCD_MarkDrawn(0, y, UI_X, UI_RESULT_H);
+
+    if (text == NULL) return;
+    BSP_LCD_DisplayStringAt(10, y + (UI_RESULT_H - BSP_LCD_GetFont()->Height) / 2, (uint8_t *)text, LEFT_MODE);
+}
+
+/*
+** Waits for touches to be released, this is so weird because of "phantom"
+** presses that happen after not pressing the TS for some period of time
+** (usually 20-30 seconds). The way it works, is by waiting until the press is
+** released and then ensuring that it lasted >= X ms (via HAL SysTick)
+** Returns 'true' when a touch was released, 'x' and 'y' are where it started
+*/
+bool LCD_Touch(uint16_t *x, uint16_t *y) {
+    static bool pressed = false;
     static uint32_t pressed_time = 0;
+    static uint16_t pressed_x, pressed_y;
 
-    uint16_t x1, y1;
     BSP_TS_GetState(&TS_State);
-    if (pressed_input == TS_INPUT_NONE) {
-        if (!TS_State.touchDetected) return TS_INPUT_NONE;
+    if (!pressed) {
+        if (!TS_State.touchDetected) return false;
 
+        pressed = true;
         pressed_time = HAL_GetTick();
-        x1 = TS_State.touchX[0];
-        y1 = TS_State.touchY[0];
-
-        //Next Song
-        if (y1 < UI_NEXT_Y + (UI_NEXT_S/2) + UI_TS_LEEWAY &&
-            y1 > UI_NEXT_Y - (UI_NEXT_S/2) + UI_TS_LEEWAY &&
-            x1 < UI_NEXT_X + (UI_NEXT_S/2) + UI_TS_LEEWAY &&
-            x1 > UI_NEXT_X - (UI_NEXT_S/2) + UI_TS_LEEWAY){
-            pressed_input = TS_INPUT_SKIP;
-        }
-        //volume up
-        if ((y1 < UI_VOL_Y + UI_VOL_R + UI_TS_LEEWAY) &&
-            (y1 > UI_VOL_Y - UI_VOL_R + UI_TS_LEEWAY) &&
-            (x1 < UI_VOL_UP_X + UI_VOL_R + UI_TS_LEEWAY) &&
-            (x1 > UI_VOL_UP_X - UI_VOL_R + UI_TS_LEEWAY)) {
-            pressed_input = TS_INPUT_VOL_UP;
+        pressed_x = TS_State.touchX[0];
+        pressed_y = TS_State.touchY[0];
+        return false;
+    }
+
+    // touch has been released, if enough time has passed (the touch lasted
+    // long enough) report where it was, otherwise, ignore the touch
+    if (TS_State.touchDetected) return false;
+    pressed = false;
+    if (HAL_GetTick() - pressed_time < 25) return false;
+
+    *x = pressed_x;
+    *y = pressed_y;
+    return true;
+}
+
+/*
+** Clears the screen and draws every widget as it was last shown in the
+** colors of the UI
+*/
+void LCD_DrawScreen(void) {
+    LCD_Rect screen = { 0, 0, BSP_LCD_GetXSize(), BSP_LCD_GetYSize() };
+    LCD_Invalidate(&screen);
+    LCD_Compose();
+}
+
+/*
+** Marks 'rect' of the screen dirty, the widgets in it are drawn again by the
+** next LCD_Present()
+*/
+void LCD_Invalidate(const LCD_Rect *rect) {
+    LCD_AddRect(ui.dirty, &ui.dirty_count, *rect);
+}
+
+/*
+** Clears the dirty rectangles and draws the widgets in them again, only what
+** is inside them is drawn and marked as drawn
+*/
+void LCD_Compose(void) {
+    if (ui.dirty_count == 0 || ui.keyboard) return;
+
+    // a widget is drawn whole, so a dirty rectangle over part of one grows to
+    // cover all of it, which can make it overlap others
+    bool grown = true;
+    while (grown) {
+        grown = false;
+        for (uint32_t i = 0; i < ui.dirty_count && !grown; i++) {
+            for (uint32_t w = 0; w < UI_WIDGETS && !grown; w++) {
+                const LCD_Rect *rect = &widgets[w].rect;
+                if (!LCD_Overlaps(rect, &ui.dirty[i]) || LCD_Inside(rect, &ui.dirty[i])) continue;
+                LCD_AddRect(ui.dirty, &ui.dirty_count, *rect);
+                grown = true;
+            }
         }
-        //volume down
-        if ((y1 < UI_VOL_Y + UI_VOL_R + UI_TS_LEEWAY) &&
-            (y1 > UI_VOL_Y - UI_VOL_R + UI_TS_LEEWAY) &&
-            (x1 < UI_VOL_DN_X + UI_VOL_R + UI_TS_LEEWAY) &&
-            (x1 > UI_VOL_DN_X - UI_VOL_R + UI_TS_LEEWAY)) {
-            pressed_input = TS_INPUT_VOL_DOWN;
+    }
+
+    BSP_LCD_SetBackColor(ui.bg);
+    for (uint32_t i = 0; i < ui.dirty_count; i++) {
+        const LCD_Rect *rect = &ui.dirty[i];
+        BSP_LCD_SetTextColor(ui.bg);
+        BSP_LCD_FillRect(rect->x, rect->y, rect->width, rect->height);
+        BSP_LCD_SetTextColor(ui.fg);
+        for (uint32_t w = 0; w < UI_WIDGETS; w++) {
+            if (LCD_Inside(&widgets[w].rect, rect)) widgets[w].draw();
         }
+        LCD_MarkDrawn(rect->x, rect->y, rect->width, rect->height);
+    }
+    ui.dirty_count = 0;
+}
+
+/*
+** Starts copying 'rect' of the whole screen at 'src' to the same place in the
+** whole screen at 'dst' with the DMA2D
+** Returns 'true' if the copy started
+*/
+bool LCD_CopyRect(uint32_t src, uint32_t dst, const LCD_Rect *rect) {
+    uint32_t offset = ((uint32_t)rect->y * BSP_LCD_GetXSize() + rect->x) * LCD_BYTES_PER_PIXEL;
+
+    LCD_DMA2D_Handle.Instance                   = DMA2D;
+    LCD_DMA2D_Handle.Init.Mode                  = DMA2D_M2M;
+    LCD_DMA2D_Handle.Init.ColorMode             = LCD_DMA2D_OUTPUT;
+    LCD_DMA2D_Handle.Init.OutputOffset          = BSP_LCD_GetXSize() - rect->width;
+    LCD_DMA2D_Handle.Init.AlphaInverted         = DMA2D_REGULAR_ALPHA;
+    LCD_DMA2D_Handle.Init.RedBlueSwap           = DMA2D_RB_REGULAR;
+    LCD_DMA2D_Handle.XferCpltCallback           = NULL;
+    LCD_DMA2D_Handle.LayerCfg[1].AlphaMode      = DMA2D_NO_MODIF_ALPHA;
+    LCD_DMA2D_Handle.LayerCfg[1].InputAlpha     = 0xFF;
+    LCD_DMA2D_Handle.LayerCfg[1].InputColorMode = LCD_DMA2D_INPUT;
+    LCD_DMA2D_Handle.LayerCfg[1].InputOffset    = BSP_LCD_GetXSize() - rect->width;
+    LCD_DMA2D_Handle.LayerCfg[1].RedBlueSwap    = DMA2D_RB_REGULAR;
+    LCD_DMA2D_Handle.LayerCfg[1].AlphaInverted  = DMA2D_REGULAR_ALPHA;
+
+    if (HAL_DMA2D_Init(&LCD_DMA2D_Handle) != HAL_OK) return false;
+    if (HAL_DMA2D_ConfigLayer(&LCD_DMA2D_Handle, 1) != HAL_OK) return false;
+    return HAL_DMA2D_Start(&LCD_DMA2D_Handle, src + offset, dst + offset, rect->width, rect->height) == HAL_OK;
+}
 
-        //Pause and Play button
-        if (y1 < UI_PAUSE_PLAY_Y + (UI_PAUSE_PLAY_S/2) + UI_TS_LEEWAY &&
-            y1 > UI_PAUSE_PLAY_Y - (UI_PAUSE_PLAY_S/2) + UI_TS_LEEWAY &&
-            x1 < UI_PAUSE_PLAY_X + (UI_PAUSE_PLAY_S/2) + UI_TS_LEEWAY &&
-            x1 > UI_PAUSE_PLAY_X - (UI_PAUSE_PLAY_S/2) + UI_TS_LEEWAY) {
-            pressed_input = TS_INPUT_PAUSE_PLAY;
+/*
+** Adds 'rect' to the 'count' rectangles at 'rects', any of them it overlaps
+** are merged into it so none of them overlap. Once there are LCD_REGIONS of
+** them all of them are merged into one
+*/
+void LCD_AddRect(LCD_Rect *rects, uint32_t *count, LCD_Rect rect) {
+    // the merged rectangle can overlap ones that were checked already, so
+    // the search starts over after every merge
+    for (uint32_t i = 0; i < *count;) {
+        if (!LCD_Overlaps(&rects[i], &rect)) {
+            i++;
+            continue;
         }
+        rect = LCD_Union(&rects[i], &rect);
+        rects[i] = rects[--(*count)];
+        i = 0;
+    }
 
-        return TS_INPUT_NONE;
-
-    } else {
-        // touch has been released, if enough time has passed (the touch lasted
-        // long enough) return the corresponding value, otherwise, ignore the
-        // touch
-        if (TS_State.touchDetected) return TS_INPUT_NONE;
-        TS_Input ret_val = pressed_input;
-        pressed_input = TS_INPUT_NONE;
-        if (HAL_GetTick() - pressed_time < 25) return TS_INPUT_NONE;
-        return ret_val;
+    if (*count == LCD_REGIONS) {
+        for (uint32_t i = 0; i < *count; i++) rect = LCD_Union(&rects[i], &rect);
+        *count = 0;
     }
+    rects[(*count)++] = rect;
+}
+
+/*
+** Returns 'true' if 'inner' lies within 'outer'
+*/
+bool LCD_Inside(const LCD_Rect *inner, const LCD_Rect *outer) {
+    return inner->x >= outer->x && inner->y >= outer->y && inner->x + inner->width <= outer->x + outer->width &&
+           inner->y + inner->height <= outer->y + outer->height;
+}
+
+/*
+** Returns 'true' if 'a' and 'b' have any pixels in common
+*/
+bool LCD_Overlaps(const LCD_Rect *a, const LCD_Rect *b) {
+    return a->x < b->x + b->width && b->x < a->x + a->width && a->y < b->y + b->height && b->y < a->y + a->height;
+}
+
+/*
+** Returns the smallest rectangle holding both 'a' and 'b'
+*/
+LCD_Rect LCD_Union(const LCD_Rect *a, const LCD_Rect *b) {
+    uint32_t right = (a->x + a->width > b->x + b->width) ? a->x + a->width : b->x + b->width;
+    uint32_t bottom = (a->y + a->height > b->y + b->height) ? a->y + a->height : b->y + b->height;
+    LCD_Rect rect = { (a->x < b->x) ? a->x : b->x, (a->y < b->y) ? a->y : b->y, 0, 0 };
+    rect.width = right - rect.x;
+    rect.height = bottom - rect.y;
+    return rect;
+}
+
+void LCD_DrawTitle(void) {
+    BSP_LCD_DisplayStringAt(0, UI_TITLE_Y, (uint8_t *)ui.title, CENTER_MODE);
+}
+
+void LCD_DrawArtist(void) {
+    BSP_LCD_DisplayStringAt(0, UI_ARTIST_Y, (uint8_t *)ui.artist, CENTER_MODE);
 }
 
 void LCD_DrawVolDown(void) {
-    BSP_LCD_SetTextColor(LCD_FG);
+    BSP_LCD_SetTextColor(ui.fg);
     BSP_LCD_DrawCircle(UI_VOL_DN_X, UI_VOL_Y, UI_VOL_R);
     BSP_LCD_DrawHLine(UI_VOL_DN_X - UI_VOL_R + UI_VOL_IGAP, UI_VOL_Y, UI_VOL_LINE);
 }
 
 void LCD_DrawVolUp(void) {
-    BSP_LCD_SetTextColor(LCD_FG);
+    BSP_LCD_SetTextColor(ui.fg);
     BSP_LCD_DrawCircle(UI_VOL_UP_X, UI_VOL_Y, UI_VOL_R);
     BSP_LCD_DrawHLine(UI_VOL_UP_X - UI_VOL_R + UI_VOL_IGAP, UI_VOL_Y, UI_VOL_LINE);
     BSP_LCD_DrawVLine(UI_VOL_UP_X, UI_VOL_Y - UI_VOL_R + UI_VOL_IGAP, UI_VOL_LINE);
 }
 
 void LCD_DrawVol(void) {
-    BSP_LCD_SetTextColor(LCD_FG);
+    if (Music_GetVolume() == ui.volume) return;
+    ui.volume = Music_GetVolume();
+    LCD_Invalidate(&widgets[UI_WIDGET_VOL].rect);
+}
+
+void LCD_DrawVolText(void) {
     char buf[10] = {0};
-    snprintf(buf, sizeof(buf), "VOL: %3ld", Music_GetVolume());
-    BSP_LCD_DisplayStringAt(0, 570, (uint8_t *)buf, CENTER_MODE);
+    snprintf(buf, sizeof(buf), "VOL: %3ld", ui.volume);
+    BSP_LCD_DisplayStringAt(0, UI_VOL_TEXT_Y, (uint8_t *)buf, CENTER_MODE);
 }
 
 void LCD_DrawPlay(void) {
+    ui.paused = true;
+    LCD_Invalidate(&widgets[UI_WIDGET_PAUSE_PLAY].rect);
+}
+
+void LCD_DrawPause(void) {
+    ui.paused = false;
+    LCD_Invalidate(&widgets[UI_WIDGET_PAUSE_PLAY].rect);
+}
+
+void LCD_DrawPausePlay(void) {
     // equilateral triangle
-    const Point points[] = {
+    const Point play[] = {
         {.X = UI_PAUSE_PLAY_X - (uint16_t)((UI_PAUSE_PLAY_S*SQRT_3)/4),
          .Y = UI_PAUSE_PLAY_Y - (UI_PAUSE_PLAY_S/2)},
         {.X = UI_PAUSE_PLAY_X + (uint16_t)((UI_PAUSE_PLAY_S*SQRT_3)/4),
@@ -201,18 +959,8 @@ void LCD_DrawPlay(void) {
         {.X = UI_PAUSE_PLAY_X - (uint16_t)((UI_PAUSE_PLAY_S*SQRT_3)/4),
          .Y = UI_PAUSE_PLAY_Y + (UI_PAUSE_PLAY_S/2)},
     };
-
-    BSP_LCD_SetTextColor(LCD_BG);
-    BSP_LCD_FillRect(UI_PAUSE_PLAY_X - (UI_PAUSE_PLAY_S/2) - 1,
-                     UI_PAUSE_PLAY_Y - (UI_PAUSE_PLAY_S/2) - 1,
-                     UI_PAUSE_PLAY_S + 2, UI_PAUSE_PLAY_S + 2);
-    BSP_LCD_SetTextColor(LCD_FG);
-    BSP_LCD_FillPolygon((pPoint)points, sizeof(points) / sizeof(points[0]));
-}
-
-void LCD_DrawPause(void) {
     // two rectangles next to each other
-    const Point points1[] = {
+    const Point pause1[] = {
         {.X = UI_PAUSE_PLAY_X - (UI_PAUSE_PLAY_S/2),
          .Y = UI_PAUSE_PLAY_Y - (UI_PAUSE_PLAY_S/2)},
         {.X = UI_PAUSE_PLAY_X - (UI_PAUSE_PLAY_S/2) + (UI_PAUSE_PLAY_S/3),
@@ -222,7 +970,7 @@ void LCD_DrawPause(void) {
         {.X = UI_PAUSE_PLAY_X - (UI_PAUSE_PLAY_S/2),
          .Y = UI_PAUSE_PLAY_Y + (UI_PAUSE_PLAY_S/2)},
     };
-    const Point points2[] = {
+    const Point pause2[] = {
         {.X = UI_PAUSE_PLAY_X + (UI_PAUSE_PLAY_S/2) - (UI_PAUSE_PLAY_S/3),
          .Y = UI_PAUSE_PLAY_Y - (UI_PAUSE_PLAY_S/2)},
         {.X = UI_PAUSE_PLAY_X + (UI_PAUSE_PLAY_S/2),
@@ -233,13 +981,12 @@ void LCD_DrawPause(void) {
          .Y = UI_PAUSE_PLAY_Y + (UI_PAUSE_PLAY_S/2)},
     };
 
-    BSP_LCD_SetTextColor(LCD_BG);
-    BSP_LCD_FillRect(UI_PAUSE_PLAY_X - (UI_PAUSE_PLAY_S/2) - 1,
-                     UI_PAUSE_PLAY_Y - (UI_PAUSE_PLAY_S/2) - 1,
-                     UI_PAUSE_PLAY_S + 2, UI_PAUSE_PLAY_S + 2);
-    BSP_LCD_SetTextColor(LCD_FG);
-    BSP_LCD_FillPolygon((pPoint)points1, sizeof(points1) / sizeof(points1[0]));
-    BSP_LCD_FillPolygon((pPoint)points2, sizeof(points2) / sizeof(points2[0]));
+    if (ui.paused) {
+        BSP_LCD_FillPolygon((pPoint)play, sizeof(play) / sizeof(play[0]));
+        return;
+    }
+    BSP_LCD_FillPolygon((pPoint)pause1, sizeof(pause1) / sizeof(pause1[0]));
+    BSP_LCD_FillPolygon((pPoint)pause2, sizeof(pause2) / sizeof(pause2[0]));
 }
 
 void LCD_DrawNext(void) {
@@ -266,3 +1013,86 @@ void LCD_DrawNext(void) {
     BSP_LCD_FillPolygon((pPoint)points1, sizeof(points1) / sizeof(points1[0]));
     BSP_LCD_FillPolygon((pPoint)points2, sizeof(points2) / sizeof(points2[0]));
 }
+
+void LCD_DrawPrev(void) {
+    // the next symbol mirrored
+    const Point points1[] = {
+        {.X = UI_PREV_X + (uint16_t)((UI_PREV_S*SQRT_3)/4),
+         .Y = UI_PREV_Y - (UI_PREV_S/2)},
+        {.X = UI_PREV_X - (uint16_t)((UI_PREV_S*SQRT_3)/4),
+         .Y = UI_PREV_Y},
+        {.X = UI_PREV_X + (uint16_t)((UI_PREV_S*SQRT_3)/4),
+         .Y = UI_PREV_Y + (UI_PREV_S/2)},
+    };
+    const Point points2[] = {
+        {.X = UI_PREV_X - (UI_PREV_S/2),
+         .Y = UI_PREV_Y - (UI_PREV_S/2)},
+        {.X = UI_PREV_X - (UI_PREV_S/2) + (UI_PREV_S/4),
+         .Y = UI_PREV_Y - (UI_PREV_S/2)},
+        {.X = UI_PREV_X - (UI_PREV_S/2) + (UI_PREV_S/4),
+         .Y = UI_PREV_Y + (UI_PREV_S/2)},
+        {.X = UI_PREV_X - (UI_PREV_S/2),
+         .Y = UI_PREV_Y + (UI_PREV_S/2)},
+    };
+
+    BSP_LCD_FillPolygon((pPoint)points1, sizeof(points1) / sizeof(points1[0]));
+    BSP_LCD_FillPolygon((pPoint)points2, sizeof(points2) / sizeof(points2[0]));
+}
+
+void LCD_DrawSearchButton(void) {
+    BSP_LCD_SetTextColor(ui.fg);
+    BSP_LCD_DrawRect(UI_X/2 - UI_SEARCH_W/2, UI_SEARCH_Y - UI_SEARCH_H/2, UI_SEARCH_W, UI_SEARCH_H);
+    BSP_LCD_DisplayStringAt(0, UI_SEARCH_Y - 12, (uint8_t *)"SEARCH", CENTER_MODE);
+}
+
+void LCD_DrawSortButton(void) {
+    uint32_t width = strlen(ui.sort) * UI_TEXT_W;
+    BSP_LCD_SetTextColor(ui.fg);
+    BSP_LCD_DrawRect(UI_SORT_X - UI_SORT_W/2, UI_SORT_Y - UI_SORT_H/2, UI_SORT_W, UI_SORT_H);
+    BSP_LCD_DisplayStringAt(UI_SORT_X - width/2, UI_SORT_Y - UI_TEXT_H/2, (uint8_t *)ui.sort, LEFT_MODE);
+}
+
+void LCD_DrawSort(const char *label) {
+    snprintf(ui.sort, sizeof(ui.sort), "%s", label);
+    LCD_Invalidate(&widgets[UI_WIDGET_SORT].rect);
+}
+
+void LCD_DrawShuffle(bool on) {
+    ui.shuffle = on;
+    LCD_Invalidate(&widgets[UI_WIDGET_SHUFFLE].rect);
+}
+
+void LCD_DrawShuffleText(void) {
+    BSP_LCD_DisplayStringAt(0, UI_SHUFFLE_Y - UI_TEXT_H/2, (uint8_t *)(ui.shuffle ? "SHUFFLE ON " : "SHUFFLE OFF"),
+                            CENTER_MODE);
+}
+
+#if _USE_DISKIO_STATS == 1
+void LCD_DrawDiskStats(void) {
+    const DISKIO_STATS *stats = disk_get_stats(DISKIO_CLASS_SONG, DISKIO_OP_READ);
+
+    // bar heights are log2 of the counts so that rare, slow reads still show up
+    uint32_t max = 1;
+    for (int i = 0; i < DISKIO_HIST_BUCKETS; i++) {
+        uint32_t bits = (stats->hist[i] == 0) ? 0 : 32 - __builtin_clz(stats->hist[i]);
+        if (bits > max) max = bits;
+    }
+
+    for (int i = 0; i < DISKIO_HIST_BUCKETS; i++) {
+        uint32_t bits = (stats->hist[i] == 0) ? 0 : 32 - __builtin_clz(stats->hist[i]);
+        ui.bars[i] = bits * UI_HIST_H / max;
+    }
+    ui.stats = true;
+    LCD_Invalidate(&widgets[UI_WIDGET_DISK_STATS].rect);
+}
+
+void LCD_DrawHistogram(void) {
+    if (!ui.stats) return;
+
+    BSP_LCD_DrawHLine(0, UI_HIST_Y, UI_X);
+    for (int i = 0; i < DISKIO_HIST_BUCKETS; i++) {
+        if (ui.bars[i] == 0) continue;
+        BSP_LCD_FillRect(i * UI_HIST_W + 1, UI_HIST_Y - ui.bars[i], UI_HIST_W - 2, ui.bars[i]);
+    }
+}
+#endif
@@ -1,24 +1,61 @@
 /* clang-format off */
 
 #include "init.h"
+#include "catalog.h"
+#include "diskio.h"
 #include "ff.h"
 #include "ff_gen_drv.h"
 #include "cover.h"
 #include "lcd.h"
 #include "music.h"
+#include "perf.h"
+#include "playlist.h"
 #include "sd_diskio.h"
+#include "shuffle.h"
 #include <stdio.h>
 #include <string.h>
 
+// playlist in the root of the card, played instead of the whole catalog
+#define PLAYLIST_FILE "/PLAYLIST.M3U"
+// longest search query
+#define SEARCH_MAX_QUERY 20
+// longest line of text drawn, in bytes
+#define TEXT_MAX_LEN 64
+
+// labels of the sort button for each CATALOG_SORT
+static const char *const sort_names[] = { "NAME", "TITLE", "ARTIST" };
+
 FATFS sdFatFs;
 
-static void play_song(FILINFO *file_info);
-static void display_title_and_artist(FIL *meta);
-static uint32_t str_end_on_nl(char *str);
-static void str_add_dots(char *str, int len);
+// position in the play order, when shuffling it is shuffled before it is used
+static uint32_t position = 0;
+static bool shuffle = false;
+static uint32_t shuffle_seed = 0;
+// what the play order is sorted by, and whether it changed during the song
+static CATALOG_SORT sort_by = CATALOG_SORT_NAME;
+static bool resorted = false;
+// catalog generation the playlist was resolved against
+static uint32_t playlist_generation = UINT32_MAX;
+// song picked by a search, played before carrying on with the play order
+static uint32_t search_track = CATALOG_NONE;
+
+static TS_Input play_song(uint32_t track);
+static bool process_cover(FIL *cover, uint32_t track, uint32_t generation);
+static bool prefetch_cover(FIL *cover, uint32_t track);
+static void toggle_shuffle(uint32_t seed);
+static void next_sort(void);
+static void reposition(uint32_t track);
+static uint32_t search_song(void);
+static void display_search(const char *query, const Catalog_Search *search, bool ready);
+static uint32_t order_count(void);
+static uint32_t order_track(uint32_t position);
+static uint32_t next_track(void);
+static void display_title_and_artist(uint32_t track);
+static void str_fit(char *dst, const char *src, uint32_t width);
 
 int main(void){
 	Sys_Init();
+	Perf_Init();
 
 	printf("\033[2J\033[;H");
 	printf("\033c");
@@ -28,6 +65,12 @@ int main(void){
 	Music_Init();
 	Cover_Init();
 	LCD_Init();
+#ifdef LCD_BENCHMARK
+	LCD_Benchmark();
+#endif
+#ifdef COVER_BENCHMARK
+	Cover_Benchmark();
+#endif
 
     // Link FATFS Driver
     FATFS_LinkDriver(&SD_Driver, "0:/");
@@ -35,63 +78,127 @@ int main(void){
     // Mount the disk
     f_mount(&sdFatFs, "0:/", 0);
 
-	// Go through files in root directory
-    FRESULT res;
-    DIR dir;
-    FILINFO file_info;
-    res = f_opendir(&dir, "/");
+	// Load (or build) the catalog of songs, then play through it in order
+	while (!Catalog_Init(&sdFatFs) || Catalog_Count() == 0);
+#ifdef CATALOG_BENCHMARK
+	Catalog_Benchmark();
+#endif
+	LCD_DrawSort(sort_names[sort_by]);
+
 	while (1) {
-		res = f_readdir(&dir, &file_info);
-		// at end of files, close and reopen directory to get back to beginning
-		if (res != FR_OK || file_info.fname[0] == 0) {
-			f_closedir(&dir);
-			f_opendir(&dir, "/");
-			continue;
+		// a rescan moves the songs of the catalog, find the playlist's again
+		if (playlist_generation != Catalog_Generation()) {
+			Playlist_Load(PLAYLIST_FILE);
+			playlist_generation = Catalog_Generation();
+		}
+
+		// a rescan can change the number of songs at any time
+		uint32_t count = order_count();
+		position %= count;
+
+		uint32_t shuffled = shuffle ? Shuffle_Position(position, count, shuffle_seed) : position;
+		uint32_t track = order_track(shuffled);
+		if (search_track != CATALOG_NONE) {
+			track = search_track;
+			search_track = CATALOG_NONE;
 		}
-		// file is not a directory, ignore
-		if ((file_info.fattrib & AM_DIR) == 0) continue;
 
-		// file is a directory, play the song in the directory
-		play_song(&file_info);
+		TS_Input input = play_song(track);
+		if (resorted) reposition(track);
+		if (input == TS_INPUT_PREV) position += count - 1;
+		else if (input != TS_INPUT_SEARCH) position++;
 	}
 }
 
-void play_song(FILINFO *file_info) {
-	char path[strlen(file_info->fname) + 15];
-	FIL cover, meta, song;
+TS_Input play_song(uint32_t track) {
+	const Catalog_Entry *entry = Catalog_Get(track);
+	FIL cover, song;
+	FIL *cover_file = NULL;
+	// the next song's cover is decoded into the cache once this one's is done
+	bool prefetching = false;
+	bool prefetched = false;
+	// song of the cover being processed, its color goes into its entry unless
+	// a rescan replaced the catalog meanwhile
+	uint32_t cover_track = track;
+	uint32_t generation = Catalog_Generation();
 
-	// create path for album cover
-	strcpy(path, file_info->fname);
-	strcat(path, "/cover.jpg");
-	// process album cover
-	if (f_open(&cover, path, FA_READ) != FR_OK) return;
-	Cover_Display(&cover);
-	f_close(&cover);
+	// a track container or song.raw, the index knows where everything in it is
+	// so no header has to be read. FLAC audio would play as noise, its song
+	// is skipped until there is a decoder
+	if (entry->flags & CATALOG_FLAG_COMPRESSED) return TS_INPUT_NONE;
+	if (Catalog_OpenSong(track, &song) != FR_OK) return TS_INPUT_NONE;
+
+	// the UI takes on the colors of the cover if it was shown before, or
+	// prefetched, the cover and title are drawn over it once the last frame
+	// of the previous song is on the screen
+	while (LCD_IsBusy());
+	LCD_SetTheme(entry->color);
+
+	// process album cover, a cached one is just copied to the screen. One
+	// embedded in the song's file is decoded in place through a second handle
+	// so it doesn't move the song's file position
+	uint64_t key = Catalog_SongKey(track);
+	bool decoding = Cover_StartCached(key);
+	if (!decoding) {
+		// a song without a cover still plays, the cover of the one before
+		// is cleared instead
+		if (Catalog_OpenCover(track, &cover) == FR_OK) {
+			decoding = (entry->cover_size != 0) ? Cover_Start(&cover, entry->cover_offset, entry->cover_size, key)
+			                                    : Cover_Start(&cover, 0, f_size(&cover), key);
+			if (decoding) cover_file = &cover;
+			else f_close(&cover);
+		}
+		if (!decoding) Cover_Blank();
+	}
 
 	// display song title and artist
-	strcpy(path, file_info->fname);
-	strcat(path, "/meta.txt");
-	if (f_open(&meta, path, FA_READ) != FR_OK) return;
-	display_title_and_artist(&meta);
-	f_close(&meta);
-
-	// create path for song
-	strcpy(path, file_info->fname);
-	strcat(path, "/song.raw");
-	// process song
-	if (f_open(&song, path, FA_READ) != FR_OK) return;
-	Music_Start(&song);
-
-	bool skip = false;
-	while (Music_Process() && !skip) {
-		switch (LCD_GetUserInput()) {
+	display_title_and_artist(track);
+
+	// process song, only the audio part of its file. The cover keeps decoding
+	// in the time left between refills of the audio buffer
+#ifdef MUSIC_BENCHMARK
+	Music_Benchmark(&song);
+#endif
+	FSIZE_t end = entry->song_size < f_size(&song) ? entry->song_size : f_size(&song);
+	FSIZE_t audio = entry->audio_offset < end ? entry->audio_offset : end;
+	Music_StartAt(&song, audio, end - audio);
+
+	TS_Input skip = TS_INPUT_NONE;
+	while (Music_Process() && skip == TS_INPUT_NONE) {
+		// touches wait while the last frame can't be drawn over yet
+		switch (LCD_IsBusy() ? TS_INPUT_NONE : LCD_GetUserInput()) {
 			case TS_INPUT_NONE: break;
 			case TS_INPUT_PAUSE_PLAY:
 				Music_PauseResume();
 				if (Music_IsPaused()) LCD_DrawPlay();
 				else LCD_DrawPause();
 				break;
-			case TS_INPUT_SKIP: skip = true; break;
+			case TS_INPUT_SKIP: skip = TS_INPUT_SKIP; break;
+			case TS_INPUT_PREV: skip = TS_INPUT_PREV; break;
+			case TS_INPUT_SHUFFLE:
+				// the same seed always gives the same order, build with
+				// -DSHUFFLE_SEED=<seed> to play a printed one again
+#ifdef SHUFFLE_SEED
+				toggle_shuffle(SHUFFLE_SEED);
+#else
+				toggle_shuffle(HAL_GetTick());
+#endif
+				LCD_DrawShuffle(shuffle);
+				break;
+			case TS_INPUT_SORT:
+				next_sort();
+				LCD_DrawSort(sort_names[sort_by]);
+				break;
+			case TS_INPUT_SEARCH:
+				// the keyboard is drawn over the cover, it has to be done first.
+				// A prefetch just carries on after the search
+				while (decoding && !prefetching) {
+					decoding = process_cover(cover_file, cover_track, generation);
+					Music_Process();
+				}
+				search_track = search_song();
+				if (search_track != CATALOG_NONE) skip = TS_INPUT_SEARCH;
+				break;
 			case TS_INPUT_VOL_UP:
 				Music_IncreaseVolume();
 				LCD_DrawVol();
@@ -101,60 +208,226 @@ void play_song(FILINFO *file_info) {
 				LCD_DrawVol();
 				break;
 		}
+
+		// finish the cover, then decode the next song's cover into the cache
+		// and keep the library up to date in whatever time is left before the
+		// audio buffer needs refilling
+		if (decoding && Music_TimeToRefill() > COVER_SLICE_US) {
+			decoding = process_cover(cover_file, cover_track, generation);
+		} else if (!decoding && !prefetched && Music_TimeToRefill() > CATALOG_SLICE_US) {
+			prefetched = true;
+			cover_track = next_track();
+			prefetching = decoding = prefetch_cover(&cover, cover_track);
+			cover_file = &cover;
+		} else if (!decoding && Music_TimeToRefill() > CATALOG_SLICE_US) {
+			Catalog_Process();
+		}
+
+		// whatever was drawn is shown at the next vertical blanking, but not
+		// before the cover is done as it is decoded into the same framebuffer
+		if (!decoding || prefetching) LCD_Present();
 	}
 
 	if (!Music_IsPaused()) Music_PauseResume();
 
+	// a song can be skipped before its cover is shown, or before the next
+	// song's cover is prefetched
+	if (decoding) {
+		Cover_Stop();
+		if (cover_file != NULL) f_close(cover_file);
+	}
 	f_close(&song);
+	LCD_PrintStats();
+
+#if _USE_DISKIO_STATS == 1
+	disk_print_stats();
+	while (LCD_IsBusy());
+	LCD_DrawDiskStats();
+#endif
+
+	return skip;
 }
 
-void display_title_and_artist(FIL *meta) {
-	char buffer[25] = {0};
-	unsigned bytes_read = 0;
+bool process_cover(FIL *cover, uint32_t track, uint32_t generation) {
+	DISKIO_CLASS cls = disk_set_class(DISKIO_CLASS_COVER);
+	bool decoding = Cover_Process();
+	disk_set_class(cls);
 
-	// read in chunk and find first new line (for title)
-	f_read(meta, buffer, sizeof(buffer), &bytes_read);
-	uint32_t x = str_end_on_nl(buffer);
-	str_add_dots(buffer, 20);
-	LCD_SongTitle(buffer);
+	if (decoding) return true;
+	if (cover != NULL) f_close(cover);
 
-	// seek back number of bytes not used in title
-	f_lseek(meta, bytes_read - x);
-	// read until new line
-	char c = 0;
-	while (c != '\n') f_read(meta, &c, sizeof(c), &bytes_read);
+	// keep the cover's color with its song so its next play starts in it
+	if (Cover_Color() != 0 && Catalog_Generation() == generation) Catalog_SetColor(track, Cover_Color());
+	return false;
+}
 
-	// reset buffer to all 0
-	memset(buffer, 0, sizeof(buffer));
+bool prefetch_cover(FIL *cover, uint32_t track) {
+	const Catalog_Entry *entry = Catalog_Get(track);
+	uint64_t key = Catalog_SongKey(track);
+	if (Cover_IsCached(key)) return false;
 
-	// read in rest, limit song artist to 20 characters
-	f_read(meta, buffer, sizeof(buffer), &bytes_read);
-	str_end_on_nl(buffer);
-	str_add_dots(buffer, 20);
-	LCD_SongArtist(buffer);
+	DISKIO_CLASS cls = disk_set_class(DISKIO_CLASS_COVER);
+	FRESULT res = Catalog_OpenCover(track, cover);
+	bool started = false;
+	if (res == FR_OK) {
+		started = (entry->cover_size != 0) ? Cover_Prefetch(cover, entry->cover_offset, entry->cover_size, key)
+		                                   : Cover_Prefetch(cover, 0, f_size(cover), key);
+		if (!started) f_close(cover);
+	}
+	disk_set_class(cls);
+	return started;
+}
+
+void toggle_shuffle(uint32_t seed) {
+	uint32_t count = order_count();
+	position %= count;
+
+	// keep playing the same song, just move its position in or out of the
+	// shuffled order so next and previous carry on from it
+	if (shuffle) {
+		position = Shuffle_Position(position, count, shuffle_seed);
+	} else {
+		shuffle_seed = seed;
+		position = Shuffle_Inverse(position, count, shuffle_seed);
+		printf("shuffle: seed %lu\r\n", shuffle_seed);
+	}
+	shuffle = !shuffle;
+}
 
-	// read until end of file
-	while (!f_eof(meta)) f_read(meta, &c, sizeof(c), &bytes_read);
-	memset(buffer, 0, sizeof(buffer));
+void next_sort(void) {
+	// the new order is sorted in the background while the song plays
+	sort_by = (sort_by == CATALOG_SORT_ARTIST) ? CATALOG_SORT_NAME : sort_by + 1;
+	Catalog_Sort(sort_by);
+	resorted = true;
 }
 
-uint32_t str_end_on_nl(char *str) {
-	char *end = strchr(str, '\n');
-	if (end == NULL) return 0;
+void reposition(uint32_t track) {
+	resorted = false;
+	if (Playlist_Count() > 0) return;
 
-	uint32_t x = strlen(end);
-	memset(end, 0, x);
-	return x;
+	// the music is stopped between songs, so the rest of the sort can be done
+	// at once. The song keeps its place so next and previous carry on from it
+	while (Catalog_IsSorting()) Catalog_Process();
+	uint32_t sorted = Catalog_Position(track);
+	if (sorted == CATALOG_NONE) return;
+	position = shuffle ? Shuffle_Inverse(sorted, order_count(), shuffle_seed) : sorted;
 }
 
-void str_add_dots(char *str, int len) {
-	if (len < 3) return;
+uint32_t search_song(void) {
+	char query[SEARCH_MAX_QUERY + 1] = {0};
+	uint32_t len = 0;
+	uint32_t track = CATALOG_NONE;
+	Catalog_Search search;
 
-	uint32_t slen = strlen(str);
-	if (slen < len) return;
+	// the keyboard covers the whole screen, keep the music going while the
+	// screen is copied out of the way
+	LCD_SaveScreen();
+	while (LCD_IsBusy()) Music_Process();
+	LCD_DrawKeyboard();
 
-	char *end = str + len;
-	*end = '\0';
-	end -= 3;
-	memcpy(end, "...", 3);
+	bool ready = Catalog_SearchStart(&search);
+	display_search(query, &search, ready);
+
+	while (Music_Process()) {
+		int key = LCD_IsBusy() ? LCD_KEY_NONE : LCD_GetKey();
+
+		if (key == LCD_KEY_EXIT) break;
+		if (key >= LCD_KEY_RESULT) {
+			if ((uint32_t)(key - LCD_KEY_RESULT) >= search.count) continue;
+			track = Catalog_SearchResult(&search, key - LCD_KEY_RESULT);
+			break;
+		}
+
+		if (key != LCD_KEY_NONE) {
+			uint32_t start = Perf_Cycles();
+			if (key == LCD_KEY_DELETE) {
+				// a shorter query can match more, so start over
+				if (len > 0) query[--len] = '\0';
+				ready = Catalog_SearchStart(&search) && Catalog_SearchNarrow(&search, query, len);
+			} else if (len < SEARCH_MAX_QUERY) {
+				query[len++] = key;
+				// the index may have been made since the search started
+				if (!ready) ready = Catalog_SearchStart(&search);
+				ready = ready && Catalog_SearchNarrow(&search, query, len);
+			}
+			printf("search: \"%s\" %lu matches in %lu us\r\n", query, search.count, Perf_CyclesToUs(Perf_Cycles() - start));
+			display_search(query, &search, ready);
+		}
+
+		if (Music_TimeToRefill() > CATALOG_SLICE_US) Catalog_Process();
+		LCD_Present();
+	}
+
+	while (LCD_IsBusy()) Music_Process();
+	LCD_RestoreScreen();
+	while (LCD_IsBusy()) Music_Process();
+	return track;
+}
+
+void display_search(const char *query, const Catalog_Search *search, bool ready) {
+	char line[2 * TEXT_MAX_LEN];
+	char buffer[TEXT_MAX_LEN];
+
+	LCD_DrawSearch(query, search->count, ready);
+	for (uint32_t row = 0; row < LCD_SEARCH_RESULTS; row++) {
+		if (row >= search->count) {
+			LCD_DrawSearchResult(row, NULL);
+			continue;
+		}
+
+		const Catalog_Entry *entry = Catalog_Get(Catalog_SearchResult(search, row));
+		snprintf(line, sizeof(line), "%s - %s", Catalog_String(entry->title), Catalog_String(entry->artist));
+		// results are indented a little from the edge of the screen
+		str_fit(buffer, line, LCD_LineLength() - 1);
+		LCD_DrawSearchResult(row, buffer);
+	}
+}
+
+uint32_t order_count(void) {
+	if (Playlist_Count() > 0) return Playlist_Count();
+	return Catalog_Count();
+}
+
+uint32_t order_track(uint32_t position) {
+	// the playlist if there is one, otherwise the whole catalog in sorted order
+	if (Playlist_Count() > 0) return Playlist_Get(position);
+	return Catalog_Sorted(position);
+}
+
+uint32_t next_track(void) {
+	// a song picked by a search doesn't move the position, so whatever is
+	// playing the song after it in the order comes next
+	uint32_t count = order_count();
+	uint32_t next = (position + 1) % count;
+	return order_track(shuffle ? Shuffle_Position(next, count, shuffle_seed) : next);
+}
+
+void display_title_and_artist(uint32_t track) {
+	const Catalog_Entry *entry = Catalog_Get(track);
+	char buffer[TEXT_MAX_LEN];
+
+	// limit song title and artist to the width of the screen
+	str_fit(buffer, Catalog_String(entry->title), LCD_LineLength());
+	LCD_SongTitle(buffer);
+
+	str_fit(buffer, Catalog_String(entry->artist), LCD_LineLength());
+	LCD_SongArtist(buffer);
+}
+
+void str_fit(char *dst, const char *src, uint32_t width) {
+	// the LCD fonts only have ASCII, every other UTF-8 character is drawn
+	// as a single '?' so it still takes up one character of the width
+	if (width > TEXT_MAX_LEN - 1) width = TEXT_MAX_LEN - 1;
+
+	uint32_t len = 0;
+	for (const uint8_t *c = (const uint8_t *)src; *c != '\0'; c++) {
+		if ((*c & 0xC0) == 0x80) continue;
+		if (len == width) {
+			// too long, end with dots in place of the last characters
+			if (width >= 3) memcpy(dst + width - 3, "...", 3);
+			break;
+		}
+		dst[len++] = (*c >= ' ' && *c < 0x7F) ? *c : '?';
+	}
+	dst[len] = '\0';
 }
@@ -0,0 +1,579 @@
+/* clang-format off */
+
+#include "meta.h"
+
+#include "ff.h"
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// text encodings of ID3v2 frames
+#define META_ISO_8859_1 0
+#define META_UTF_16     1
+#define META_UTF_16BE   2
+#define META_UTF_8      3
+
+// APIC and PICTURE type of the front cover
+#define META_FRONT_COVER 3
+
+// the reads of the tags of a song, the first read is kept when the second is
+// done so strings in it stay valid
+typedef struct {
+    FIL *file;
+    char *buffer;       // META_TAG_BUFFER bytes
+    const uint8_t *data; // bytes of the last read
+    FSIZE_t start;      // offset of the last read in the file
+    uint32_t len;       // number of bytes of the last read
+    uint32_t reads;     // number of reads done
+    bool front;         // the cover found is a front cover
+} Meta_Tags;
+
+// ID3v2 text frames and the meta.txt keys they are parsed as, the strings of
+// the first three are kept in the text part of the buffer, as are those of
+// TXXX frames named after them
+static const struct {
+    char id[4];
+    const char *key;
+} meta_frames[] = {
+    { "TIT2", "title" },
+    { "TPE1", "artist" },
+    { "TALB", "album" },
+    { "TRCK", "track" },
+    { "TYER", "year" },
+    { "TDRC", "year" },
+};
+
+static bool meta_field(Meta_Info *info, Meta_String key, Meta_String value);
+static Meta_String meta_trim(const char *str, uint32_t len);
+static bool meta_key(Meta_String key, const char *name);
+static uint32_t meta_number(Meta_String value);
+static int32_t meta_gain(Meta_String value);
+static const uint8_t *meta_bytes(Meta_Tags *tags, FSIZE_t offset, uint32_t len);
+static void meta_read_id3(Meta_Tags *tags, const uint8_t *header, Meta_Info *info);
+static void meta_id3_text(Meta_Tags *tags, const char *id, FSIZE_t offset, uint32_t size, Meta_Info *info);
+static void meta_id3_picture(Meta_Tags *tags, FSIZE_t offset, uint32_t size, Meta_Info *info);
+static void meta_read_flac(Meta_Tags *tags, Meta_Info *info);
+static void meta_flac_comments(Meta_Tags *tags, FSIZE_t offset, uint32_t size, Meta_Info *info);
+static void meta_flac_picture(Meta_Tags *tags, FSIZE_t offset, uint32_t size, Meta_Info *info);
+static uint32_t meta_text_len(uint8_t encoding, const uint8_t *str, uint32_t len);
+static Meta_String meta_text(uint8_t encoding, const uint8_t *str, uint32_t len, char *dst, uint32_t size);
+static char *meta_text_slot(Meta_Tags *tags, Meta_String key);
+static uint32_t meta_be32(const uint8_t *bytes);
+static uint32_t meta_le32(const uint8_t *bytes);
+static uint32_t meta_syncsafe(const uint8_t *bytes);
+
+/*
+** Parses the 'len' bytes of a meta.txt in 'buf' into 'info'. Lines are
+** "key=value" with the keys title, artist, album, track, year and gain (in dB,
+** e.g. "-6.5 dB"), keys ignore letter case and lines starting with '#' are
+** comments. A file without any of the keys is read the old way, title on the
+** first line and artist on the second. Lines can end in "\n" or "\r\n", a
+** UTF-8 byte order mark is skipped and values are kept as they are
+*/
+void Meta_Parse(const char *buf, uint32_t len, Meta_Info *info) {
+    const char *end = buf + len;
+    Meta_String lines[2] = {{0}};
+    uint32_t line_count = 0;
+    bool keyed = false;
+
+    memset(info, 0, sizeof(*info));
+    if (len >= 3 && memcmp(buf, "\xEF\xBB\xBF", 3) == 0) buf += 3;
+
+    for (const char *line = buf; line < end;) {
+        const char *nl = memchr(line, '\n', end - line);
+        const char *line_end = nl ? nl : end;
+        uint32_t line_len = line_end - line;
+        if (line_len > 0 && line[line_len - 1] == '\r') line_len--;
+
+        // the first two lines in case this turns out to be an old style file
+        if (line_count < 2) lines[line_count++] = (Meta_String){ line, line_len };
+
+        const char *eq = memchr(line, '=', line_len);
+        if (line_len > 0 && line[0] != '#' && eq != NULL) {
+            Meta_String key = meta_trim(line, eq - line);
+            Meta_String value = meta_trim(eq + 1, line + line_len - eq - 1);
+            bool known = meta_field(info, key, value);
+            keyed = keyed || known;
+        }
+
+        line = nl ? nl + 1 : end;
+    }
+
+    if (!keyed) {
+        info->title = lines[0];
+        info->artist = lines[1];
+    }
+}
+
+/*
+** Returns the length of the longest start of the 'len' bytes of UTF-8 in
+** 'str' that is at most 'max' bytes and doesn't cut a character in half
+*/
+uint32_t Meta_Clip(const char *str, uint32_t len, uint32_t max) {
+    if (len <= max) return len;
+
+    // back up over continuation bytes (10xxxxxx) to the start of the
+    // character that doesn't fit
+    while (max > 0 && ((uint8_t)str[max] & 0xC0) == 0x80) max--;
+    return max;
+}
+
+/*
+** Reads the ID3v2 tag or the FLAC metadata blocks at the start of the song
+** in 'file' into 'info' with one or two reads of META_TAG_READ bytes. The
+** title, artist, album, track number, year and replay gain are taken from the
+** text frames or Vorbis comments and are converted to UTF-8 in 'buffer', which
+** must hold META_TAG_BUFFER bytes and be kept for as long as the strings are
+** used. A jpeg or png in an APIC frame or PICTURE block is found by its
+** offset in the file, a front cover is preferred, so it can be decoded in
+** place. The audio after FLAC metadata blocks is FLAC frames, not PCM, so
+** the song is marked as compressed
+** Returns 'false' if the song has no tags
+*/
+bool Meta_ReadTags(FIL *file, char *buffer, Meta_Info *info) {
+    Meta_Tags tags = { .file = file, .buffer = buffer };
+
+    memset(info, 0, sizeof(*info));
+    const uint8_t *header = meta_bytes(&tags, 0, 10);
+    if (header == NULL) return false;
+
+    if (memcmp(header, "ID3", 3) == 0) meta_read_id3(&tags, header, info);
+    else if (memcmp(header, "fLaC", 4) == 0) meta_read_flac(&tags, info);
+    else return false;
+    return true;
+}
+
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/* HELPERS                                                                    */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+
+/*
+** Sets the field of 'info' named by 'key' to 'value', the Vorbis comment
+** names of the track number, year and replay gain work as well
+** Returns 'false' if there is no such field
+*/
+bool meta_field(Meta_Info *info, Meta_String key, Meta_String value) {
+    if (meta_key(key, "title")) info->title = value;
+    else if (meta_key(key, "artist")) info->artist = value;
+    else if (meta_key(key, "album")) info->album = value;
+    else if (meta_key(key, "track") || meta_key(key, "tracknumber")) info->track = meta_number(value);
+    else if (meta_key(key, "year") || meta_key(key, "date")) info->year = meta_number(value);
+    else if (meta_key(key, "gain") || meta_key(key, "replaygain_track_gain")) info->gain = meta_gain(value);
+    else return false;
+    return true;
+}
+
+/*
+** Returns the 'len' bytes at 'str' without spaces and tabs at either end
+*/
+Meta_String meta_trim(const char *str, uint32_t len) {
+    while (len > 0 && (*str == ' ' || *str == '\t')) {
+        str++;
+        len--;
+    }
+    while (len > 0 && (str[len - 1] == ' ' || str[len - 1] == '\t')) len--;
+    return (Meta_String){ str, len };
+}
+
+/*
+** Returns 'true' if 'key' is 'name', ignoring letter case
+*/
+bool meta_key(Meta_String key, const char *name) {
+    if (key.len != strlen(name)) return false;
+    for (uint32_t i = 0; i < key.len; i++) {
+        if (tolower((uint8_t)key.str[i]) != name[i]) return false;
+    }
+    return true;
+}
+
+/*
+** Returns the number at the start of 'value', so "3/12" is track 3
+*/
+uint32_t meta_number(Meta_String value) {
+    uint32_t number = 0;
+    for (uint32_t i = 0; i < value.len && isdigit((uint8_t)value.str[i]); i++) {
+        number = number * 10 + (value.str[i] - '0');
+    }
+    return number;
+}
+
+/*
+** Returns the gain in hundredths of a dB of a 'value' like "-6.5 dB"
+*/
+int32_t meta_gain(Meta_String value) {
+    int32_t whole = 0;
+    int32_t hundredths = 0;
+    int32_t scale = 100;
+    bool negative = false;
+    bool fraction = false;
+    uint32_t i = 0;
+
+    if (i < value.len && (value.str[i] == '-' || value.str[i] == '+')) negative = value.str[i++] == '-';
+    for (; i < value.len; i++) {
+        char c = value.str[i];
+        if (c == '.' && !fraction) {
+            fraction = true;
+        } else if (!isdigit((uint8_t)c)) {
+            break;
+        } else if (!fraction) {
+            whole = whole * 10 + (c - '0');
+        } else if (scale > 1) {
+            scale /= 10;
+            hundredths += (c - '0') * scale;
+        }
+    }
+
+    int32_t gain = whole * 100 + hundredths;
+    return negative ? -gain : gain;
+}
+
+/*
+** Returns the 'len' bytes at 'offset' in the tagged file, they are read if
+** they aren't part of the last read, which has to be the first or second
+** Returns NULL if the bytes can't be read or more reads would be needed
+*/
+const uint8_t *meta_bytes(Meta_Tags *tags, FSIZE_t offset, uint32_t len) {
+    UINT bytes_read = 0;
+
+    // lengths come from the file, so nothing here may wrap around
+    if (offset >= tags->start && offset - tags->start <= tags->len && len <= tags->len - (offset - tags->start)) {
+        return tags->data + (offset - tags->start);
+    }
+    if (len > META_TAG_READ || tags->reads == 2) return NULL;
+
+    uint8_t *data = (uint8_t *)tags->buffer + tags->reads * META_TAG_READ;
+    if (f_lseek(tags->file, offset) != FR_OK) return NULL;
+    if (f_read(tags->file, data, META_TAG_READ, &bytes_read) != FR_OK) return NULL;
+
+    tags->reads++;
+    tags->data = data;
+    tags->start = offset;
+    tags->len = bytes_read;
+    return len <= bytes_read ? data : NULL;
+}
+
+/*
+** Reads the frames of the ID3v2.3 or ID3v2.4 tag with the 10 byte 'header'
+*/
+void meta_read_id3(Meta_Tags *tags, const uint8_t *header, Meta_Info *info) {
+    uint8_t version = header[3];
+    uint8_t flags = header[5];
+    FSIZE_t end = 10 + meta_syncsafe(&header[6]);
+
+    // the audio is after the tag and its footer
+    info->audio = end + ((version == 4 && (flags & 0x10)) ? 10 : 0);
+
+    // ID3v2.2 has different frames, and a tag that was unsynchronised as a
+    // whole would have to be copied to be read
+    if (version < 3 || version > 4 || (flags & 0x80)) return;
+
+    FSIZE_t offset = 10;
+    if (flags & 0x40) {
+        const uint8_t *extended = meta_bytes(tags, offset, 4);
+        if (extended == NULL) return;
+        offset += (version == 4) ? meta_syncsafe(extended) : 4 + meta_be32(extended);
+    }
+
+    while (offset + 10 <= end) {
+        const uint8_t *frame = meta_bytes(tags, offset, 10);
+        // padding fills the rest of the tag
+        if (frame == NULL || frame[0] == 0) break;
+
+        char id[4];
+        memcpy(id, frame, sizeof(id));
+        uint32_t size = (version == 4) ? meta_syncsafe(&frame[4]) : meta_be32(&frame[4]);
+        // compressed, encrypted, grouped or unsynchronised frames are skipped
+        bool plain = (frame[9] & ((version == 4) ? 0x4F : 0xE0)) == 0;
+        FSIZE_t data = offset + 10;
+        if (size > end - data) break;
+        offset = data + size;
+        if (!plain || size == 0) continue;
+
+        if (memcmp(id, "APIC", 4) == 0) meta_id3_picture(tags, data, size, info);
+        else if (id[0] == 'T') meta_id3_text(tags, id, data, size, info);
+    }
+}
+
+/*
+** Reads the text frame 'id' of 'size' bytes at 'offset', a TXXX frame whose
+** description is the name of a field sets that field
+*/
+void meta_id3_text(Meta_Tags *tags, const char *id, FSIZE_t offset, uint32_t size, Meta_Info *info) {
+    char key[32];
+    char value[32];
+    const uint8_t *text = meta_bytes(tags, offset, size);
+    if (text == NULL) return;
+
+    // every text frame starts with the encoding of its text
+    uint8_t encoding = text[0];
+    text++;
+    size--;
+
+    if (memcmp(id, "TXXX", 4) == 0) {
+        // the description and the value are both in the frame's encoding,
+        // the description is terminated
+        uint32_t len = meta_text_len(encoding, text, size);
+        uint32_t skip = len + ((encoding == META_UTF_16 || encoding == META_UTF_16BE) ? 2 : 1);
+        if (skip > size) return;
+        Meta_String name = meta_text(encoding, text, len, key, sizeof(key));
+        name = meta_trim(name.str, name.len);
+
+        // a title, artist or album has to outlive this frame
+        char *dst = meta_text_slot(tags, name);
+        uint32_t dst_size = (dst != NULL) ? META_TAG_TEXT : sizeof(value);
+        Meta_String text_value = meta_text(encoding, text + skip, size - skip, (dst != NULL) ? dst : value, dst_size);
+        meta_field(info, name, meta_trim(text_value.str, text_value.len));
+        return;
+    }
+
+    for (uint32_t i = 0; i < sizeof(meta_frames) / sizeof(meta_frames[0]); i++) {
+        if (memcmp(id, meta_frames[i].id, 4) != 0) continue;
+
+        // title, artist and album are kept, everything else is a number
+        Meta_String name = { meta_frames[i].key, strlen(meta_frames[i].key) };
+        char *dst = meta_text_slot(tags, name);
+        uint32_t dst_size = (dst != NULL) ? META_TAG_TEXT : sizeof(value);
+        meta_field(info, name, meta_text(encoding, text, size, (dst != NULL) ? dst : value, dst_size));
+        return;
+    }
+}
+
+/*
+** Returns where in the text part of the buffer of 'tags' the field named
+** 'key' is kept, or NULL if it is a number that is parsed straight away
+*/
+char *meta_text_slot(Meta_Tags *tags, Meta_String key) {
+    for (uint32_t i = 0; i < 3; i++) {
+        if (meta_key(key, meta_frames[i].key)) return tags->buffer + 2 * META_TAG_READ + i * META_TAG_TEXT;
+    }
+    return NULL;
+}
+
+/*
+** Reads the APIC frame of 'size' bytes at 'offset', the picture is used as
+** the cover if it is a jpeg or png and there is no front cover yet
+*/
+void meta_id3_picture(Meta_Tags *tags, FSIZE_t offset, uint32_t size, Meta_Info *info) {
+    // the encoding, mime type, picture type and description before the
+    // picture, a longer description than this isn't worth a read
+    uint32_t len = (size < 2 * META_TAG_TEXT) ? size : 2 * META_TAG_TEXT;
+    const uint8_t *frame = meta_bytes(tags, offset, len);
+    if (frame == NULL || len < 4) return;
+
+    uint8_t encoding = frame[0];
+    uint32_t pos = 1 + meta_text_len(META_ISO_8859_1, &frame[1], len - 1) + 1;
+    if (pos >= len) return;
+    uint8_t type = frame[pos++];
+    pos += meta_text_len(encoding, &frame[pos], len - pos);
+    pos += (encoding == META_UTF_16 || encoding == META_UTF_16BE) ? 2 : 1;
+
+    // only jpegs and pngs can be decoded, whatever the mime type says
+    if (pos + 4 > len) return;
+    bool jpeg = frame[pos] == 0xFF && frame[pos + 1] == 0xD8;
+    bool png = memcmp(&frame[pos], "\x89PNG", 4) == 0;
+    if (!jpeg && !png) return;
+    if (info->cover_size != 0 && (tags->front || type != META_FRONT_COVER)) return;
+
+    info->cover = offset + pos;
+    info->cover_size = size - pos;
+    tags->front = type == META_FRONT_COVER;
+}
+
+/*
+** Reads the metadata blocks of a FLAC stream, the audio frames follow them
+*/
+void meta_read_flac(Meta_Tags *tags, Meta_Info *info) {
+    FSIZE_t offset = 4;
+    bool last = false;
+
+    while (!last) {
+        const uint8_t *block = meta_bytes(tags, offset, 4);
+        if (block == NULL) return;
+
+        // the top bit marks the last block, the rest is its type
+        last = (block[0] & 0x80) != 0;
+        uint8_t type = block[0] & 0x7F;
+        uint32_t size = (block[1] << 16) | (block[2] << 8) | block[3];
+        FSIZE_t data = offset + 4;
+        offset = data + size;
+
+        if (type == 4) meta_flac_comments(tags, data, size, info);
+        else if (type == 6) meta_flac_picture(tags, data, size, info);
+    }
+
+    info->audio = offset;
+    info->compressed = true;
+}
+
+/*
+** Reads the VORBIS_COMMENT block of 'size' bytes at 'offset', each comment is
+** a "NAME=value" in UTF-8 so the strings are used straight from the read
+*/
+void meta_flac_comments(Meta_Tags *tags, FSIZE_t offset, uint32_t size, Meta_Info *info) {
+    FSIZE_t end = offset + size;
+
+    // the vendor string comes first, then the number of comments
+    const uint8_t *bytes = meta_bytes(tags, offset, 4);
+    if (bytes == NULL || size < 4 || meta_le32(bytes) > end - offset - 4) return;
+    offset += 4 + meta_le32(bytes);
+    if ((bytes = meta_bytes(tags, offset, 4)) == NULL) return;
+    uint32_t count = meta_le32(bytes);
+    offset += 4;
+
+    for (uint32_t i = 0; i < count && offset + 4 <= end; i++) {
+        if ((bytes = meta_bytes(tags, offset, 4)) == NULL) return;
+        uint32_t len = meta_le32(bytes);
+        offset += 4;
+        if (len > end - offset) return;
+
+        // comments too long for a read, like lyrics, are skipped
+        const char *comment = (const char *)meta_bytes(tags, offset, len);
+        offset += len;
+        if (comment == NULL) continue;
+
+        const char *eq = memchr(comment, '=', len);
+        if (eq == NULL) continue;
+        meta_field(info, meta_trim(comment, eq - comment), meta_trim(eq + 1, comment + len - eq - 1));
+    }
+}
+
+/*
+** Reads the PICTURE block of 'size' bytes at 'offset', the picture is used as
+** the cover if it is a jpeg or png and there is no front cover yet
+*/
+void meta_flac_picture(Meta_Tags *tags, FSIZE_t offset, uint32_t size, Meta_Info *info) {
+    FSIZE_t end = offset + size;
+
+    // picture type and length of the mime type. Every length is checked
+    // against what is left of the block, so none of them can wrap around
+    const uint8_t *bytes = meta_bytes(tags, offset, 8);
+    if (bytes == NULL || size < 8) return;
+    uint32_t type = meta_be32(bytes);
+    uint32_t mime_len = meta_be32(&bytes[4]);
+    offset += 8;
+
+    if (mime_len > end - offset) return;
+    const char *mime = (const char *)meta_bytes(tags, offset, mime_len);
+    if (mime == NULL) return;
+    Meta_String mime_type = { mime, mime_len };
+    bool jpeg = meta_key(mime_type, "image/jpeg") || meta_key(mime_type, "image/jpg");
+    if (!jpeg && !meta_key(mime_type, "image/png")) return;
+    offset += mime_len;
+
+    // the description, then width, height, depth, colors and picture length
+    if (end - offset < 4 || (bytes = meta_bytes(tags, offset, 4)) == NULL) return;
+    if (meta_be32(bytes) > end - offset - 4) return;
+    offset += 4 + meta_be32(bytes);
+    if (end - offset < 20 || (bytes = meta_bytes(tags, offset, 20)) == NULL) return;
+    uint32_t len = meta_be32(&bytes[16]);
+    offset += 20;
+
+    if (len > end - offset) return;
+    if (info->cover_size != 0 && (tags->front || type != META_FRONT_COVER)) return;
+
+    info->cover = offset;
+    info->cover_size = len;
+    tags->front = type == META_FRONT_COVER;
+}
+
+/*
+** Returns the number of bytes of the 'len' bytes of text at 'str' in
+** 'encoding' before its terminator
+*/
+uint32_t meta_text_len(uint8_t encoding, const uint8_t *str, uint32_t len) {
+    uint32_t i = 0;
+
+    if (encoding == META_UTF_16 || encoding == META_UTF_16BE) {
+        // UTF-16 is terminated by a whole 16-bit zero
+        while (i + 1 < len && (str[i] != 0 || str[i + 1] != 0)) i += 2;
+        return (i + 1 < len) ? i : len;
+    }
+
+    while (i < len && str[i] != 0) i++;
+    return i;
+}
+
+/*
+** Converts the 'len' bytes of text at 'str' in 'encoding' to UTF-8 in 'dst',
+** which holds 'size' bytes. Only the first of several terminated strings is
+** converted and characters that don't fit are left out
+** Returns the converted text, which is also terminated
+*/
+Meta_String meta_text(uint8_t encoding, const uint8_t *str, uint32_t len, char *dst, uint32_t size) {
+    bool big_endian = encoding == META_UTF_16BE;
+    uint32_t out = 0;
+    uint32_t i = 0;
+
+    len = meta_text_len(encoding, str, len);
+
+    // UTF-16 starts with a byte order mark, UTF-16BE doesn't
+    if (encoding == META_UTF_16 && len >= 2) {
+        big_endian = str[0] == 0xFE && str[1] == 0xFF;
+        if ((str[0] == 0xFE && str[1] == 0xFF) || (str[0] == 0xFF && str[1] == 0xFE)) i = 2;
+    }
+
+    while (i < len) {
+        uint32_t code;
+        if (encoding == META_UTF_8) {
+            // already UTF-8, just don't cut a character in half
+            uint32_t n = Meta_Clip((const char *)&str[i], len - i, size - 1 - out);
+            memcpy(&dst[out], &str[i], n);
+            out += n;
+            break;
+        } else if (encoding == META_ISO_8859_1) {
+            code = str[i++];
+        } else {
+            if (i + 1 >= len) break;
+            code = big_endian ? (str[i] << 8) | str[i + 1] : (str[i + 1] << 8) | str[i];
+            i += 2;
+            // a surrogate pair for a character outside the first plane
+            if (code >= 0xD800 && code < 0xDC00 && i + 1 < len) {
+                uint32_t low = big_endian ? (str[i] << 8) | str[i + 1] : (str[i + 1] << 8) | str[i];
+                if (low >= 0xDC00 && low < 0xE000) {
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    i += 2;
+                }
+            }
+            if (code >= 0xD800 && code < 0xE000) code = 0xFFFD;
+        }
+
+        uint32_t n = (code < 0x80) ? 1 : (code < 0x800) ? 2 : (code < 0x10000) ? 3 : 4;
+        if (out + n > size - 1) break;
+        if (n == 1) {
+            dst[out++] = code;
+        } else {
+            // lead byte with the length in its top bits, then 6 bits per byte
+            dst[out++] = (uint8_t)(0xF00 >> n) | (code >> (6 * (n - 1)));
+            for (uint32_t shift = 6 * (n - 1); shift > 0; shift -= 6) {
+                dst[out++] = 0x80 | ((code >> (shift - 6)) & 0x3F);
+            }
+        }
+    }
+
+    dst[out] = '\0';
+    return (Meta_String){ dst, out };
+}
+
+/*
+** Returns the big-endian 32-bit number at 'bytes'
+*/
+uint32_t meta_be32(const uint8_t *bytes) {
+    return ((uint32_t)bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+}
+
+/*
+** Returns the little-endian 32-bit number at 'bytes'
+*/
+uint32_t meta_le32(const uint8_t *bytes) {
+    return ((uint32_t)bytes[3] << 24) | (bytes[2] << 16) | (bytes[1] << 8) | bytes[0];
+}
+
+/*
+** Returns the ID3v2 "syncsafe" number at 'bytes', 7 bits in each byte
+*/
+uint32_t meta_syncsafe(const uint8_t *bytes) {
+    return ((bytes[0] & 0x7F) << 21) | ((bytes[1] & 0x7F) << 14) | ((bytes[2] & 0x7F) << 7) | (bytes[3] & 0x7F);
+}
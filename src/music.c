@@ -3,12 +3,21 @@
 #include "music.h"
 
 #include "stm32f769i_discovery_audio.h"
+#include "diskio.h"
 #include "ff.h"
+#include "perf.h"
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
 
 #define MUSIC_BUFFER_SIZE 2048
+#define MUSIC_SECTOR_SIZE _MIN_SS
+// 16-bit stereo samples played per second
+#define MUSIC_SAMPLE_RATE (44100 * 2)
+
+// SAI handle of the audio output, owned by the BSP
+extern SAI_HandleTypeDef haudio_out_sai;
 
 // playback volume
 static volatile uint32_t music_volume = 20;
@@ -18,12 +27,22 @@ static enum { MUSIC_IDLE, MUSIC_INIT, MUSIC_PLAY, MUSIC_DONE } music_state = MUS
 static enum { PLAY_RESUMED, PLAY_PAUSED } play_state = PLAY_RESUMED;
 // buffer for holding data
 static struct {
-    uint8_t data[MUSIC_BUFFER_SIZE];
+    uint8_t data[MUSIC_BUFFER_SIZE] __attribute__((aligned(4)));
     volatile enum { BUFFER_FULL, BUFFER_FIRST, BUFFER_SECOND } state;
     volatile enum { LAST_NONE, LAST_HALF, LAST_FULL } done;
     FIL *file;
+    // when the file is a single run of clusters it is read straight from the
+    // disk, 'sector' is the next sector to read. 'remaining' is the number of
+    // bytes of the song that have not been read yet
+    bool contiguous;
+    DWORD sector;
+    FSIZE_t remaining;
 } music_buffer;
 
+static bool music_find_contiguous(FIL *file, DWORD *sector);
+static unsigned int music_read(uint8_t *buf, unsigned int len);
+static bool music_eof(void);
+
 /*
 ** Initialize the audio output using the BSP
 ** Returns 'true' if initialization happens successfully
@@ -44,6 +63,15 @@ bool Music_Init(void) {
 ** Returns 'true' if music starts successfully
 */
 bool Music_Start(FIL *file) {
+    return Music_StartAt(file, 0, f_size(file));
+}
+
+/*
+** Start playing the 'size' bytes of music data at 'offset' in 'file', like the
+** audio after the tags of a song
+** Returns 'true' if music starts successfully
+*/
+bool Music_StartAt(FIL *file, FSIZE_t offset, FSIZE_t size) {
     if (music_state == MUSIC_IDLE) {
         return false;
     }
@@ -51,8 +79,17 @@ bool Music_Start(FIL *file) {
     music_buffer.state = BUFFER_FULL;
     music_buffer.file = file;
     music_buffer.done = LAST_NONE;
-    unsigned int bytes_read = 0;
-    f_read(music_buffer.file, music_buffer.data, MUSIC_BUFFER_SIZE, &bytes_read);
+    music_buffer.contiguous = music_find_contiguous(file, &music_buffer.sector);
+    music_buffer.remaining = size;
+
+    // raw sector reads need the audio to start on a sector
+    if (music_buffer.contiguous && offset % MUSIC_SECTOR_SIZE == 0) {
+        music_buffer.sector += offset / MUSIC_SECTOR_SIZE;
+    } else {
+        music_buffer.contiguous = false;
+        if (f_lseek(file, offset) != FR_OK) return false;
+    }
+    unsigned int bytes_read = music_read(music_buffer.data, MUSIC_BUFFER_SIZE);
 
     if (bytes_read > 0) {
         if (Music_IsPaused()) Music_PauseResume();
@@ -149,8 +186,8 @@ bool Music_Process(void) {
         if (buf == NULL) break;
 
         // read data, if not all data was read, check for end of file
-        f_read(music_buffer.file, buf, MUSIC_BUFFER_SIZE/2, &bytes_read);
-        if (f_eof(music_buffer.file) && music_buffer.done == LAST_NONE) music_buffer.done = last;
+        bytes_read = music_read(buf, MUSIC_BUFFER_SIZE/2);
+        if (music_eof() && music_buffer.done == LAST_NONE) music_buffer.done = last;
         memset(buf+bytes_read, 0, MUSIC_BUFFER_SIZE/2 - bytes_read);
         music_buffer.state = BUFFER_FULL;
 
@@ -169,6 +206,136 @@ bool Music_Process(void) {
     return true;
 }
 
+/*
+** Returns the time in microseconds until Music_Process() has to refill the
+** audio buffer, 0 if a refill is already due
+*/
+uint32_t Music_TimeToRefill(void) {
+    if (music_state != MUSIC_PLAY || play_state == PLAY_PAUSED) return UINT32_MAX;
+    if (music_buffer.state != BUFFER_FULL) return 0;
+
+    // the DMA counts down the samples left in the whole buffer, what is left
+    // of the half it is playing is how long until the next callback
+    uint32_t samples = __HAL_DMA_GET_COUNTER(haudio_out_sai.hdmatx) % (MUSIC_BUFFER_SIZE / 4);
+    return samples * 1000000 / MUSIC_SAMPLE_RATE;
+}
+
+#ifdef MUSIC_BENCHMARK
+/*
+** Reads all of 'file' once through FatFs and once with raw sector reads (if
+** the file is contiguous) and prints the throughput and cycles spent for each
+** over UART. The file is rewound afterwards
+*/
+void Music_Benchmark(FIL *file) {
+    unsigned int bytes_read = 0;
+    uint32_t total = 0;
+    uint32_t start = Perf_Cycles();
+
+    music_buffer.file = file;
+    music_buffer.contiguous = false;
+    music_buffer.remaining = f_size(file);
+    f_lseek(file, 0);
+    do {
+        bytes_read = music_read(music_buffer.data, MUSIC_BUFFER_SIZE/2);
+        total += bytes_read;
+    } while (bytes_read == MUSIC_BUFFER_SIZE/2);
+    uint32_t fatfs_us = Perf_CyclesToUs(Perf_Cycles() - start);
+
+    printf("music: f_read %lu bytes in %lu us (%lu KB/s, %lu cycles/KB)\r\n",
+           total, fatfs_us, (uint32_t)((uint64_t)total * 1000 / (fatfs_us + 1)),
+           (uint32_t)((uint64_t)fatfs_us * (SystemCoreClock / 1000000) * 1024 / (total + 1)));
+
+    f_lseek(file, 0);
+    if (!music_find_contiguous(file, &music_buffer.sector)) {
+        printf("music: file is fragmented, no raw sector path\r\n");
+        return;
+    }
+
+    music_buffer.contiguous = true;
+    music_buffer.remaining = f_size(file);
+    total = 0;
+    start = Perf_Cycles();
+    do {
+        bytes_read = music_read(music_buffer.data, MUSIC_BUFFER_SIZE/2);
+        total += bytes_read;
+    } while (bytes_read == MUSIC_BUFFER_SIZE/2);
+    uint32_t raw_us = Perf_CyclesToUs(Perf_Cycles() - start);
+    music_buffer.contiguous = false;
+
+    printf("music: raw    %lu bytes in %lu us (%lu KB/s, %lu cycles/KB)\r\n",
+           total, raw_us, (uint32_t)((uint64_t)total * 1000 / (raw_us + 1)),
+           (uint32_t)((uint64_t)raw_us * (SystemCoreClock / 1000000) * 1024 / (total + 1)));
+}
+#endif
+
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/* HELPERS                                                                    */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+
+/*
+** Checks whether 'file' is stored in a single run of clusters, if it is,
+** 'sector' is set to the first sector of the file
+** Returns 'true' if the file can be read with raw sector reads
+*/
+bool music_find_contiguous(FIL *file, DWORD *sector) {
+    // a single fragment needs: table size, cluster count, start cluster and
+    // the terminator, any more fragments and FatFs reports it can't fit
+    DWORD clmt[4] = { sizeof(clmt) / sizeof(clmt[0]) };
+    FATFS *fs = file->obj.fs;
+
+    if (file->obj.sclust < 2) return false;
+
+    file->cltbl = clmt;
+    FRESULT res = f_lseek(file, CREATE_LINKMAP);
+    file->cltbl = NULL;
+    if (res != FR_OK) return false;
+
+    *sector = fs->database + (clmt[2] - 2) * fs->csize;
+    return true;
+}
+
+/*
+** Reads up to 'len' bytes of the song into 'buf', 'len' must be a multiple of
+** the sector size. Contiguous files are read directly from the disk, skipping
+** FatFs entirely, everything else goes through f_read()
+** Returns the number of bytes of the song that were read
+*/
+unsigned int music_read(uint8_t *buf, unsigned int len) {
+    unsigned int bytes_read = 0;
+    DISKIO_CLASS cls = disk_set_class(DISKIO_CLASS_SONG);
+
+    if (!music_buffer.contiguous) {
+        if (music_buffer.remaining < len) len = music_buffer.remaining;
+        f_read(music_buffer.file, buf, len, &bytes_read);
+        music_buffer.remaining -= bytes_read;
+        // a short read means the file ended early or couldn't be read
+        if (bytes_read < len) music_buffer.remaining = 0;
+    } else if (music_buffer.remaining > 0) {
+        // don't read sectors past the end of the file, they may belong to another
+        bytes_read = (music_buffer.remaining < len) ? music_buffer.remaining : len;
+        UINT count = (bytes_read + MUSIC_SECTOR_SIZE - 1) / MUSIC_SECTOR_SIZE;
+        if (disk_read(music_buffer.file->obj.fs->drv, buf, music_buffer.sector, count) == RES_OK) {
+            music_buffer.sector += count;
+            music_buffer.remaining -= bytes_read;
+        } else {
+            music_buffer.remaining = 0;
+            bytes_read = 0;
+        }
+    }
+
+    disk_set_class(cls);
+    return bytes_read;
+}
+
+/*
+** Returns 'true' if all of the song has been read
+*/
+bool music_eof(void) {
+    return music_buffer.remaining == 0;
+}
+
 /*----------------------------------------------------------------------------*/
 /*                                                                            */
 /* BSP CALLBACKS                                                              */
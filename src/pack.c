@@ -0,0 +1,46 @@
+/* clang-format off */
+
+#include "pack.h"
+
+#include "ff.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+static bool pack_region(FIL *file, uint32_t offset, uint32_t size);
+
+/*
+** Reads the first PACK_HEADER_READ bytes of the container in 'file' into
+** 'buffer' and copies its header to 'header', every region is checked to lie
+** within the file and the audio to start on a PACK_ALIGN boundary
+** Returns 'false' if 'file' isn't a usable container
+*/
+bool Pack_ReadHeader(FIL *file, uint8_t *buffer, Pack_Header *header) {
+    UINT bytes_read = 0;
+
+    if (f_lseek(file, 0) != FR_OK) return false;
+    if (f_read(file, buffer, PACK_HEADER_READ, &bytes_read) != FR_OK) return false;
+    if (bytes_read < sizeof(Pack_Header)) return false;
+
+    memcpy(header, buffer, sizeof(*header));
+    if (memcmp(header->magic, PACK_MAGIC, sizeof(header->magic)) != 0) return false;
+    if (header->version != PACK_VERSION || header->header_size != sizeof(Pack_Header)) return false;
+
+    return pack_region(file, header->meta, header->meta_size) &&
+           pack_region(file, header->cover, header->cover_size) &&
+           pack_region(file, header->audio, header->audio_size) &&
+           header->audio % PACK_ALIGN == 0;
+}
+
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/* HELPERS                                                                    */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+
+/*
+** Returns 'true' if the 'size' bytes at 'offset' are all within 'file'
+*/
+bool pack_region(FIL *file, uint32_t offset, uint32_t size) {
+    return offset <= f_size(file) && size <= f_size(file) - offset;
+}
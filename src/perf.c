@@ -0,0 +1,32 @@
+/* clang-format off */
+
+#include "perf.h"
+
+#include "diskio.h"
+
+/*
+** Enables the DWT cycle counter used for all timing measurements
+*/
+void Perf_Init(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    // the M7 needs the DWT to be unlocked before it can be written to
+    DWT->LAR = 0xC5ACCE55;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+#if _USE_DISKIO_STATS == 1
+/*
+** Timestamp of the disk statistics, the DWT cycle counter
+*/
+DWORD disk_timestamp(void) {
+    return Perf_Cycles();
+}
+
+/*
+** Returns the microseconds passed since the disk statistics timestamp 'start'
+*/
+DWORD disk_elapsed_us(DWORD start) {
+    return Perf_CyclesToUs(Perf_Cycles() - start);
+}
+#endif
@@ -0,0 +1,126 @@
+/* clang-format off */
+
+#include "playlist.h"
+
+#include "catalog.h"
+#include "diskio.h"
+#include "ff.h"
+#include "perf.h"
+#include "sdram.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// most songs in a playlist
+#define PLAYLIST_MAX_ENTRIES (SDRAM_PLAYLIST_SIZE / sizeof(uint32_t))
+// bytes of the file read at a time
+#define PLAYLIST_BUFFER_SIZE 512
+// longest line kept, longer ones can't name a directory of the catalog anyway
+#define PLAYLIST_MAX_LINE    256
+
+// catalog indexes of the songs in the playlist
+static uint32_t *const playlist = (uint32_t *)SDRAM_PLAYLIST;
+static uint32_t playlist_count = 0;
+
+static void playlist_add(const char *line, uint32_t len);
+
+/*
+** Loads the M3U/M3U8 playlist 'path' in one pass through a small buffer,
+** each entry is resolved to a song of the catalog by the name of its directory
+** (the first part of its path) and entries that aren't in the catalog are
+** skipped
+** Returns the number of songs in the playlist, 0 if it couldn't be read
+*/
+uint32_t Playlist_Load(const char *path) {
+    uint8_t buffer[PLAYLIST_BUFFER_SIZE];
+    char line[PLAYLIST_MAX_LINE];
+    uint32_t len = 0;
+    uint32_t lines = 0;
+    bool too_long = false;
+    UINT bytes_read = 0;
+    FIL file;
+
+    playlist_count = 0;
+    if (f_open(&file, path, FA_READ) != FR_OK) return 0;
+
+    uint32_t start = Perf_Cycles();
+    DISKIO_CLASS cls = disk_set_class(DISKIO_CLASS_META);
+    do {
+        if (f_read(&file, buffer, sizeof(buffer), &bytes_read) != FR_OK) break;
+
+        for (UINT i = 0; i < bytes_read; i++) {
+            char c = buffer[i];
+            if (c != '\n' && c != '\r') {
+                if (len < sizeof(line)) line[len++] = c;
+                else too_long = true;
+                continue;
+            }
+
+            if (len > 0 && !too_long) playlist_add(line, len);
+            if (len > 0) lines++;
+            len = 0;
+            too_long = false;
+        }
+    } while (bytes_read == sizeof(buffer));
+    // the last line doesn't need a line break
+    if (len > 0 && !too_long) playlist_add(line, len);
+    if (len > 0) lines++;
+    disk_set_class(cls);
+
+    f_close(&file);
+
+    printf("playlist: %lu of %lu lines are songs, loaded in %lu us\r\n",
+           playlist_count, lines, Perf_CyclesToUs(Perf_Cycles() - start));
+    return playlist_count;
+}
+
+/*
+** Returns the number of songs in the playlist
+*/
+uint32_t Playlist_Count(void) {
+    return playlist_count;
+}
+
+/*
+** Returns the catalog index of the song at 'position' in the playlist
+*/
+uint32_t Playlist_Get(uint32_t position) {
+    return playlist[position];
+}
+
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/* HELPERS                                                                    */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+
+/*
+** Adds the song named by the 'len' characters of playlist line 'line', lines
+** like "#EXTINF:..." are comments and paths can use either slash, start at the
+** root or a drive, and end in a file of the directory or the directory itself
+*/
+void playlist_add(const char *line, uint32_t len) {
+    const char *end = line + len;
+
+    // byte order mark of an M3U8 file
+    if (len >= 3 && memcmp(line, "\xEF\xBB\xBF", 3) == 0) line += 3;
+    if (line == end || *line == '#' || playlist_count == PLAYLIST_MAX_ENTRIES) return;
+
+    // "0:" or "C:" drive
+    if (end - line >= 2 && line[1] == ':') line += 2;
+
+    // the first part of the path that isn't "." names the directory
+    while (line < end) {
+        const char *part = line;
+        while (line < end && *line != '/' && *line != '\\') line++;
+        uint32_t part_len = line - part;
+        if (line < end) line++;
+
+        if (part_len == 0 || (part_len == 1 && *part == '.')) continue;
+
+        uint32_t index = Catalog_Find(part, part_len);
+        if (index != CATALOG_NONE) playlist[playlist_count++] = index;
+        return;
+    }
+}
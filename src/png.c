@@ -0,0 +1,1020 @@
+/* clang-format off */
+
+#include "png.h"
+
+#include "ff.h"
+#include "lcd.h"
+#include "sdram.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// bytes of the png read at a time, whole sectors so every read after the
+// first one starts on a sector and FatFs reads straight into the buffer
+#define PNG_INPUT_SIZE (8 * _MIN_SS)
+// the inflate window, the farthest back a match can reach
+#define PNG_WINDOW_SIZE SDRAM_PNG_WINDOW_SIZE
+#define PNG_WINDOW_MASK (PNG_WINDOW_SIZE - 1)
+// bytes kept for each of the two rows, a filter byte and the widest row
+#define PNG_ROW_SIZE (SDRAM_PNG_ROWS_SIZE / 2)
+// codes up to this long are decoded with a single table lookup
+#define PNG_FAST_BITS 9
+// bytes past the end of the image data the bit buffer may read ahead, a
+// stream that needs more than that is broken
+#define PNG_OVERRUN 4
+
+_Static_assert(PNG_ROW_SIZE >= 1 + PNG_MAX_WIDTH * 8, "a row of 16-bit RGBA must fit");
+
+/*
+** a pixel of the screen, 16-bit samples are cut down to their high byte
+*/
+#ifdef LCD_RGB565
+typedef uint16_t Png_Pixel;
+#define PNG_PIXEL(red, green, blue) ((((red) >> 3) << 11) | (((green) >> 2) << 5) | ((blue) >> 3))
+#else
+typedef uint32_t Png_Pixel;
+#define PNG_PIXEL(red, green, blue) (0xFF000000 | ((red) << 16) | ((green) << 8) | (blue))
+#endif
+
+/*
+** a canonical Huffman code of a deflate block, the number of codes of each
+** length and the symbols in the order of their codes. Codes of up to
+** PNG_FAST_BITS are also in a table indexed by the next bits of the stream,
+** holding the symbol and the length of its code (0 for a longer code)
+*/
+typedef struct {
+    uint16_t counts[16];
+    uint16_t symbols[288];
+    uint16_t fast[1 << PNG_FAST_BITS];
+} Png_Huffman;
+
+/*
+** the png being decoded, read a buffer at a time with the chunk headers and
+** CRCs around the image data skipped as they go by, and the state of the
+** inflate between two rows: the block being decoded and the rest of a match
+** that didn't fit in the last row
+*/
+static struct {
+    FIL *file;
+    const uint8_t *memory;
+    // offset of the byte after the last one read, end of the png, and if
+    // the file must be seeked there before the next read
+    FSIZE_t offset;
+    FSIZE_t end;
+    bool seek;
+    uint32_t bytes_read;
+    // bytes of the last read not used yet
+    const uint8_t *next;
+    const uint8_t *last;
+    // bytes of image data left in the current chunk, set once the image
+    // data is used up and the bytes the bit buffer read past it
+    uint32_t chunk_left;
+    bool data_end;
+    uint32_t overrun;
+    bool failed;
+    // bits of the image data not used yet, the next one in the lowest bit
+    uint32_t bits;
+    uint32_t count;
+    // block being decoded, if it is the last one and the bytes of a stored
+    // block left
+    enum { PNG_BLOCK, PNG_STORED, PNG_CODES, PNG_DONE } block;
+    bool final;
+    uint32_t stored;
+    const Png_Huffman *lengths;
+    const Png_Huffman *distances;
+    // match still to be copied and where the next byte goes in the window
+    uint32_t length;
+    uint32_t distance;
+    uint32_t position;
+    uint32_t produced;
+    // image header, bytes of a pixel for the filters (at least 1) and of a
+    // row without its filter byte
+    uint32_t width;
+    uint32_t height;
+    uint8_t depth;
+    uint8_t color_type;
+    uint32_t bpp;
+    uint32_t row_size;
+    uint32_t row;
+    // pixels of the palette, or the gray levels of a gray image
+    Png_Pixel palette[256];
+} png;
+
+static uint8_t png_input[PNG_INPUT_SIZE] __attribute__((aligned(4)));
+
+// the codes of a block of fixed codes, the codes of the current dynamic
+// block and the code its code lengths are sent in
+static Png_Huffman png_fixed_lengths, png_fixed_distances;
+static Png_Huffman png_lengths, png_distances, png_code_lengths;
+static bool png_fixed_built;
+
+// base and extra bits of the length symbols 257-285 and distance symbols 0-29
+static const uint16_t png_length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+static const uint8_t png_length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+static const uint16_t png_distance_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+};
+static const uint8_t png_distance_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+
+// order the lengths of the code length code are sent in
+static const uint8_t png_code_length_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15,
+};
+
+#ifdef COVER_BENCHMARK
+// the deflated image data of the png Png_MakeBenchmark() writes
+static struct {
+    uint8_t *out;
+    uint32_t bits;
+    uint32_t count;
+} png_writer;
+#endif
+
+static const uint8_t png_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+static bool png_start(FIL *file, const uint8_t *memory, FSIZE_t offset, uint32_t size, uint32_t *width,
+                      uint32_t *height);
+static bool png_header(const uint8_t *header);
+static bool png_fill(void);
+static bool png_raw(uint8_t *data, uint32_t len);
+static void png_skip(uint32_t len);
+static uint8_t png_byte(void);
+static uint8_t png_next_chunk(void);
+static void png_need(uint32_t bits);
+static uint32_t png_take(uint32_t bits);
+static bool png_build(Png_Huffman *code, const uint8_t *lengths, uint32_t count);
+static uint32_t png_decode(const Png_Huffman *code);
+static bool png_dynamic(void);
+static bool png_inflate(uint8_t *out, uint32_t len);
+static bool png_unfilter(uint8_t filter, uint8_t *row, const uint8_t *previous);
+static void png_convert(const uint8_t *row, Png_Pixel *out);
+static uint32_t png_reverse(uint32_t value, uint32_t bits);
+static uint32_t png_be32(const uint8_t *bytes);
+#ifdef COVER_BENCHMARK
+static void png_put_bits(uint32_t value, uint32_t bits);
+static void png_put_symbol(uint32_t symbol);
+static uint8_t *png_put_chunk(uint8_t *out, const char *type, const uint8_t *data, uint32_t len);
+static void png_put_be32(uint8_t *bytes, uint32_t value);
+#endif
+
+/*
+** Returns 'true' if the image at the current position of 'file' starts with
+** the png signature, the file is seeked back to where the image starts
+*/
+bool Png_IsPng(FIL *file) {
+    uint8_t signature[sizeof(png_signature)];
+    UINT bytes_read = 0;
+    FSIZE_t start = f_tell(file);
+
+    bool found = f_read(file, signature, sizeof(signature), &bytes_read) == FR_OK &&
+                 bytes_read == sizeof(signature) && memcmp(signature, png_signature, sizeof(signature)) == 0;
+    f_lseek(file, start);
+    return found;
+}
+
+/*
+** Reads the width and height of the png image at the current position of
+** 'file' from its header without decoding it, the file is seeked back to
+** where the image starts afterwards
+** Returns 'true' if it is a png
+*/
+bool Png_ReadSize(FIL *file, uint16_t *width, uint16_t *height) {
+    // the signature, then the length and type of the header chunk and the
+    // size it starts with
+    uint8_t header[24];
+    UINT bytes_read = 0;
+    FSIZE_t start = f_tell(file);
+
+    bool found = f_read(file, header, sizeof(header), &bytes_read) == FR_OK && bytes_read == sizeof(header) &&
+                 memcmp(header, png_signature, sizeof(png_signature)) == 0 && memcmp(header + 12, "IHDR", 4) == 0;
+    f_lseek(file, start);
+    if (!found) return false;
+
+    uint32_t w = png_be32(header + 16);
+    uint32_t h = png_be32(header + 20);
+    *width = (w > UINT16_MAX) ? UINT16_MAX : w;
+    *height = (h > UINT16_MAX) ? UINT16_MAX : h;
+    return true;
+}
+
+/*
+** Starts decoding the png image of 'size' bytes at 'offset' in 'file', its
+** chunks are read up to the start of the image data and its size is put in
+** 'width' and 'height'. 'file' must stay open until every row is decoded
+** Returns 'false' if it isn't a png that can be decoded
+*/
+bool Png_Start(FIL *file, FSIZE_t offset, uint32_t size, uint32_t *width, uint32_t *height) {
+    return png_start(file, NULL, offset, size, width, height);
+}
+
+/*
+** Inflates and unfilters the next row of the image and writes its pixels to
+** 'destination' in the pixel format of the screen, reading more of the file
+** whenever the image data runs out
+** Returns 'false' if the image is broken or has no rows left
+*/
+bool Png_Row(void *destination) {
+    if (png.failed || png.row >= png.height) return false;
+
+    // the two rows take turns, the other one is the row above
+    uint8_t *row = (uint8_t *)SDRAM_PNG_ROWS + (png.row & 1) * PNG_ROW_SIZE;
+    const uint8_t *previous = (const uint8_t *)SDRAM_PNG_ROWS + ((png.row & 1) ^ 1) * PNG_ROW_SIZE;
+    if (!png_inflate(row, 1 + png.row_size)) return false;
+    if (!png_unfilter(row[0], row + 1, previous + 1)) return false;
+
+    png_convert(row + 1, destination);
+    png.row++;
+    return true;
+}
+
+/*
+** Returns the number of bytes of the png read from the card since it started
+*/
+uint32_t Png_BytesRead(void) {
+    return png.bytes_read;
+}
+
+#ifdef COVER_BENCHMARK
+/*
+** Writes a made up RGB png of 'width' by 'height' to 'data', its rows use
+** every filter in turn and its image data is deflated with fixed codes, both
+** literals and matches, like a real cover. Its CRCs and checksum are left
+** out as the decoder doesn't check them. 'width' can be at most 1024
+** Returns the size of the png
+*/
+uint32_t Png_MakeBenchmark(uint8_t *data, uint32_t width, uint32_t height) {
+    static const uint8_t header[13] = { 0, 0, 0, 0, 0, 0, 0, 0, 8, 2, 0, 0, 0 };
+    uint32_t size = 1 + width * 3;
+    uint32_t seed = 1;
+
+    // the header, then the image data as a single chunk whose length is
+    // filled in once it is deflated
+    memcpy(data, png_signature, sizeof(png_signature));
+    png_writer.out = png_put_chunk(data + sizeof(png_signature), "IHDR", header, sizeof(header));
+    png_put_be32(png_writer.out - 4 - 13, width);
+    png_put_be32(png_writer.out - 4 - 9, height);
+    uint8_t *chunk = png_writer.out;
+    png_writer.out += 8;
+    *png_writer.out++ = 0x78;
+    *png_writer.out++ = 0x01;
+    png_writer.bits = 0;
+    png_writer.count = 0;
+    png_put_bits(1, 1);
+    png_put_bits(1, 2);
+
+    // the rows and filtered rows before and after, in the rows of the decoder
+    uint8_t *rows = (uint8_t *)SDRAM_PNG_ROWS;
+    memset(rows, 0, 4 * size);
+    for (uint32_t y = 0; y < height; y++) {
+        uint8_t *row = rows + (y & 1) * size;
+        const uint8_t *previous = rows + ((y & 1) ^ 1) * size;
+        uint8_t *filtered = rows + (2 + (y & 1)) * size;
+        const uint8_t *above = rows + (2 + ((y & 1) ^ 1)) * size;
+
+        // a noisy gradient on the left and flat tiles on the right
+        for (uint32_t x = 0; x < width; x++) {
+            uint8_t *pixel = row + 1 + x * 3;
+            seed = seed * 1103515245 + 12345;
+            if (x < width / 2) {
+                pixel[0] = x + (seed >> 29);
+                pixel[1] = y + ((seed >> 26) & 7);
+                pixel[2] = (x + y) / 2 + ((seed >> 23) & 7);
+            } else {
+                pixel[0] = (x / 32) * 40 + (y / 32) * 16;
+                pixel[1] = (x / 32) * 8 + (y / 32) * 48;
+                pixel[2] = (x / 32) * 24;
+            }
+        }
+
+        filtered[0] = y % 5;
+        for (uint32_t i = 1; i < size; i++) {
+            int32_t a = (i > 3) ? row[i - 3] : 0;
+            int32_t b = previous[i];
+            int32_t c = (i > 3) ? previous[i - 3] : 0;
+            int32_t pa = (b - c < 0) ? c - b : b - c;
+            int32_t pb = (a - c < 0) ? c - a : a - c;
+            int32_t pc = (a + b - 2 * c < 0) ? 2 * c - a - b : a + b - 2 * c;
+            int32_t predicted[5] = { 0, a, b, (a + b) >> 1, (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c };
+            filtered[i] = row[i] - predicted[filtered[0]];
+        }
+
+        // the longest match with the pixel before or the row above
+        for (uint32_t i = 0; i < size;) {
+            uint32_t best = 0;
+            uint32_t distance = 0;
+            for (uint32_t len = 0; i >= 3 && len < 258 && i + len < size && filtered[i + len] == filtered[i + len - 3];
+                 len++) {
+                best = len + 1;
+                distance = 3;
+            }
+            uint32_t len = 0;
+            while (y > 0 && len < 258 && i + len < size && filtered[i + len] == above[i + len]) len++;
+            if (len > best) {
+                best = len;
+                distance = size;
+            }
+
+            if (best < 3) {
+                png_put_symbol(filtered[i++]);
+                continue;
+            }
+            uint32_t code = 28;
+            while (png_length_base[code] > best) code--;
+            png_put_symbol(257 + code);
+            png_put_bits(best - png_length_base[code], png_length_extra[code]);
+            code = 29;
+            while (png_distance_base[code] > distance) code--;
+            png_put_bits(png_reverse(code, 5), 5);
+            png_put_bits(distance - png_distance_base[code], png_distance_extra[code]);
+            i += best;
+        }
+    }
+
+    png_put_symbol(256);
+    png_put_bits(0, 7);
+    memset(png_writer.out, 0, 4);
+    png_writer.out += 4;
+    uint32_t len = png_writer.out - chunk - 8;
+    png_put_be32(chunk, len);
+    memcpy(chunk + 4, "IDAT", 4);
+    memset(png_writer.out, 0, 4);
+    png_writer.out = png_put_chunk(png_writer.out + 4, "IEND", NULL, 0);
+    return png_writer.out - data;
+}
+
+/*
+** Starts decoding the png image of 'size' bytes at 'data' like Png_Start()
+** does for a file, so the decoding can be timed without the card
+** Returns 'false' if it isn't a png that can be decoded
+*/
+bool Png_StartMemory(const uint8_t *data, uint32_t size, uint32_t *width, uint32_t *height) {
+    return png_start(NULL, data, 0, size, width, height);
+}
+#endif
+
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/* HELPERS                                                                    */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+
+/*
+** Starts decoding the png of 'size' bytes at 'offset' in 'file', or at
+** 'memory' if it isn't NULL: the chunks before the image data are read, the
+** palette is kept and everything else is skipped by its length
+** Returns 'false' if it isn't a png that can be decoded
+*/
+bool png_start(FIL *file, const uint8_t *memory, FSIZE_t offset, uint32_t size, uint32_t *width,
+               uint32_t *height) {
+    png.file = file;
+    png.memory = memory;
+    png.offset = offset;
+    png.end = offset + size;
+    png.seek = (memory == NULL);
+    png.bytes_read = 0;
+    png.next = NULL;
+    png.last = NULL;
+    png.chunk_left = 0;
+    png.data_end = false;
+    png.overrun = 0;
+    png.failed = true;
+    png.width = 0;
+    png.height = 0;
+    png.row = 0;
+
+    uint8_t header[13];
+    if (!png_raw(header, sizeof(png_signature)) || memcmp(header, png_signature, sizeof(png_signature)) != 0) {
+        return false;
+    }
+
+    // the header comes first, the palette has to come before the image data
+    bool seen_header = false;
+    for (;;) {
+        if (!png_raw(header, 8)) return false;
+        uint32_t len = png_be32(header);
+        if (!seen_header && memcmp(header + 4, "IHDR", 4) != 0) return false;
+
+        if (memcmp(header + 4, "IHDR", 4) == 0) {
+            if (seen_header || len != 13 || !png_raw(header, 13) || !png_header(header)) return false;
+            seen_header = true;
+            png_skip(4);
+        } else if (memcmp(header + 4, "PLTE", 4) == 0) {
+            if (len % 3 != 0 || len > 3 * 256) return false;
+            for (uint32_t i = 0; i < len / 3; i++) {
+                uint8_t entry[3];
+                if (!png_raw(entry, 3)) return false;
+                if (png.color_type == 3) png.palette[i] = PNG_PIXEL(entry[0], entry[1], entry[2]);
+            }
+            png_skip(4);
+        } else if (memcmp(header + 4, "IDAT", 4) == 0) {
+            png.chunk_left = len;
+            break;
+        } else if (memcmp(header + 4, "IEND", 4) == 0) {
+            return false;
+        } else {
+            png_skip(len + 4);
+        }
+    }
+
+    // the zlib header, deflate with a window of at most 32KB and no preset
+    // dictionary
+    png.failed = false;
+    png.bits = 0;
+    png.count = 0;
+    uint32_t method = png_take(8);
+    uint32_t flags = png_take(8);
+    if (png.failed || (method & 0x0F) != 8 || (method >> 4) > 7 || ((method << 8) | flags) % 31 != 0 ||
+        (flags & 0x20) != 0) {
+        png.failed = true;
+        return false;
+    }
+
+    if (!png_fixed_built) {
+        uint8_t lengths[288];
+        for (uint32_t i = 0; i < 288; i++) lengths[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+        png_build(&png_fixed_lengths, lengths, 288);
+        for (uint32_t i = 0; i < 30; i++) lengths[i] = 5;
+        png_build(&png_fixed_distances, lengths, 30);
+        png_fixed_built = true;
+    }
+
+    png.block = PNG_BLOCK;
+    png.final = false;
+    png.length = 0;
+    png.position = 0;
+    png.produced = 0;
+
+    // the first row is unfiltered against a row of zeros
+    memset((uint8_t *)SDRAM_PNG_ROWS + PNG_ROW_SIZE, 0, 1 + png.row_size);
+
+    *width = png.width;
+    *height = png.height;
+    return true;
+}
+
+/*
+** Checks the 13 bytes of the image header at 'header' and keeps the size and
+** format of the image, gray levels are put in the palette
+** Returns 'false' if the image can't be decoded
+*/
+bool png_header(const uint8_t *header) {
+    png.width = png_be32(header);
+    png.height = png_be32(header + 4);
+    png.depth = header[8];
+    png.color_type = header[9];
+
+    uint32_t channels;
+    switch (png.color_type) {
+    case 0: channels = 1; break;
+    case 2: channels = 3; break;
+    case 3: channels = 1; break;
+    case 4: channels = 2; break;
+    case 6: channels = 4; break;
+    default: return false;
+    }
+
+    // every depth the color type allows, compression, filter and interlace
+    // methods other than 0 are either unknown or interlacing
+    uint8_t depth = png.depth;
+    bool valid = (depth == 8) || (depth == 16 && png.color_type != 3) ||
+                 ((depth == 1 || depth == 2 || depth == 4) && (png.color_type == 0 || png.color_type == 3));
+    if (!valid || header[10] != 0 || header[11] != 0 || header[12] != 0) return false;
+    if (png.width == 0 || png.width > PNG_MAX_WIDTH || png.height == 0 || png.height > UINT16_MAX) return false;
+
+    png.bpp = (channels * depth + 7) / 8;
+    png.row_size = (png.width * channels * depth + 7) / 8;
+
+    // a palette without enough entries leaves the rest black
+    if (png.color_type == 3) {
+        for (uint32_t i = 0; i < 256; i++) png.palette[i] = PNG_PIXEL(0, 0, 0);
+    } else if (png.color_type == 0 || png.color_type == 4) {
+        uint32_t levels = (depth < 8) ? (1u << depth) : 256;
+        for (uint32_t i = 0; i < levels; i++) {
+            uint32_t gray = i * 255 / (levels - 1);
+            png.palette[i] = PNG_PIXEL(gray, gray, gray);
+        }
+    }
+    return true;
+}
+
+/*
+** Reads the next part of the png into the input buffer, never past its end.
+** The first read after a seek stops at the end of a sector so all the
+** others are whole sectors
+** Returns 'false' if there is nothing left to read or the read failed
+*/
+bool png_fill(void) {
+    if (png.offset >= png.end) return false;
+
+    if (png.memory != NULL) {
+        png.next = png.memory + png.offset;
+        png.last = png.memory + png.end;
+        png.offset = png.end;
+        return true;
+    }
+
+    if (png.seek && f_lseek(png.file, png.offset) != FR_OK) return false;
+    png.seek = false;
+
+    UINT len = PNG_INPUT_SIZE - png.offset % _MIN_SS;
+    if (png.end - png.offset < len) len = png.end - png.offset;
+
+    UINT bytes_read = 0;
+    if (f_read(png.file, png_input, len, &bytes_read) != FR_OK || bytes_read == 0) return false;
+    png.offset += bytes_read;
+    png.bytes_read += bytes_read;
+    png.next = png_input;
+    png.last = png_input + bytes_read;
+    return true;
+}
+
+/*
+** Copies the next 'len' bytes of the png to 'data'
+** Returns 'false' if the png ends before that
+*/
+bool png_raw(uint8_t *data, uint32_t len) {
+    while (len > 0) {
+        if (png.next == png.last && !png_fill()) return false;
+        uint32_t size = png.last - png.next;
+        if (size > len) size = len;
+        memcpy(data, png.next, size);
+        png.next += size;
+        data += size;
+        len -= size;
+    }
+    return true;
+}
+
+/*
+** Skips the next 'len' bytes of the png, seeking past them if they aren't
+** read yet so a large chunk costs a seek rather than reads
+*/
+void png_skip(uint32_t len) {
+    uint32_t size = png.last - png.next;
+    if (len <= size) {
+        png.next += len;
+        return;
+    }
+    png.offset += len - size;
+    png.next = png.last;
+    png.seek = (png.memory == NULL);
+}
+
+/*
+** Returns the next byte of the image data, the bytes past its end are 0
+*/
+uint8_t png_byte(void) {
+    if (png.chunk_left != 0 && png.next != png.last) {
+        png.chunk_left--;
+        return *png.next++;
+    }
+    return png_next_chunk();
+}
+
+/*
+** Moves on to the next chunk of image data when the current one is used up,
+** or reads more of the png when the buffer is, and then does what
+** png_byte() does
+** Returns the next byte of the image data
+*/
+uint8_t png_next_chunk(void) {
+    while (png.chunk_left == 0 && !png.data_end) {
+        // skip the CRC of the chunk that ended, the image data goes on in
+        // the next chunk if it is another IDAT
+        uint8_t header[8];
+        png_skip(4);
+        if (png_raw(header, 8) && memcmp(header + 4, "IDAT", 4) == 0) {
+            png.chunk_left = png_be32(header);
+        } else {
+            png.data_end = true;
+        }
+    }
+
+    if (png.data_end) {
+        if (++png.overrun > PNG_OVERRUN) png.failed = true;
+        return 0;
+    }
+    if (png.next == png.last && !png_fill()) {
+        png.failed = true;
+        return 0;
+    }
+    png.chunk_left--;
+    return *png.next++;
+}
+
+/*
+** Makes sure the bit buffer holds at least 'bits' bits, at most 24
+*/
+void png_need(uint32_t bits) {
+    while (png.count < bits) {
+        png.bits |= (uint32_t)png_byte() << png.count;
+        png.count += 8;
+    }
+}
+
+/*
+** Returns the next 'bits' bits of the image data, at most 24
+*/
+uint32_t png_take(uint32_t bits) {
+    png_need(bits);
+    uint32_t value = png.bits & ((1u << bits) - 1);
+    png.bits >>= bits;
+    png.count -= bits;
+    return value;
+}
+
+/*
+** Builds the canonical Huffman code of the 'count' symbols with the code
+** lengths in 'lengths' (0 for an unused symbol) into 'code'. A code that
+** doesn't use up every bit pattern is fine, decoding a missing one fails
+** Returns 'false' if there are more codes of some length than fit
+*/
+bool png_build(Png_Huffman *code, const uint8_t *lengths, uint32_t count) {
+    uint16_t offsets[16];
+
+    for (uint32_t len = 0; len < 16; len++) code->counts[len] = 0;
+    for (uint32_t i = 0; i < count; i++) code->counts[lengths[i]]++;
+    code->counts[0] = 0;
+
+    int32_t left = 1;
+    for (uint32_t len = 1; len < 16; len++) {
+        left = (left << 1) - code->counts[len];
+        if (left < 0) return false;
+    }
+
+    offsets[1] = 0;
+    for (uint32_t len = 1; len < 15; len++) offsets[len + 1] = offsets[len] + code->counts[len];
+    for (uint32_t i = 0; i < count; i++) {
+        if (lengths[i] != 0) code->symbols[offsets[lengths[i]]++] = i;
+    }
+
+    // the stream holds codes starting with their highest bit, so the table
+    // is indexed by the reversed code and every entry the bits after it
+    // could make
+    for (uint32_t i = 0; i < (1 << PNG_FAST_BITS); i++) code->fast[i] = 0;
+    uint32_t next = 0;
+    uint32_t index = 0;
+    for (uint32_t len = 1; len <= PNG_FAST_BITS; len++) {
+        for (uint32_t i = 0; i < code->counts[len]; i++, next++, index++) {
+            for (uint32_t j = png_reverse(next, len); j < (1 << PNG_FAST_BITS); j += 1u << len) {
+                code->fast[j] = (code->symbols[index] << 4) | len;
+            }
+        }
+        next <<= 1;
+    }
+    return true;
+}
+
+/*
+** Decodes the next symbol of 'code', by the table if its code is short
+** enough and a bit at a time otherwise
+** Returns the symbol, or 256 having set 'failed' for a missing code
+*/
+uint32_t png_decode(const Png_Huffman *code) {
+    png_need(15);
+    uint32_t entry = code->fast[png.bits & ((1 << PNG_FAST_BITS) - 1)];
+    if (entry != 0) {
+        png.bits >>= entry & 0x0F;
+        png.count -= entry & 0x0F;
+        return entry >> 4;
+    }
+
+    // the codes of each length follow the ones of the length before, so
+    // the code is in range once it is below the first code after them
+    int32_t first = 0;
+    int32_t index = 0;
+    int32_t bits = 0;
+    for (uint32_t len = 1; len < 16; len++) {
+        bits |= (png.bits >> (len - 1)) & 1;
+        int32_t count = code->counts[len];
+        if (bits - first < count) {
+            png.bits >>= len;
+            png.count -= len;
+            return code->symbols[index + bits - first];
+        }
+        index += count;
+        first = (first + count) << 1;
+        bits <<= 1;
+    }
+    png.failed = true;
+    return 256;
+}
+
+/*
+** Reads the code lengths of a block of dynamic codes and builds its codes
+** Returns 'false' if they are broken
+*/
+bool png_dynamic(void) {
+    uint8_t lengths[288 + 32];
+    uint32_t literals = png_take(5) + 257;
+    uint32_t distances = png_take(5) + 1;
+    uint32_t code_lengths = png_take(4) + 4;
+    if (literals > 286 || distances > 30) return false;
+
+    for (uint32_t i = 0; i < 19; i++) {
+        lengths[png_code_length_order[i]] = (i < code_lengths) ? png_take(3) : 0;
+    }
+    if (!png_build(&png_code_lengths, lengths, 19)) return false;
+
+    // the lengths of both codes are sent as one run, a repeat can carry on
+    // from one into the other
+    for (uint32_t i = 0; i < literals + distances;) {
+        uint32_t symbol = png_decode(&png_code_lengths);
+        if (symbol < 16) {
+            lengths[i++] = symbol;
+            continue;
+        }
+
+        uint32_t repeat;
+        uint8_t value = 0;
+        if (symbol == 16) {
+            if (i == 0) return false;
+            value = lengths[i - 1];
+            repeat = 3 + png_take(2);
+        } else if (symbol == 17) {
+            repeat = 3 + png_take(3);
+        } else if (symbol == 18) {
+            repeat = 11 + png_take(7);
+        } else {
+            return false;
+        }
+        if (i + repeat > literals + distances) return false;
+        while (repeat-- > 0) lengths[i++] = value;
+    }
+
+    // there has to be a code for the end of the block
+    if (png.failed || lengths[256] == 0) return false;
+    if (!png_build(&png_lengths, lengths, literals)) return false;
+    if (!png_build(&png_distances, lengths + literals, distances)) return false;
+    png.lengths = &png_lengths;
+    png.distances = &png_distances;
+    return true;
+}
+
+/*
+** Inflates the next 'len' bytes of the image data into 'out', keeping them
+** in the window for the matches after them. A match that goes on past 'len'
+** is finished by the next call
+** Returns 'false' if the image data is broken or ends before that
+*/
+bool png_inflate(uint8_t *out, uint32_t len) {
+    uint8_t *window = (uint8_t *)SDRAM_PNG_WINDOW;
+
+    while (len > 0) {
+        if (png.failed) return false;
+
+        if (png.length > 0) {
+            uint32_t size = (png.length < len) ? png.length : len;
+            uint32_t from = (png.position - png.distance) & PNG_WINDOW_MASK;
+            png.length -= size;
+            png.produced += size;
+            len -= size;
+            while (size-- > 0) {
+                uint8_t value = window[from];
+                window[png.position] = value;
+                *out++ = value;
+                from = (from + 1) & PNG_WINDOW_MASK;
+                png.position = (png.position + 1) & PNG_WINDOW_MASK;
+            }
+            continue;
+        }
+
+        switch (png.block) {
+        case PNG_BLOCK: {
+            if (png.final) {
+                png.block = PNG_DONE;
+                break;
+            }
+            png.final = png_take(1);
+            uint32_t type = png_take(2);
+            if (type == 0) {
+                // stored bytes start on a byte boundary
+                png_take(png.count & 7);
+                png.stored = png_take(16);
+                if (png.stored != (png_take(16) ^ 0xFFFF)) png.failed = true;
+                png.block = PNG_STORED;
+            } else if (type == 1) {
+                png.lengths = &png_fixed_lengths;
+                png.distances = &png_fixed_distances;
+                png.block = PNG_CODES;
+            } else if (type == 2 && png_dynamic()) {
+                png.block = PNG_CODES;
+            } else {
+                png.failed = true;
+            }
+            break;
+        }
+
+        case PNG_STORED:
+            if (png.stored == 0) {
+                png.block = PNG_BLOCK;
+                break;
+            }
+            while (png.stored > 0 && len > 0) {
+                uint8_t value = png_take(8);
+                window[png.position] = value;
+                *out++ = value;
+                png.position = (png.position + 1) & PNG_WINDOW_MASK;
+                png.produced++;
+                png.stored--;
+                len--;
+            }
+            break;
+
+        case PNG_CODES:
+            while (len > 0 && !png.failed) {
+                uint32_t symbol = png_decode(png.lengths);
+                if (symbol < 256) {
+                    window[png.position] = symbol;
+                    *out++ = symbol;
+                    png.position = (png.position + 1) & PNG_WINDOW_MASK;
+                    png.produced++;
+                    len--;
+                    continue;
+                }
+                if (symbol == 256) {
+                    png.block = PNG_BLOCK;
+                    break;
+                }
+
+                symbol -= 257;
+                if (symbol >= 29) {
+                    png.failed = true;
+                    break;
+                }
+                png.length = png_length_base[symbol] + png_take(png_length_extra[symbol]);
+                symbol = png_decode(png.distances);
+                if (symbol >= 30) {
+                    png.failed = true;
+                    break;
+                }
+                png.distance = png_distance_base[symbol] + png_take(png_distance_extra[symbol]);
+                if (png.distance > png.produced) png.failed = true;
+                break;
+            }
+            break;
+
+        case PNG_DONE:
+            png.failed = true;
+            break;
+        }
+    }
+    return !png.failed;
+}
+
+/*
+** Undoes 'filter' on 'row' in place, against the unfiltered 'previous' row
+** Returns 'false' for an unknown filter
+*/
+bool png_unfilter(uint8_t filter, uint8_t *row, const uint8_t *previous) {
+    uint32_t bpp = png.bpp;
+    uint32_t size = png.row_size;
+
+    switch (filter) {
+    case 0: break;
+
+    case 1:
+        for (uint32_t i = bpp; i < size; i++) row[i] += row[i - bpp];
+        break;
+
+    case 2:
+        for (uint32_t i = 0; i < size; i++) row[i] += previous[i];
+        break;
+
+    case 3:
+        for (uint32_t i = 0; i < bpp; i++) row[i] += previous[i] >> 1;
+        for (uint32_t i = bpp; i < size; i++) row[i] += (row[i - bpp] + previous[i]) >> 1;
+        break;
+
+    case 4:
+        // the left and upper left bytes of the first pixel are 0, so it
+        // always predicts from the byte above
+        for (uint32_t i = 0; i < bpp; i++) row[i] += previous[i];
+        for (uint32_t i = bpp; i < size; i++) {
+            int32_t a = row[i - bpp];
+            int32_t b = previous[i];
+            int32_t c = previous[i - bpp];
+            int32_t pa = b - c;
+            int32_t pb = a - c;
+            int32_t pc = pa + pb;
+            pa = (pa < 0) ? -pa : pa;
+            pb = (pb < 0) ? -pb : pb;
+            pc = (pc < 0) ? -pc : pc;
+            row[i] += (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+        }
+        break;
+
+    default:
+        png.failed = true;
+        return false;
+    }
+    return true;
+}
+
+/*
+** Writes the pixels of the unfiltered 'row' to 'out' in the pixel format of
+** the screen, gray and palette pixels by their entry in the palette and the
+** rest by the high byte of each sample
+*/
+void png_convert(const uint8_t *row, Png_Pixel *out) {
+    uint32_t width = png.width;
+
+    if (png.depth < 8) {
+        // the pixels of a byte start at its highest bits
+        uint32_t depth = png.depth;
+        uint32_t mask = (1u << depth) - 1;
+        uint32_t shift = 8;
+        for (uint32_t i = 0; i < width; i++) {
+            if (shift == 0) {
+                row++;
+                shift = 8;
+            }
+            shift -= depth;
+            out[i] = png.palette[(*row >> shift) & mask];
+        }
+    } else if (png.color_type != 2 && png.color_type != 6) {
+        uint32_t bpp = png.bpp;
+        for (uint32_t i = 0; i < width; i++, row += bpp) out[i] = png.palette[row[0]];
+    } else {
+        uint32_t bpp = png.bpp;
+        uint32_t sample = png.depth / 8;
+        for (uint32_t i = 0; i < width; i++, row += bpp) out[i] = PNG_PIXEL(row[0], row[sample], row[2 * sample]);
+    }
+}
+
+/*
+** Returns the 'bits' lowest bits of 'value' in reverse order
+*/
+uint32_t png_reverse(uint32_t value, uint32_t bits) {
+    uint32_t reversed = 0;
+    for (uint32_t bit = 0; bit < bits; bit++) reversed |= ((value >> bit) & 1) << (bits - 1 - bit);
+    return reversed;
+}
+
+#ifdef COVER_BENCHMARK
+/*
+** Writes the 'bits' lowest bits of 'value' to the deflated image data
+*/
+void png_put_bits(uint32_t value, uint32_t bits) {
+    png_writer.bits |= value << png_writer.count;
+    png_writer.count += bits;
+    while (png_writer.count >= 8) {
+        *png_writer.out++ = png_writer.bits;
+        png_writer.bits >>= 8;
+        png_writer.count -= 8;
+    }
+}
+
+/*
+** Writes the fixed code of literal or length symbol 'symbol'
+*/
+void png_put_symbol(uint32_t symbol) {
+    if (symbol < 144) {
+        png_put_bits(png_reverse(0x30 + symbol, 8), 8);
+    } else if (symbol < 256) {
+        png_put_bits(png_reverse(0x190 + symbol - 144, 9), 9);
+    } else if (symbol < 280) {
+        png_put_bits(png_reverse(symbol - 256, 7), 7);
+    } else {
+        png_put_bits(png_reverse(0xC0 + symbol - 280, 8), 8);
+    }
+}
+
+/*
+** Writes a chunk of type 'type' holding the 'len' bytes at 'data' to 'out',
+** without its CRC
+** Returns the end of the chunk
+*/
+uint8_t *png_put_chunk(uint8_t *out, const char *type, const uint8_t *data, uint32_t len) {
+    png_put_be32(out, len);
+    memcpy(out + 4, type, 4);
+    if (len > 0) memcpy(out + 8, data, len);
+    memset(out + 8 + len, 0, 4);
+    return out + 12 + len;
+}
+
+/*
+** Writes 'value' to 'bytes' as a big-endian 32-bit value
+*/
+void png_put_be32(uint8_t *bytes, uint32_t value) {
+    bytes[0] = value >> 24;
+    bytes[1] = value >> 16;
+    bytes[2] = value >> 8;
+    bytes[3] = value;
+}
+#endif
+
+/*
+** Returns the big-endian 32-bit value at 'bytes'
+*/
+uint32_t png_be32(const uint8_t *bytes) {
+    return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+}
@@ -0,0 +1,89 @@
+/* clang-format off */
+
+#include "shuffle.h"
+
+#include <stdint.h>
+
+// rounds of the Feistel network, 4 are enough to mix every bit into every other
+#define SHUFFLE_ROUNDS 4
+
+static uint32_t shuffle_bits(uint32_t count);
+static uint32_t shuffle_round(uint32_t half, uint32_t seed, uint32_t round);
+
+/*
+** Returns where 'position' (< 'count') goes in the shuffle made from 'seed',
+** every position in [0, count) is returned for exactly one 'position'
+*/
+uint32_t Shuffle_Position(uint32_t position, uint32_t count, uint32_t seed) {
+    uint32_t bits = shuffle_bits(count);
+    uint32_t mask = (1u << bits) - 1;
+
+    // the network covers at most 4 times 'count' values, so on average it
+    // takes less than 4 passes to land back in range
+    do {
+        uint32_t left = position >> bits;
+        uint32_t right = position & mask;
+        for (uint32_t round = 0; round < SHUFFLE_ROUNDS; round++) {
+            uint32_t next = left ^ (shuffle_round(right, seed, round) & mask);
+            left = right;
+            right = next;
+        }
+        position = (left << bits) | right;
+    } while (position >= count);
+
+    return position;
+}
+
+/*
+** Returns the position that Shuffle_Position() moves to 'shuffled'
+*/
+uint32_t Shuffle_Inverse(uint32_t shuffled, uint32_t count, uint32_t seed) {
+    uint32_t bits = shuffle_bits(count);
+    uint32_t mask = (1u << bits) - 1;
+
+    // the rounds in reverse, walking the same cycle backwards
+    do {
+        uint32_t left = shuffled >> bits;
+        uint32_t right = shuffled & mask;
+        for (uint32_t round = SHUFFLE_ROUNDS; round-- > 0;) {
+            uint32_t prev = right ^ (shuffle_round(left, seed, round) & mask);
+            right = left;
+            left = prev;
+        }
+        shuffled = (left << bits) | right;
+    } while (shuffled >= count);
+
+    return shuffled;
+}
+
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/* HELPERS                                                                    */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+
+/*
+** Returns the number of bits in each half of the Feistel network for 'count'
+** positions (at most 2^30)
+*/
+uint32_t shuffle_bits(uint32_t count) {
+    uint32_t bits = 1;
+    while ((1u << (2 * bits)) < count) bits++;
+    return bits;
+}
+
+/*
+** The round function of the Feistel network, it doesn't have to be
+** invertible so it's just a hash of the half, the seed and the round
+** Returns the hash
+*/
+uint32_t shuffle_round(uint32_t half, uint32_t seed, uint32_t round) {
+    // murmur3 finalizer
+    uint32_t hash = half ^ seed ^ (round * 0x9E3779B9);
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6B;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35;
+    hash ^= hash >> 16;
+    return hash;
+}